@@ -0,0 +1,187 @@
+#include "Batch.h"
+#include <sstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <chrono>
+#include <unordered_map>
+#include <cstdlib>
+
+bool parseManifest(istream& in, vector<BatchJob>& jobs, string& error) {
+    string line;
+    for (size_t number = 1; getline(in, line); number++) {
+        istringstream fields(line);
+        BatchJob job;
+        string budget;
+        if (!(fields >> job.elf) || job.elf[0] == '#') continue;
+
+        char* end = nullptr;
+        if (fields >> budget) job.budget = strtoull(budget.c_str(), &end, 10);
+        if (budget.empty() || budget[0] == '-' || *end != '\0') {
+            error = "line " + to_string(number) + ": expected <elf> <budget> [args...]";
+            return false;
+        }
+        if (job.budget == 0) job.budget = CPU::RUN_UNLIMITED;
+        for (string arg; fields >> arg;) job.args.push_back(arg);
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+namespace {
+
+struct WorkQueue {
+    mutex lock;
+    deque<size_t> items;
+};
+
+bool takeWork(WorkQueue& queue, bool steal, size_t& index) {
+    lock_guard<mutex> guard(queue.lock);
+    if (queue.items.empty()) return false;
+    // The owner works front to back, thieves take from the back
+    if (steal) {
+        index = queue.items.back();
+        queue.items.pop_back();
+    } else {
+        index = queue.items.front();
+        queue.items.pop_front();
+    }
+    return true;
+}
+
+}
+
+void runWorkStealing(size_t count, unsigned workers, const function<void(size_t)>& task) {
+    if (count == 0) return;
+    workers = (unsigned)std::max<size_t>(1, std::min<size_t>(workers, count));
+    vector<WorkQueue> queues(workers);
+    for (unsigned w = 0; w < workers; w++) {
+        for (size_t i = count * w / workers; i < count * (w + 1) / workers; i++) queues[w].items.push_back(i);
+    }
+
+    // No work is added once running, so a worker that finds every queue empty is done
+    auto worker = [&](unsigned self) {
+        size_t index;
+        while (true) {
+            bool found = takeWork(queues[self], false, index);
+            for (unsigned k = 1; !found && k < workers; k++) {
+                found = takeWork(queues[(self + k) % workers], true, index);
+            }
+            if (!found) return;
+            task(index);
+        }
+    };
+    vector<thread> threads;
+    for (unsigned w = 1; w < workers; w++) threads.emplace_back(worker, w);
+    worker(0);
+    for (thread& t : threads) t.join();
+}
+
+// Makes sure "<elf>.dcache" holds a valid decode image: an existing one is
+// kept, otherwise the ELF's code is predecoded and saved
+static bool prepareDecodeCache(const string& elf, const BatchOptions& options) {
+    CPU cpu;
+    cpu.setQuiet(true);
+    cpu.setMemorySize(options.memory_bytes);
+    cpu.setDecodeCache(true);
+    if (!cpu.loadELF(elf)) return false;
+    if (cpu.decodeCacheLoaded()) return true;
+    cpu.predecode();
+    return cpu.saveDecodeCache();
+}
+
+void runBatch(const vector<BatchJob>& jobs, const BatchOptions& options,
+              const function<void(const BatchResult&)>& report) {
+    unsigned threads = options.threads ? options.threads : std::max(1u, thread::hardware_concurrency());
+    mutex report_lock;
+
+    // One decode image per ELF, built by the first of its jobs to start while
+    // the others wait on that ELF's lock. Every job then maps the same file,
+    // so the image is one physical copy in the page cache. A failed build is
+    // retried by the next job, and its own job runs cold.
+    struct CacheState {
+        mutex lock;
+        bool ready = false;
+    };
+    unordered_map<string, unique_ptr<CacheState>> caches;     // Filled before any job starts
+    for (const BatchJob& job : jobs) {
+        if (!caches.count(job.elf)) caches[job.elf].reset(new CacheState());
+    }
+
+    runWorkStealing(jobs.size(), threads, [&](size_t i) {
+        const BatchJob& job = jobs[i];
+        auto start = chrono::steady_clock::now();
+        BatchResult result;
+        result.job = i;
+
+        if (options.decode_cache) {
+            CacheState& cache = *caches.at(job.elf);
+            lock_guard<mutex> guard(cache.lock);
+            if (!cache.ready) cache.ready = prepareDecodeCache(job.elf, options);
+        }
+
+        CPU cpu;
+        cpu.setQuiet(true);
+        cpu.setOutputCapture(true);
+        cpu.setMemorySize(options.memory_bytes);
+        if (options.trap_misaligned) cpu.setMisalignedAccess(MisalignedAccess::Trap);
+        cpu.setDecodeCache(options.decode_cache);
+        if (options.backend == MemoryBackend::Reserved) cpu.setMemoryBackend(MemoryBackend::Reserved);
+        cpu.setEngine(options.engine);  // Unavailable engines fall back to the block interpreter
+
+        vector<string> argv = { job.elf };
+        argv.insert(argv.end(), job.args.begin(), job.args.end());
+        if (cpu.loadELF(job.elf) && cpu.setArgs(argv)) {
+            result.loaded = true;
+            result.warm = cpu.decodeCacheLoaded();
+            result.stop_reason = cpu.run(job.budget);
+            if (result.stop_reason == StopReason::Exit) result.exit_code = (int32_t)cpu.getReg(10);
+            result.instructions = cpu.getInstructionCount();
+        }
+        result.output = cpu.takeOutput();
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        lock_guard<mutex> guard(report_lock);
+        report(result);
+    });
+}
+
+static void appendJsonString(string& out, const string& s) {
+    out += '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c < 0x20 || c >= 0x80) {
+            // Guest output need not be UTF-8, so every byte from 0x80 up is
+            // escaped as the code point of the same value (U+0080-U+00FF)
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+string resultJson(const BatchJob& job, const BatchResult& result) {
+    string out = "{\"job\":" + to_string(result.job) + ",\"elf\":";
+    appendJsonString(out, job.elf);
+    if (!result.loaded) return out + ",\"error\":\"cannot load ELF\"}";
+
+    ostringstream seconds;
+    seconds << fixed << setprecision(6) << result.seconds;
+    out += ",\"stop\":";
+    appendJsonString(out, stopReasonName(result.stop_reason));
+    out += ",\"exit_code\":" + to_string(result.exit_code);
+    out += ",\"instructions\":" + to_string(result.instructions);
+    out += string(",\"warm\":") + (result.warm ? "true" : "false");
+    out += ",\"seconds\":" + seconds.str();
+    out += ",\"stdout\":";
+    appendJsonString(out, result.output);
+    return out + "}";
+}
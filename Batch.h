@@ -0,0 +1,66 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <istream>
+#include <functional>
+#include "CPU.h"
+
+using namespace std;
+
+// Batch runs: many independent programs, one CPU per job, spread over a
+// work-stealing thread pool. Jobs that run the same ELF share its code pages
+// (every job maps the file MAP_PRIVATE, so clean pages are one physical copy
+// in the page cache) and its decoded code (the first job of each ELF to
+// start predecodes it into "<elf>.dcache" unless a valid one exists; every
+// job of that ELF maps it and decodes nothing).
+
+// One manifest line: <elf> <budget> [args...]   (budget 0 = run until exit)
+struct BatchJob {
+    string elf;
+    uint64_t budget = CPU::RUN_UNLIMITED;
+    vector<string> args;    // Guest argv[1..]; argv[0] is the ELF path
+};
+
+struct BatchOptions {
+    unsigned threads = 0;               // 0: one per hardware thread
+    uint64_t memory_bytes = 4 << 20;
+    MemoryBackend backend = MemoryBackend::Paged;
+    Engine engine = Engine::Block;
+    bool trap_misaligned = false;
+    bool decode_cache = true;
+};
+
+struct BatchResult {
+    size_t job = 0;
+    bool loaded = false;                // False: the ELF could not be loaded
+    StopReason stop_reason = StopReason::None;
+    int32_t exit_code = -1;             // a0 at the exit syscall, -1 otherwise
+    uint64_t instructions = 0;
+    bool warm = false;                  // Started from a decode cache
+    double seconds = 0;
+    string output;                      // What the print syscalls produced
+};
+
+// Blank lines and lines starting with '#' are skipped. Arguments are split on
+// whitespace. False (with a message naming the line) on a malformed line.
+bool parseManifest(istream& in, vector<BatchJob>& jobs, string& error);
+
+// Runs every job; `report` is called once per job as it finishes (in
+// completion order, never concurrently)
+void runBatch(const vector<BatchJob>& jobs, const BatchOptions& options,
+              const function<void(const BatchResult&)>& report);
+
+// One JSON object per result, no trailing newline. The line is plain ASCII:
+// output bytes from 0x80 up come out as \u0080-\u00ff, so a reader gets
+// the raw bytes back by taking each code point as one byte (Latin-1).
+string resultJson(const BatchJob& job, const BatchResult& result);
+
+// Calls task(i) for every i in [0, count) on `workers` threads. Each worker
+// starts with a contiguous share of the indices and, once it runs dry, steals
+// from the far end of another worker's share.
+void runWorkStealing(size_t count, unsigned workers, const function<void(size_t)>& task);
+
+#endif
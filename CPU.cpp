@@ -1,28 +1,396 @@
 #include "CPU.h"
-#include "elfio/elfio.hpp"
+#include "elfio/elf_types.hpp"
+#include <cstddef>
+#include <charconv>
 #include <iomanip>
 #include <algorithm>
 
 using namespace ELFIO;
 
-CPU::CPU() {
+CPU::CPU() : CPU(make_shared<SparseMemory>(4 * 1024 * 1024), 0) {} // 4 MB default, allocated page by page on first touch
+
+CPU::CPU(shared_ptr<SparseMemory> shared_memory, uint32_t hart)
+    : memory_owner(std::move(shared_memory)), memory(*memory_owner), hart_id(hart) {
     pc = 0;
     std::fill(std::begin(regs), std::end(regs), 0);
-    memory.resize(4 * 1024 * 1024, 0);  // 4 MB fixed memory
-    regs[2] = memory.size(); // Stack Pointer initialization
+    std::fill(std::begin(fregs), std::end(fregs), 0);
+    std::fill(std::begin(vregs), std::end(vregs), 0);
+    regs[2] = (uint32_t)memory.size(); // Stack Pointer initialization
+    resetProcess(0);
+    if (memory.base()) page_flags.assign(SparseMemory::MAX_SIZE >> SparseMemory::PAGE_BITS, 0);
 
     // regs[10] = 5; // Initialize x10 to 5 for testing
 }
 
+void CPU::memoryChanged() {
+    reservation_valid = false;
+    flushTlbs();
+    flushDecodeCache();
+    dropSnapshot();
+    resetProcess(0);
+    if (memory.base()) {
+        page_flags.assign(SparseMemory::MAX_SIZE >> SparseMemory::PAGE_BITS, 0);
+    } else {
+        vector<uint8_t>().swap(page_flags);
+    }
+}
+
 uint32_t CPU::fetch() {
-    // Bounds check
-    if (pc + 3 >= memory.size()) {
-        if (!quiet_mode) cout << "[ERROR] PC out of bounds: 0x" << hex << pc << endl;
+    return fetchAt(pc);
+}
+
+uint32_t CPU::fetchAt(uint32_t addr) {
+    // Bounds check (the data-access misalignment policy does not apply to fetches)
+    const TlbEntry& e = load_tlb[tlbIndex(addr)];
+    if (e.tag == tlbTag(addr, 4)) return SparseMemory::read<uint32_t>(e.host + (addr & SparseMemory::PAGE_MASK));
+
+    // Parcel by parcel: a compressed instruction may end a page or memory,
+    // and a 32-bit one may straddle two pages
+    uint64_t low, high;
+    if (!loadSlow(addr, 2, low) || ((low & 0x3) == 0x3 && !loadSlow(addr + 2, 2, high))) {
+        if (!quiet_mode) cout << "[ERROR] PC out of bounds: 0x" << hex << addr << endl;
         return 0;
     }
-    
-    // Little-Endian Load
-    return memory[pc] | (memory[pc+1] << 8) | (memory[pc+2] << 16) | (memory[pc+3] << 24);
+    return (uint32_t)((low & 0x3) == 0x3 ? (low | high << 16) : low);
+}
+
+void CPU::flushDecodeCache() {
+    for (const auto& page : decode_pages) {
+        if (page_flags.empty()) break;
+        page_flags[page.first] &= ~PAGE_CODE;
+    }
+    decode_pages.clear();
+    decode_storage.clear();
+    decode_image.reset();
+    decode_cache_loaded = false;
+    for (auto& e : fetch_tlb) e = FetchTlbEntry();
+    for (auto& e : store_tlb) e.code = nullptr;
+    flushBlocks();
+}
+
+void CPU::flushTlbs() {
+    for (auto& e : load_tlb) e = TlbEntry();
+    for (auto& e : store_tlb) e = StoreTlbEntry();
+    for (auto& e : fetch_tlb) e = FetchTlbEntry();
+}
+
+void CPU::setMemorySize(uint64_t bytes) {
+    memory.resize(bytes);
+    reservation_valid = false;
+    flushTlbs();
+    flushDecodeCache();
+    dropSnapshot();
+    regs[2] = (uint32_t)memory.size(); // 4 GiB wraps to 0: the first push lands at the top
+    resetProcess(0);
+}
+
+bool CPU::setMemoryBackend(MemoryBackend backend) {
+    if (!memory.useReservation(backend == MemoryBackend::Reserved)) return false;
+    memoryChanged();
+    return true;
+}
+
+bool CPU::loadSlow(uint32_t addr, uint32_t len, uint64_t& value) {
+    if (!memory.contains(addr, len)) {
+        access_fault = StopReason::Fault;
+        return false;
+    }
+    uint32_t offset = addr & SparseMemory::PAGE_MASK;
+    if (offset + len <= SparseMemory::PAGE_SIZE) {
+        // TLB miss or misaligned within the page: still one host access
+        const uint8_t* p = memory.page(addr) + offset;
+        if (len == 1) value = SparseMemory::read<uint8_t>(p);
+        else if (len == 2) value = SparseMemory::read<uint16_t>(p);
+        else if (len == 4) value = SparseMemory::read<uint32_t>(p);
+        else value = SparseMemory::read<uint64_t>(p);
+    } else {
+        value = 0;
+        for (uint32_t i = 0; i < len; i++) {
+            uint32_t a = addr + i;
+            value |= (uint64_t)memory.page(a)[a & SparseMemory::PAGE_MASK] << (8 * i);
+        }
+    }
+    // Refill: later aligned accesses to this page take the fast path
+    TlbEntry& e = load_tlb[tlbIndex(addr)];
+    e.tag = addr & ~SparseMemory::PAGE_MASK;
+    e.host = memory.page(addr);
+    return true;
+}
+
+bool CPU::storeSlow(uint32_t addr, uint32_t len, uint64_t value) {
+    if (!memory.contains(addr, len)) {
+        access_fault = StopReason::Fault;
+        return false;
+    }
+    if (!page_flags.empty()) storedToCleanPage(addr, len); // Every first store to a page after snapshot() lands here
+    uint32_t offset = addr & SparseMemory::PAGE_MASK;
+    if (offset + len <= SparseMemory::PAGE_SIZE) {
+        uint8_t* p = memory.page(addr) + offset;
+        if (len == 1) SparseMemory::write<uint8_t>(p, value);
+        else if (len == 2) SparseMemory::write<uint16_t>(p, value);
+        else if (len == 4) SparseMemory::write<uint32_t>(p, value);
+        else SparseMemory::write<uint64_t>(p, value);
+    } else {
+        for (uint32_t i = 0; i < len; i++) {
+            uint32_t a = addr + i;
+            memory.page(a)[a & SparseMemory::PAGE_MASK] = (uint8_t)(value >> (8 * i));
+        }
+    }
+    invalidateDecoded(addr, len);
+    fillStoreTlb(addr);
+    return true;
+}
+
+CPU::StoreTlbEntry& CPU::fillStoreTlb(uint32_t addr) {
+    StoreTlbEntry& e = store_tlb[tlbIndex(addr)];
+    e.tag = addr & ~SparseMemory::PAGE_MASK;
+    e.host = memory.page(addr);
+    auto it = decode_pages.find(addr >> SparseMemory::PAGE_BITS);
+    e.code = it != decode_pages.end() ? it->second : nullptr;
+    return e;
+}
+
+void CPU::storedToCleanPage(uint32_t addr, uint32_t len) {
+    // Runs before the store. A store at the top of memory wraps to page 0
+    // (and then faults on the guard page).
+    uint32_t first = addr >> SparseMemory::PAGE_BITS;
+    uint32_t last = ((addr + len - 1) >> SparseMemory::PAGE_BITS) & 0xFFFFF;
+    if (page_flags[first] & PAGE_CLEAN) markDirty(first);
+    if (page_flags[last] & PAGE_CLEAN) markDirty(last);
+}
+
+void CPU::markDirty(uint32_t page_num) {
+    page_flags[page_num] &= ~PAGE_CLEAN;
+    dirty_pages.push_back(page_num);
+    unique_ptr<uint8_t[]>& saved = snapshot_state->pages[page_num];
+    if (!saved) {
+        // First write since the snapshot was taken, in any run: keep the original
+        saved.reset(new uint8_t[SparseMemory::PAGE_SIZE]);
+        memory.read(page_num << SparseMemory::PAGE_BITS, saved.get(), SparseMemory::PAGE_SIZE);
+    }
+}
+
+shared_ptr<Snapshot> CPU::snapshot() {
+    if (memory_owner.use_count() > 1) return nullptr;
+    auto snap = make_shared<Snapshot>();
+    snap->pc = pc;
+    copy(begin(regs), end(regs), snap->regs);
+    copy(begin(fregs), end(fregs), snap->fregs);
+    snap->fcsr = getFcsr();
+    copy(begin(vregs), end(vregs), snap->vregs);
+    snap->vl = vl;
+    snap->vtype = vtype;
+    snap->instruction_count = instruction_count;
+    snap->load_count = load_count;
+    snap->store_count = store_count;
+    snap->taken_branch_count = taken_branch_count;
+    snap->stop_reason = stop_reason;
+    snap->process = process;
+
+    // Every page in range starts clean; the store TLB is emptied so the paged
+    // backend's next store to each page goes through storeSlow
+    if (page_flags.empty()) page_flags.assign(SparseMemory::MAX_SIZE >> SparseMemory::PAGE_BITS, 0);
+    for (uint64_t p = 0; p < (memory.size() >> SparseMemory::PAGE_BITS); p++) page_flags[p] |= PAGE_CLEAN;
+    for (auto& e : store_tlb) e = StoreTlbEntry();
+    dirty_pages.clear();
+    snapshot_state = snap;
+    return snap;
+}
+
+bool CPU::restore(const shared_ptr<Snapshot>& snap) {
+    if (!snap || snap != snapshot_state) return false;
+    for (uint32_t page_num : dirty_pages) {
+        memory.write(page_num << SparseMemory::PAGE_BITS, snap->pages[page_num].get(), SparseMemory::PAGE_SIZE);
+        page_flags[page_num] |= PAGE_CLEAN;
+    }
+    // Decoded code stays valid wherever the restored instruction matches.
+    // Instructions straddling into a restored page are checked against memory.
+    for (uint32_t page_num : dirty_pages) {
+        const uint8_t* saved = snap->pages[page_num].get();
+        uint32_t base = page_num << SparseMemory::PAGE_BITS;
+        auto it = decode_pages.find(page_num);
+        for (uint32_t i = 0; it != decode_pages.end() && i < DECODE_CACHE_PAGE_INSTS; i++) {
+            DecodedInst& slot = it->second->insts[i];
+            if (slot.op == Op::NONE) continue;
+            bool same;
+            if (2 * i + slot.len > SparseMemory::PAGE_SIZE) same = slotMatches(slot, base + 2 * i);
+            else if (slot.len == 2) same = slot.raw == SparseMemory::read<uint16_t>(saved + 2 * i);
+            else same = slot.raw == SparseMemory::read<uint32_t>(saved + 2 * i);
+            if (!same) {
+                slot.op = Op::NONE;
+                code_dirty = true;
+            }
+        }
+        auto prev = page_num ? decode_pages.find(page_num - 1) : decode_pages.end();
+        if (prev == decode_pages.end()) continue;
+        DecodedInst& straddling = prev->second->insts[DECODE_CACHE_PAGE_INSTS - 1];
+        if (straddling.op != Op::NONE && straddling.len == 4 && !slotMatches(straddling, base - 2)) {
+            straddling.op = Op::NONE;
+            code_dirty = true;
+        }
+    }
+    dirty_pages.clear();
+    for (auto& e : store_tlb) e = StoreTlbEntry();
+    if (code_dirty) flushBlocks();
+
+    reservation_valid = false;
+    pc = snap->pc;
+    copy(begin(snap->regs), end(snap->regs), regs);
+    copy(begin(snap->fregs), end(snap->fregs), fregs);
+    frm = snap->fcsr >> 5;
+    fflags = snap->fcsr & 0x1F;
+    copy(begin(snap->vregs), end(snap->vregs), vregs);
+    setVectorType(snap->vtype, snap->vl);
+    instruction_count = snap->instruction_count;
+    load_count = snap->load_count;
+    store_count = snap->store_count;
+    taken_branch_count = snap->taken_branch_count;
+    stop_reason = snap->stop_reason;
+    process = snap->process;    // Files opened since are closed
+    return true;
+}
+
+bool CPU::writeMemory(uint32_t addr, const void* data, size_t len) {
+    if (len == 0) return true;
+    if (len >= SparseMemory::MAX_SIZE || (uint64_t)addr + len > memory.size()) return false;
+    if (snapshot_state) {
+        uint32_t last = (uint32_t)((addr + len - 1) >> SparseMemory::PAGE_BITS);
+        for (uint32_t p = addr >> SparseMemory::PAGE_BITS; p <= last; p++) {
+            if (page_flags[p] & PAGE_CLEAN) markDirty(p);
+        }
+    }
+    memory.write(addr, data, len);
+    invalidateDecoded(addr, (uint32_t)len);
+    if (code_dirty) flushBlocks();
+    return true;
+}
+
+void CPU::dropSnapshot() {
+    if (!snapshot_state) return;
+    snapshot_state.reset();
+    dirty_pages.clear();
+    for (auto& flags : page_flags) flags &= ~PAGE_CLEAN;
+}
+
+void CPU::storedToCodePage(uint32_t addr, uint32_t len) {
+    // Reserved backend: only the decode cache needs updating. The store TLB
+    // finds the page's decode slots without hashing.
+    StoreTlbEntry& e = store_tlb[tlbIndex(addr)];
+    if (e.tag != tlbTag(addr, len)) {
+        if (tlbTag(addr, len) != (addr & ~SparseMemory::PAGE_MASK)) {
+            invalidateDecoded(addr, len); // Misaligned: may straddle pages
+            return;
+        }
+        fillStoreTlb(addr);
+    }
+    if (e.code) invalidateSlot(e.code, addr, len);
+}
+
+void CPU::flushBlocks() {
+    blocks.clear();
+    if (jit) jit->reset();
+    code_dirty = false;
+}
+
+// Floating-point CSRs; fcsr is frm (bits 7:5) and fflags (bits 4:0)
+static const uint32_t CSR_FFLAGS = 0x001;
+static const uint32_t CSR_FRM = 0x002;
+static const uint32_t CSR_FCSR = 0x003;
+// Vector CSRs. vstart always reads 0: vector ops never stop part-way.
+static const uint32_t CSR_VSTART = 0x008;
+static const uint32_t CSR_VL = 0xC20;
+static const uint32_t CSR_VTYPE = 0xC21;
+static const uint32_t CSR_VLENB = 0xC22;
+
+// Counters (Zicntr, Zihpm): cycle, time, instret, then hpmcounter3-31, with
+// the upper halves at +0x80. All read-only.
+static const uint32_t CSR_CYCLE = 0xC00;
+static const uint32_t CSR_HPMCOUNTER31 = 0xC1F;
+static const uint32_t CSR_CYCLEH = 0xC80;
+static const uint32_t CSR_HPMCOUNTER31H = 0xC9F;
+
+uint64_t CPU::getCycles() const {
+    return instruction_count * timing.cycles_per_instruction + load_count * timing.load_cycles +
+           store_count * timing.store_cycles + taken_branch_count * timing.taken_branch_cycles;
+}
+
+// Counter CSRs read mid-instruction: the reading instruction has already
+// been counted, so instret (and the cycles it implies) leaves it out
+uint64_t CPU::counterCsr(uint32_t index) const {
+    switch (index) {
+        case 0: return getCycles() - timing.cycles_per_instruction;
+        case 1: return (uint64_t)((unsigned __int128)(getCycles() - timing.cycles_per_instruction) * timing.timebase_hz / timing.clock_hz);
+        case 2: return instruction_count - 1;
+        case 3: return load_count;
+        case 4: return store_count;
+        case 5: return taken_branch_count;
+        case 6: return decode_count;
+        default: return 0;
+    }
+}
+
+bool CPU::readCsr(uint32_t csr, uint32_t& value) {
+    if ((csr >= CSR_CYCLE && csr <= CSR_HPMCOUNTER31) || (csr >= CSR_CYCLEH && csr <= CSR_HPMCOUNTER31H)) {
+        uint64_t count = counterCsr(csr & 0x1F);
+        value = (csr & 0x80) ? (uint32_t)(count >> 32) : (uint32_t)count;
+        return true;
+    }
+    switch (csr) {
+        case CSR_FFLAGS: value = fpFlags(); return true;
+        case CSR_FRM: value = frm; return true;
+        case CSR_FCSR: value = frm << 5 | fpFlags(); return true;
+        case CSR_VSTART: value = 0; return true;
+        case CSR_VL: value = vl; return true;
+        case CSR_VTYPE: value = vtype; return true;
+        case CSR_VLENB: value = VLENB; return true;
+        default: return false;
+    }
+}
+
+bool CPU::writeCsr(uint32_t csr, uint32_t value) {
+    switch (csr) {
+        case CSR_FFLAGS:
+            fflags = value & 0x1F;
+            feclearexcept(FE_ALL_EXCEPT);
+            return true;
+        case CSR_FRM:
+            frm = value & 0x7;
+            fesetround(hostRounding(frm));
+            return true;
+        case CSR_FCSR:
+            fflags = value & 0x1F;
+            feclearexcept(FE_ALL_EXCEPT);
+            frm = (value >> 5) & 0x7;
+            fesetround(hostRounding(frm));
+            return true;
+        case CSR_VSTART:
+            return value == 0;
+        default:
+            return false;
+    }
+}
+
+const char* stopReasonName(StopReason reason) {
+    switch(reason) {
+        case StopReason::None: return "Still running";
+        case StopReason::Exit: return "Exit syscall";
+        case StopReason::Halt: return "Null instruction";
+        case StopReason::Fault: return "Memory fault";
+        case StopReason::Illegal: return "Illegal instruction";
+        case StopReason::Misaligned: return "Misaligned access";
+        case StopReason::Budget: return "Instruction budget exhausted";
+    }
+    return "?";
+}
+
+bool CPU::setEngine(Engine e) {
+    if (e == Engine::Threaded && !RISCV_THREADED_AVAILABLE) return false;
+    if (e == Engine::Jit) {
+        if (!jit) jit.reset(new JIT());
+        if (!jit->available()) return false;
+    }
+    engine = e;
+    return true;
 }
 
 void CPU::printStatus() {
@@ -33,262 +401,587 @@ void CPU::printStatus() {
         cout << "x" << dec << i+2 << ": " << hex << "0x" << regs[i+2] << "\t";
         cout << "x" << dec << i+3 << ": " << hex << "0x" << regs[i+3] << endl;
     }
+    if (any_of(begin(fregs), end(fregs), [](uint64_t f) { return f != 0; }) || getFcsr() != 0) {
+        for (int i = 0; i < 32; i += 4) {
+            for (int j = i; j < i + 4; j++) {
+                cout << "f" << dec << j << ": " << hex << "0x" << setw(16) << setfill('0') << fregs[j] << setfill(' ') << (j < i + 3 ? "\t" : "\n");
+            }
+        }
+        cout << "fcsr: 0x" << hex << getFcsr() << endl;
+    }
+    if (vtype != VTYPE_VILL) cout << "vl: " << dec << vl << "\tvtype: 0x" << hex << vtype << endl;
     cout << "Instructions Executed: " << dec << instruction_count << endl;
+    cout << "Cycles: " << getCycles() << " (loads " << load_count << ", stores " << store_count
+         << ", taken branches " << taken_branch_count << ", decodes " << decode_count << ")" << endl;
     cout << "------------------------------------------" << endl;
 }
 
+DecodedInst CPU::decodeAt(uint32_t addr) {
+    FetchTlbEntry& e = fetch_tlb[tlbIndex(addr)];
+    if (e.tag != tlbTag(addr, 2)) {
+        if ((addr & 1) != 0 || !memory.contains(addr, 2)) {
+            decode_count++;
+            return decode(fetchAt(addr));
+        }
+
+        // Decode Cache: hot loops skip fetch() and bit extraction entirely
+        e.tag = addr & ~SparseMemory::PAGE_MASK;
+        e.page = decodedPage(addr >> SparseMemory::PAGE_BITS);
+    }
+    DecodedInst& slot = e.page->insts[(addr >> 1) & 0x7FF];
+    if (slot.op == Op::NONE) {
+        decode_count++;
+        slot = decode(fetchAt(addr));
+        // The second half of an instruction ending the page is on the next
+        // one: give that page a decode page too, so stores to it are checked
+        if (slot.len == 4 && (addr & SparseMemory::PAGE_MASK) == SparseMemory::PAGE_SIZE - 2 && memory.contains(addr, 4)) {
+            decodedPage((addr >> SparseMemory::PAGE_BITS) + 1);
+        }
+    }
+    return slot;
+}
+
+CPU::DecodedPage* CPU::decodedPage(uint32_t page_num) {
+    DecodedPage*& page = decode_pages[page_num];
+    if (!page) {
+        decode_storage.emplace_back(new DecodedPage());
+        addDecodedPage(page_num, page = decode_storage.back().get());
+    }
+    return page;
+}
+
+// Whether a decoded slot still matches the instruction bytes at addr
+bool CPU::slotMatches(const DecodedInst& slot, uint32_t addr) {
+    uint8_t bytes[4] = {};
+    if (!memory.read(addr, bytes, slot.len)) return false;
+    return SparseMemory::read<uint32_t>(bytes) == slot.raw;
+}
+
+void CPU::addDecodedPage(uint32_t page_num, DecodedPage* page) {
+    decode_pages[page_num] = page;
+    // Stores through the TLB must now invalidate this page's slots
+    StoreTlbEntry& store_entry = store_tlb[tlbIndex(page_num << SparseMemory::PAGE_BITS)];
+    if (store_entry.tag == (page_num << SparseMemory::PAGE_BITS)) store_entry.code = page;
+    if (memory.base()) page_flags[page_num] |= PAGE_CODE;
+}
+
 bool CPU::executeNext() {
-    uint32_t inst = fetch();
-    if (inst == 0) return false; // Halt on null instruction
+    FpEnvScope fp_env(*this);
+    if (trace_writer) return stepAny<BinaryTrace>();
+    return quiet_mode ? stepAny<NoTrace>() : stepAny<ConsoleTrace>();
+}
 
-    // Increment count 
-    instruction_count++;
+template <class Trace>
+bool CPU::stepAny() {
+    if (memory.base()) return guardFaults<Trace>([this] { return step<Trace, ReservedAccess>(); });
+    return step<Trace, PagedAccess>();
+}
 
-    uint32_t opcode = inst & 0x7F;
-    uint32_t rd = (inst >> 7) & 0x1F;
-    uint32_t rs1 = (inst >> 15) & 0x1F;
-    uint32_t rs2 = (inst >> 20) & 0x1F;
-    uint32_t funct3 = (inst >> 12) & 0x7;
+// Runs body with SIGSEGVs inside the memory reservation turned into guest
+// faults. The faulting access has not advanced pc, so the instruction is
+// decoded again to report it like the bounds-checked path would.
+template <class Trace, class Body>
+bool CPU::guardFaults(Body body) {
+    HostFaultGuard guard(memory);
+    if (sigsetjmp(guard.env, 0)) {
+        DecodedInst d = decodeAt(pc);
+        bool is_store = (d.op >= Op::SB && d.op <= Op::STORE_BAD) || (d.op >= Op::SC_W && d.op <= Op::AMOMAXU_W) ||
+                        d.op == Op::FSW || d.op == Op::FSD;
+        if constexpr (Trace::messages) {
+            cout << "[ERROR] " << (is_store ? "Store" : "Load") << " OOB at 0x" << hex << (regs[d.rs1] + d.imm) << '\n';
+            cout.flush();
+        }
+        stop_reason = StopReason::Fault;
+        if (code_dirty) flushBlocks();
+        return false;
+    }
+    return body();
+}
 
-    regs[0] = 0; // x0 always 0
+template <class Trace, class Mem>
+bool CPU::step() {
+    bool active = execute<Trace, Mem>(decodeAt(pc));
+    if (code_dirty) flushBlocks();
+    if (Trace::messages) cout.flush();
+    return active;
+}
 
-    switch(opcode) {
-        case 0x13: // I-Type Arithmetic
-        {
-            int32_t imm = (int32_t)inst >> 20;
-
-            // For Shift instructions, immediate is only lower 5 bits
-            uint32_t shamt = imm & 0x1F; 
-
-            switch(funct3) {
-                case 0x0: regs[rd] = regs[rs1] + imm; 
-                    if(!quiet_mode) cout << "EXEC: ADDI x" << dec << rd << ", x" << rs1 << ", " << imm << endl; break;
-                case 0x2: regs[rd] = ((int32_t)regs[rs1] < imm) ? 1 : 0; 
-                    if(!quiet_mode) cout << "EXEC: SLTI x" << dec << rd << ", x" << rs1 << ", " << imm << endl; break;
-                case 0x3: regs[rd] = ((uint32_t)regs[rs1] < (uint32_t)imm) ? 1 : 0; 
-                    if(!quiet_mode) cout << "EXEC: SLTIU x" << dec << rd << ", x" << rs1 << ", " << imm << endl; break;
-                case 0x4: regs[rd] = regs[rs1] ^ imm; 
-                    if(!quiet_mode) cout << "EXEC: XORI x" << dec << rd << ", x" << rs1 << ", " << imm << endl; break;
-                case 0x6: regs[rd] = regs[rs1] | imm; 
-                    if(!quiet_mode) cout << "EXEC: ORI x" << dec << rd << ", x" << rs1 << ", " << imm << endl; break;
-                case 0x7: regs[rd] = regs[rs1] & imm; 
-                    if(!quiet_mode) cout << "EXEC: ANDI x" << dec << rd << ", x" << rs1 << ", " << imm << endl; break;
-                case 0x1: regs[rd] = regs[rs1] << shamt; 
-                    if(!quiet_mode) cout << "EXEC: SLLI x" << dec << rd << ", x" << rs1 << ", " << shamt << endl; break;
-                case 0x5: 
-                    if (inst & 0x40000000) { regs[rd] = (int32_t)regs[rs1] >> shamt; if(!quiet_mode) cout << "EXEC: SRAI x" << dec << rd << ", x" << rs1 << ", " << shamt << endl; }
-                    else { regs[rd] = (uint32_t)regs[rs1] >> shamt; if(!quiet_mode) cout << "EXEC: SRLI x" << dec << rd << ", x" << rs1 << ", " << shamt << endl; }
-                    break;
-                // FIX 3: Default case
-                default:
-                    if(!quiet_mode) cout << "[ERROR] Unknown I-Type funct3: " << funct3 << endl;
-                    break;
+void CPU::invalidateDecoded(uint32_t addr, uint32_t len) {
+    uint32_t last = addr + len - 1;
+    // A 4-byte instruction starting in the halfword before addr overlaps it too
+    uint32_t before = (addr & ~1u) - 2;
+    if (addr >= 2) {
+        auto it = decode_pages.find(before >> 12);
+        if (it != decode_pages.end()) {
+            DecodedInst& slot = it->second->insts[(before >> 1) & 0x7FF];
+            if (slot.op != Op::NONE && slot.len == 4) {
+                slot.op = Op::NONE;
+                code_dirty = true;
             }
-            break;
         }
-        case 0x33: // R-Type Arithmetic
-        {
-            switch(funct3) {
-                case 0x0: 
-                    if (inst & 0x40000000) { regs[rd] = regs[rs1] - regs[rs2]; if(!quiet_mode) cout << "EXEC: SUB x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; }
-                    else { regs[rd] = regs[rs1] + regs[rs2]; if(!quiet_mode) cout << "EXEC: ADD x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; }
-                    break;
-                case 0x1: regs[rd] = regs[rs1] << (regs[rs2] & 0x1F); if(!quiet_mode) cout << "EXEC: SLL x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; break;
-                case 0x2: regs[rd] = ((int32_t)regs[rs1] < (int32_t)regs[rs2]) ? 1 : 0; if(!quiet_mode) cout << "EXEC: SLT x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; break;
-                case 0x3: regs[rd] = ((uint32_t)regs[rs1] < (uint32_t)regs[rs2]) ? 1 : 0; if(!quiet_mode) cout << "EXEC: SLTU x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; break;
-                case 0x4: regs[rd] = regs[rs1] ^ regs[rs2]; if(!quiet_mode) cout << "EXEC: XOR x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; break;
-                case 0x5: 
-                    if (inst & 0x40000000) { regs[rd] = (int32_t)regs[rs1] >> (regs[rs2] & 0x1F); if(!quiet_mode) cout << "EXEC: SRA x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; }
-                    else { regs[rd] = (uint32_t)regs[rs1] >> (regs[rs2] & 0x1F); if(!quiet_mode) cout << "EXEC: SRL x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; }
-                    break;
-                case 0x6: regs[rd] = regs[rs1] | regs[rs2]; if(!quiet_mode) cout << "EXEC: OR x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; break;
-                case 0x7: regs[rd] = regs[rs1] & regs[rs2]; if(!quiet_mode) cout << "EXEC: AND x" << dec << rd << ", x" << rs1 << ", x" << rs2 << endl; break;
-                // FIX 3: Default case
-                default:
-                    if(!quiet_mode) cout << "[ERROR] Unknown R-Type funct3: " << funct3 << endl;
-                    break;
-            }
-            break;
+    }
+    for (uint32_t page_idx = addr >> 12; page_idx <= (last >> 12); page_idx++) {
+        auto it = decode_pages.find(page_idx);
+        if (it == decode_pages.end()) continue;
+        DecodedPage* page = it->second;
+        uint32_t lo = std::max(addr, page_idx << 12);
+        uint32_t hi = std::min(last, (page_idx << 12) | 0xFFF);
+        for (uint32_t a = lo & ~1u; a <= hi; a += 2) {
+            DecodedInst& slot = page->insts[(a >> 1) & 0x7FF];
+            if (slot.op == Op::NONE) continue;
+            slot.op = Op::NONE;
+            code_dirty = true; // Cached blocks may contain this instruction
         }
-        case 0x03: // Loads
-        {
-            int32_t imm = (int32_t)inst >> 20;
-            uint32_t addr = regs[rs1] + imm;
-            // FIX 4: Halt on OOB
-            if (addr + 3 >= memory.size()) { 
-                if(!quiet_mode) cout << "[ERROR] Load OOB at 0x" << hex << addr << endl; 
-                return false; 
-            }
-           switch(funct3) {
-                case 0x0: regs[rd] = (int8_t)memory[addr]; if(!quiet_mode) cout << "EXEC: LB" << endl; break;
-                case 0x1: regs[rd] = (int16_t)(memory[addr] | (memory[addr+1]<<8)); if(!quiet_mode) cout << "EXEC: LH" << endl; break;
-                case 0x2: regs[rd] = memory[addr] | (memory[addr+1]<<8) | (memory[addr+2]<<16) | (memory[addr+3]<<24); if(!quiet_mode) cout << "EXEC: LW" << endl; break;
-                case 0x4: regs[rd] = memory[addr]; if(!quiet_mode) cout << "EXEC: LBU" << endl; break;
-                case 0x5: regs[rd] = memory[addr] | (memory[addr+1]<<8); if(!quiet_mode) cout << "EXEC: LHU" << endl; break;
-                default: if(!quiet_mode) cout << "[ERROR] Unknown Load funct3" << endl; break;
-            }
-            break;
+    }
+}
+
+// FENCE.I: code other harts stored is only picked up here, so every decoded
+// slot is dropped (the pages stay allocated for re-decoding)
+void CPU::invalidateAllDecoded() {
+    for (const auto& page : decode_pages) {
+        for (DecodedInst& slot : page.second->insts) slot.op = Op::NONE;
+    }
+    code_dirty = !decode_pages.empty();
+}
+
+static bool endsBlock(Op op) {
+    switch(op) {
+        case Op::BEQ: case Op::BNE: case Op::BLT: case Op::BGE: case Op::BLTU: case Op::BGEU: case Op::BRANCH_BAD:
+        case Op::JAL: case Op::JALR: case Op::ECALL: case Op::HALT: case Op::ILLEGAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+CPU::Block* CPU::lookupBlock(uint32_t addr) {
+    auto it = blocks.find(addr);
+    if (it != blocks.end()) return it->second.get();
+    if ((addr & 1) != 0 || !memory.contains(addr, 2)) return nullptr;
+
+    // Discover a straight run of instructions ending in a control transfer
+    unique_ptr<Block> block(new Block());
+    block->start_pc = addr;
+    uint32_t cur = addr;
+    while (block->ops.size() < MAX_BLOCK_OPS && memory.contains(cur, 2)) {
+        DecodedInst d = decodeAt(cur);
+        block->ops.push_back(d);
+        if (endsBlock(d.op)) break;
+        cur += d.len;
+    }
+    if (!endsBlock(block->ops.back().op)) cur -= block->ops.back().len; // Back to the last op
+
+    // Static successors: [0] is the jump/branch target, [1] the fall-through
+    const DecodedInst& last = block->ops.back();
+    block->next_pc[1] = cur + last.len;
+    bool is_branch = last.op >= Op::BEQ && last.op <= Op::BGEU;
+    block->next_pc[0] = (is_branch || last.op == Op::JAL) ? cur + last.imm : cur + last.len;
+
+    Block* result = block.get();
+    blocks[addr] = std::move(block);
+    return result;
+}
+
+StopReason CPU::run(uint64_t budget) {
+    // Pick the trace instantiation once per run, never per instruction
+    FpEnvScope fp_env(*this);
+    bool active;
+    if (trace_writer) {
+        active = runAny<BinaryTrace>(budget);
+    } else if (quiet_mode) {
+        active = runAny<NoTrace>(budget);
+    } else {
+        active = runAny<ConsoleTrace>(budget);
+        cout.flush();
+    }
+    guest_stdout.flush();
+    if (active) stop_reason = StopReason::Budget;
+    return stop_reason;
+}
+
+template <class Trace>
+bool CPU::runAny(uint64_t budget) {
+    // Likewise the memory access policy
+    if (memory.base()) {
+        return guardFaults<Trace>([&] {
+            return engine == Engine::Threaded ? runThreaded<Trace, ReservedAccess>(budget) : runBlocks<Trace, ReservedAccess>(budget);
+        });
+    }
+    return engine == Engine::Threaded ? runThreaded<Trace, PagedAccess>(budget) : runBlocks<Trace, PagedAccess>(budget);
+}
+
+// Last instruction count a run may reach (saturates for RUN_UNLIMITED)
+static uint64_t budgetLimit(uint64_t count, uint64_t budget) {
+    return budget > UINT64_MAX - count ? UINT64_MAX : count + budget;
+}
+
+template <class Trace, class Mem>
+bool CPU::runBlocks(uint64_t budget) {
+    uint64_t stop = budgetLimit(instruction_count, budget);
+    Block* block = nullptr;
+
+    while (instruction_count < stop) {
+        if (!block) block = lookupBlock(pc);
+
+        // Not enough budget left for the whole block (or no block here): single-step
+        if (!block || block->ops.size() > stop - instruction_count) {
+            if (!step<Trace, Mem>()) return false;
+            block = nullptr;
+            continue;
         }
 
-        case 0x23: // STORE Instructions
-        {
-            int32_t imm11_5 = (inst >> 25) & 0x7F;
-            int32_t imm4_0  = (inst >> 7) & 0x1F;
-            int32_t imm = (imm11_5 << 5) | imm4_0;
-            if (imm & 0x800) imm |= 0xFFFFF000;
-            
-            uint32_t addr = regs[rs1] + imm;
-            uint32_t val = regs[rs2];
-            // FIX 4: Halt on OOB
-            if (addr + 3 >= memory.size()) { 
-                if(!quiet_mode) cout << "[ERROR] Store OOB at 0x" << hex << addr << endl; 
-                return false; 
+        size_t first_op = 0;
+        if (!Trace::enabled && engine == Engine::Jit) {
+            // Translated blocks carry no tracing, so they only run in quiet mode
+            if (!block->jit_tried && ++block->exec_count >= JIT_THRESHOLD) {
+                if (jit->full()) {
+                    flushBlocks();
+                    block = nullptr;
+                    continue;
+                }
+                block->jit_tried = true;
+                block->jit_code = jit->compile(block->ops, block->start_pc, block->jit_ops);
+                if (!block->jit_code && jit->full()) {
+                    flushBlocks();
+                    block = nullptr;
+                    continue;
+                }
             }
-           switch(funct3) {
-                case 0x0: memory[addr] = val & 0xFF; if(!quiet_mode) cout << "EXEC: SB" << endl; break;
-                case 0x1: memory[addr] = val & 0xFF; memory[addr+1] = (val>>8) & 0xFF; if(!quiet_mode) cout << "EXEC: SH" << endl; break;
-                case 0x2: memory[addr] = val & 0xFF; memory[addr+1] = (val>>8) & 0xFF; memory[addr+2] = (val>>16) & 0xFF; memory[addr+3] = (val>>24) & 0xFF; if(!quiet_mode) cout << "EXEC: SW" << endl; break;
-                default: if(!quiet_mode) cout << "[ERROR] Unknown Store funct3" << endl; break;
+            if (block->jit_code) {
+                if (!runJit(block)) return false;
+                first_op = block->jit_ops;
             }
-            break;
         }
 
-        case 0x63: // BRANCH Instructions
-        {
-            int32_t imm12 = (inst >> 31) & 0x1;
-            int32_t imm10_5 = (inst >> 25) & 0x3F;
-            int32_t imm4_1 = (inst >> 8) & 0xF;
-            int32_t imm11 = (inst >> 7) & 0x1;
-            int32_t imm = (imm12 << 12) | (imm11 << 11) | (imm10_5 << 5) | (imm4_1 << 1);
-            if (imm12) imm |= 0xFFFFE000;
-
-            bool take = false;
-            switch(funct3) {
-                case 0x0: take = (regs[rs1] == regs[rs2]); break;
-                case 0x1: take = (regs[rs1] != regs[rs2]); break;
-                case 0x4: take = ((int32_t)regs[rs1] < (int32_t)regs[rs2]); break;
-                case 0x5: take = ((int32_t)regs[rs1] >= (int32_t)regs[rs2]); break;
-                case 0x6: take = (regs[rs1] < regs[rs2]); break;
-                case 0x7: take = (regs[rs1] >= regs[rs2]); break;
-                default: if(!quiet_mode) cout << "[ERROR] Unknown Branch funct3" << endl; break;
+        // Interpret the block (or whatever the translation left over)
+        for (size_t i = first_op; i < block->ops.size() && !code_dirty; i++) {
+            if (!execute<Trace, Mem>(block->ops[i])) {
+                if (code_dirty) flushBlocks();
+                return false;
             }
-            if(!quiet_mode) cout << "EXEC: BRANCH " << (take ? "TAKEN" : "NOT TAKEN") << endl;
-            if (take) pc += (imm - 4);
-            break;
         }
-        
-        case 0x37: // LUI
-            regs[rd] = inst & 0xFFFFF000; 
-            if(!quiet_mode) cout << "EXEC: LUI x" << dec << rd << endl;
-            break;
-            
-        case 0x17: // AUIPC
-            regs[rd] = pc + (inst & 0xFFFFF000); 
-            if(!quiet_mode) cout << "EXEC: AUIPC x" << dec << rd << endl;
-            break;
-            
-        case 0x6F: // JAL
-       {
-            int32_t imm20 = (inst >> 31) & 0x1;
-            int32_t imm10_1 = (inst >> 21) & 0x3FF;
-            int32_t imm11 = (inst >> 20) & 0x1;
-            int32_t imm19_12 = (inst >> 12) & 0xFF;
-            
-            // Reassemble the 20-bit offset
-            int32_t offset = (imm20 << 20) | (imm19_12 << 12) | (imm11 << 11) | (imm10_1 << 1);
-            if (offset & 0x100000) offset |= 0xFFE00000;
-            regs[rd] = pc + 4;
-            pc += offset;
-            if(!quiet_mode) cout << "EXEC: JAL -> 0x" << hex << pc << endl;
-            // FIX 1: Return immediately, instruction count already incremented at start
-            return true;
-         }
-
-        case 0x67: // JALR (Jump and Link Register) - Function Return
-        {
-            // FIX 2: Validate funct3 is 0
-            if (funct3 != 0x0) {
-                if(!quiet_mode) cout << "[ERROR] Invalid JALR funct3: " << funct3 << endl;
-                break;
-            }
-            
-            int32_t imm = (int32_t)(inst & 0xFFF00000) >> 20;
-            uint32_t target = (regs[rs1] + imm) & ~1;
-            regs[rd] = pc + 4;
-            pc = target;
-            if(!quiet_mode) cout << "EXEC: JALR -> 0x" << hex << pc << endl;
-            // FIX 1: Return immediately
-            return true;
-         }
-
-        case 0x73: // ECALL (System Calls)
-        {
-            uint32_t syscall = regs[17];
-            if (syscall == 10) { 
-                if(!quiet_mode) cout << "SYSCALL: EXIT" << endl; 
-                return false; 
-            }
-            if (syscall == 1) { 
-                if(!quiet_mode) cout << "SYSCALL: Print Int -> " << dec << (int32_t)regs[10] << endl; 
-            }
-            if (syscall == 4) { // Print String
-                uint32_t addr = regs[10]; // Address of string is in x10
-                string output = "";
-                while(addr < memory.size()) {
-                    char c = (char)memory[addr];
-                    if (c == '\0') break; // Stop at null terminator
-                    output += c;
-                    addr++;
-                }
-                if(!quiet_mode) cout << "SYSCALL: Print Str -> " << output << endl; 
-            }
-           break;
+        if (code_dirty) {
+            flushBlocks();
+            block = nullptr;
+            continue;
         }
-        
-        default:
-            if(!quiet_mode) cout << "[ERROR] Unknown Opcode: 0x" << hex << opcode << endl;
-            return false;
-   }
-    
-    pc += 4;
+
+        block = nextBlock(block);
+    }
     return true;
 }
 
+CPU::Block* CPU::nextBlock(Block* block) {
+    // Block Chaining: follow direct links, only hash on indirect targets (JALR)
+    if (pc == block->next_pc[0]) {
+        if (!block->next[0]) block->next[0] = lookupBlock(pc);
+        return block->next[0];
+    }
+    if (pc == block->next_pc[1]) {
+        if (!block->next[1]) block->next[1] = lookupBlock(pc);
+        return block->next[1];
+    }
+    return lookupBlock(pc);
+}
+
+template <class Trace, class Mem>
+bool CPU::runThreaded(uint64_t budget) {
+#if RISCV_THREADED_AVAILABLE
+    // Direct-threaded dispatch: every handler ends in its own indirect jump
+    static const void* const labels[] = {
+#define RISCV_OP_LABEL(name) &&L_##name,
+        RISCV_OPS(RISCV_OP_LABEL)
+#undef RISCV_OP_LABEL
+    };
+
+    uint64_t stop = budgetLimit(instruction_count, budget);
+    Block* block = nullptr;
+    const DecodedInst* d = nullptr;
+    const DecodedInst* end = nullptr;
+
+#define OP(name) L_##name:
+#define D (*d)
+#define DISPATCH do { regs[0] = 0; instruction_count++; goto *labels[(int)d->op]; } while (0)
+#define NEXT do { pc += d->len; if (++d == end) goto next_block; DISPATCH; } while (0)
+#define JUMP goto next_block
+#define STORED do { pc += d->len; if (code_dirty) goto code_modified; if (++d == end) goto next_block; DISPATCH; } while (0)
+#define STOP(r) do { stop_reason = (r); goto halted; } while (0)
+#define TRACE_EXEC(value, addr) do { if constexpr (Trace::enabled) Trace::exec(trace_writer, pc, D, (value), (addr)); } while (0)
+#define TRACE_MSG(x) do { if constexpr (Trace::messages) cout << x << '\n'; } while (0)
+
+next_block:
+    if (instruction_count >= stop) return true;
+    block = block ? nextBlock(block) : lookupBlock(pc);
+    if (!block || block->ops.size() > stop - instruction_count) {
+        if (!step<Trace, Mem>()) return false;
+        block = nullptr;
+        goto next_block;
+    }
+    d = block->ops.data();
+    end = d + block->ops.size();
+    DISPATCH;
+
+#include "ExecCore.inc"
+
+L_NONE:
+L_HALT:
+    instruction_count--; // Null instructions halt without retiring
+    stop_reason = StopReason::Halt;
+    goto halted;
+
+code_modified:
+    flushBlocks();
+    block = nullptr;
+    goto next_block;
+
+halted:
+    if (code_dirty) flushBlocks();
+    return false;
+
+#undef OP
+#undef D
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef STORED
+#undef STOP
+#undef TRACE_EXEC
+#undef TRACE_MSG
+#else
+    return runBlocks<Trace, Mem>(budget);
+#endif
+}
+
+bool CPU::runJit(Block* block) {
+    uint64_t state = block->jit_code(regs, this);
+    pc = (uint32_t)state;
+    instruction_count += (state >> 32) & 0x3FFFFFFF;
+    taken_branch_count += (state >> 62) & 1;
+    if (!(state >> 63)) return true;
+    stop_reason = access_fault; // Memory fault halts, as in the interpreter
+    return false;
+}
+
+template <class Trace, class Mem>
+bool CPU::execute(const DecodedInst& d) {
+    if (d.op == Op::HALT) { // Halt on null instruction
+        stop_reason = StopReason::Halt;
+        return false;
+    }
+
+    // Increment count 
+    instruction_count++;
+
+    regs[0] = 0; // x0 always 0
+
+#define OP(name) case Op::name:
+#define D d
+#define NEXT pc += d.len; return true
+#define JUMP return true
+#define STORED NEXT
+#define STOP(r) do { stop_reason = (r); return false; } while (0)
+#define TRACE_EXEC(value, addr) do { if constexpr (Trace::enabled) Trace::exec(trace_writer, pc, D, (value), (addr)); } while (0)
+#define TRACE_MSG(x) do { if constexpr (Trace::messages) cout << x << '\n'; } while (0)
+    switch(d.op) {
+#include "ExecCore.inc"
+        default:
+            break;
+    }
+    return false;
+#undef OP
+#undef D
+#undef NEXT
+#undef JUMP
+#undef STORED
+#undef STOP
+#undef TRACE_EXEC
+#undef TRACE_MSG
+}
+
 void CPU::loadRaw(const vector<uint32_t>& code) {
-    // Reset memory
-    std::fill(memory.begin(), memory.end(), 0);
+    // Reset memory (only touched pages are released)
+    memory.clear();
+    flushTlbs();
+    flushDecodeCache();
+    dropSnapshot();
     
     // Copy code into memory (byte by byte)
-    size_t addr = 0;
+    uint32_t addr = 0;
     for (uint32_t inst : code) {
-        if (addr + 4 > memory.size()) break;
-        memory[addr] = inst & 0xFF;
-        memory[addr+1] = (inst >> 8) & 0xFF;
-        memory[addr+2] = (inst >> 16) & 0xFF;
-        memory[addr+3] = (inst >> 24) & 0xFF;
+        uint8_t bytes[4] = { (uint8_t)inst, (uint8_t)(inst >> 8), (uint8_t)(inst >> 16), (uint8_t)(inst >> 24) };
+        if (!memory.write(addr, bytes, 4)) break;
         addr += 4;
     }
     pc = 0;
+    stop_reason = StopReason::None;
+    resetProcess(addr);
+    elf_path.clear(); // Nothing to cache
     if(!quiet_mode) cout << "Loaded " << code.size() * 4 << " bytes raw." << endl;
 }
 
+// Little-endian ELF field at `offset` into a header (any host endianness)
+template <class T> static T elfField(const uint8_t* header, size_t offset) {
+    return SparseMemory::read<T>(header + offset);
+}
+
 bool CPU::loadELF(const string& filename) {
-    elfio reader;
-    if (!reader.load(filename)) return false;
-    if (reader.get_machine() != EM_RISCV) return false;
-    std::fill(memory.begin(), memory.end(), 0);
-    for (const auto& segment : reader.segments) {
-        if (segment->get_type() == PT_LOAD) {
-            uint32_t addr = (uint32_t)segment->get_virtual_address();
-            uint32_t fsize = (uint32_t)segment->get_file_size();
-            uint32_t msize = (uint32_t)segment->get_memory_size();
-            if (addr + msize > memory.size()) return false;
-            if (fsize > 0) memcpy(&memory[addr], segment->get_data(), fsize);
-        }
+    // Zero-copy: the file is mapped once and only the ELF and program headers
+    // are parsed; PT_LOAD pages alias the mapping copy-on-write (see mapFile)
+    auto file = make_shared<MappedFile>();
+    if (!file->open(filename)) return false;
+    const uint8_t* image = file->data();
+    if (file->size() < sizeof(Elf32_Ehdr)) return false;
+    if (image[EI_MAG0] != ELFMAG0 || image[EI_MAG1] != ELFMAG1 || image[EI_MAG2] != ELFMAG2 || image[EI_MAG3] != ELFMAG3) return false;
+    if (image[EI_CLASS] != ELFCLASS32 || image[EI_DATA] != ELFDATA2LSB) return false;
+    if (elfField<Elf_Half>(image, offsetof(Elf32_Ehdr, e_machine)) != EM_RISCV) return false;
+
+    uint32_t phoff = elfField<Elf32_Off>(image, offsetof(Elf32_Ehdr, e_phoff));
+    uint32_t phentsize = elfField<Elf_Half>(image, offsetof(Elf32_Ehdr, e_phentsize));
+    uint32_t phnum = elfField<Elf_Half>(image, offsetof(Elf32_Ehdr, e_phnum));
+    if (phnum > 0 && (phentsize < sizeof(Elf32_Phdr) || phoff + (uint64_t)phnum * phentsize > file->size())) return false;
+
+    memory.clear();
+    flushTlbs();
+    flushDecodeCache();
+    dropSnapshot();
+    elf_path = filename;
+    elf_size = file->size();
+    elf_hash = decode_cache_enabled ? contentHash(image, file->size()) : 0;
+    elf_segments.clear();
+    uint32_t image_end = 0;
+    for (uint32_t i = 0; i < phnum; i++) {
+        const uint8_t* ph = image + phoff + i * phentsize;
+        if (elfField<Elf_Word>(ph, offsetof(Elf32_Phdr, p_type)) != PT_LOAD) continue;
+        uint32_t offset = elfField<Elf32_Off>(ph, offsetof(Elf32_Phdr, p_offset));
+        uint32_t addr = elfField<Elf32_Addr>(ph, offsetof(Elf32_Phdr, p_vaddr));
+        uint32_t fsize = elfField<Elf_Word>(ph, offsetof(Elf32_Phdr, p_filesz));
+        uint32_t msize = elfField<Elf_Word>(ph, offsetof(Elf32_Phdr, p_memsz));
+        if (fsize > msize || !memory.contains(addr, msize)) return false;
+        if (!memory.mapFile(addr, file, offset, fsize)) return false; // .bss stays zero
+        elf_segments.push_back({addr, offset, fsize, (elfField<Elf_Word>(ph, offsetof(Elf32_Phdr, p_flags)) & PF_X) != 0});
+        image_end = max(image_end, addr + msize);
     }
+    if (decode_cache_enabled) loadDecodeCache();
 
     // Set the Program Counter (PC)
-    pc = (uint32_t)reader.get_entry();
+    pc = elfField<Elf32_Addr>(image, offsetof(Elf32_Ehdr, e_entry));
+    stop_reason = StopReason::None;
+    resetProcess(image_end);
     if(!quiet_mode) cout << "Loaded ELF Entry: 0x" << hex << pc << endl;
     return true;
-}
\ No newline at end of file
+}
+
+bool CPU::setArgs(const vector<string>& args) {
+    uint64_t top = memory.size();
+    uint64_t strings = 0;
+    for (const string& arg : args) strings += arg.size() + 1;
+    // argc, argv[], NULL, envp NULL, auxv { AT_PAGESZ, 4096 } { AT_NULL }; sp stays 16-byte aligned
+    uint64_t vector_bytes = 4 * (args.size() + 7);
+    if (strings + vector_bytes + 32 > top) return false;
+
+    uint64_t str_addr = top - strings;
+    uint64_t sp = (str_addr - vector_bytes) & ~(uint64_t)15;
+    vector<uint32_t> block = { (uint32_t)args.size() };
+    for (const string& arg : args) {
+        if (!writeMemory((uint32_t)str_addr, arg.c_str(), arg.size() + 1)) return false;
+        block.push_back((uint32_t)str_addr);
+        str_addr += arg.size() + 1;
+    }
+    block.push_back(0);
+    block.push_back(0);
+    block.insert(block.end(), { 6, SparseMemory::PAGE_SIZE, 0, 0 });
+    vector<uint8_t> bytes(block.size() * 4);
+    for (size_t i = 0; i < block.size(); i++) SparseMemory::write<uint32_t>(&bytes[i * 4], block[i]);
+    if (!writeMemory((uint32_t)sp, bytes.data(), bytes.size())) return false;
+
+    regs[2] = (uint32_t)sp;
+    regs[10] = (uint32_t)args.size();
+    regs[11] = (uint32_t)sp + 4;
+    return true;
+}
+
+bool CPU::loadDecodeCache() {
+    DecodeCacheView view;
+    if (!openDecodeCache(decodeCachePath(elf_path), elf_hash, elf_size, view)) return false;
+    for (uint32_t i = 0; i < view.page_count; i++) {
+        if (view.page_numbers[i] >= (SparseMemory::MAX_SIZE >> SparseMemory::PAGE_BITS)) continue;
+        DecodedPage* page = (DecodedPage*)(view.pages + (size_t)i * DECODE_CACHE_PAGE_INSTS);
+        addDecodedPage(view.page_numbers[i], page);
+    }
+    // As in decodeAt: stores to the second half of a straddling instruction must find it
+    for (uint32_t i = 0; i < view.page_count; i++) {
+        const DecodedInst& last = view.pages[(size_t)(i + 1) * DECODE_CACHE_PAGE_INSTS - 1];
+        uint32_t next = view.page_numbers[i] + 1;
+        if (last.op != Op::NONE && last.len == 4 && memory.contains(next << SparseMemory::PAGE_BITS, 2)) decodedPage(next);
+    }
+    decode_image = view.file;
+    // Rebuilding a block only reads the cached slots
+    for (uint32_t i = 0; i < view.block_count; i++) lookupBlock(view.block_starts[i]);
+    decode_cache_loaded = true;
+    return true;
+}
+
+void CPU::predecode() {
+    // Each slot decodes exactly as it would when first executed, so this
+    // only moves the work earlier. Code reached some other way (jumps into
+    // the middle of an instruction, code in data) is still decoded on demand.
+    for (const ElfSegment& seg : elf_segments) {
+        if (!seg.exec) continue;
+        uint64_t end = (uint64_t)seg.addr + seg.size;
+        for (uint64_t addr = ((uint64_t)seg.addr + 1) & ~(uint64_t)1; addr + 2 <= end;) addr += decodeAt((uint32_t)addr).len;
+    }
+}
+
+bool CPU::saveDecodeCache() {
+    if (!decode_cache_enabled || elf_path.empty() || decode_cache_loaded) return false;
+
+    // Guest memory may alias the loaded image and have been written since, so
+    // compare against a fresh view of the file, and only if it is unchanged
+    MappedFile file;
+    if (!file.open(elf_path) || file.size() != elf_size || contentHash(file.data(), file.size()) != elf_hash) return false;
+    auto original = [&](uint32_t addr, uint32_t len, uint32_t& word) {
+        for (auto seg = elf_segments.rbegin(); seg != elf_segments.rend(); ++seg) { // Later segments win
+            if (addr < seg->addr || addr - seg->addr + len > seg->size) continue;
+            const uint8_t* p = file.data() + seg->offset + (addr - seg->addr);
+            word = len == 2 ? SparseMemory::read<uint16_t>(p) : SparseMemory::read<uint32_t>(p);
+            return true;
+        }
+        return false;
+    };
+    auto unchanged = [&](uint32_t addr, const DecodedInst& d) {
+        uint32_t word;
+        return d.op != Op::NONE && original(addr, d.len, word) && word == d.raw;
+    };
+
+    vector<uint32_t> page_numbers;
+    for (const auto& page : decode_pages) page_numbers.push_back(page.first);
+    sort(page_numbers.begin(), page_numbers.end());
+    vector<unique_ptr<DecodedPage>> copies;
+    vector<const DecodedInst*> pages;
+    vector<uint32_t> kept;
+    for (uint32_t page_num : page_numbers) {
+        unique_ptr<DecodedPage> copy(new DecodedPage(*decode_pages[page_num]));
+        bool any = false;
+        for (uint32_t i = 0; i < DECODE_CACHE_PAGE_INSTS; i++) {
+            DecodedInst& slot = copy->insts[i];
+            if (unchanged((page_num << SparseMemory::PAGE_BITS) + 2 * i, slot)) any = true;
+            else slot = DecodedInst();
+        }
+        if (!any) continue;
+        kept.push_back(page_num);
+        pages.push_back(copy->insts);
+        copies.push_back(std::move(copy));
+    }
+
+    vector<uint32_t> block_starts;
+    for (const auto& entry : blocks) {
+        const Block& block = *entry.second;
+        bool valid = true;
+        uint32_t addr = block.start_pc;
+        for (size_t i = 0; i < block.ops.size() && valid; addr += block.ops[i].len, i++) valid = unchanged(addr, block.ops[i]);
+        if (valid) block_starts.push_back(block.start_pc);
+    }
+    sort(block_starts.begin(), block_starts.end());
+
+    return writeDecodeCache(decodeCachePath(elf_path), elf_hash, elf_size, kept, pages, block_starts);
+}
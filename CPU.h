@@ -5,34 +5,599 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <memory>
+#include <unordered_map>
+#include <atomic>
+#include <algorithm>
+#include "Decoder.h"
+#include "Memory.h"
+#include "DecodeCache.h"
+#include "JIT.h"
+#include "Trace.h"
+#include "FPU.h"
+#include "Vector.h"
+#include "Syscall.h"
+
+struct iovec;
 
 using namespace std;
 
+// Labels-as-values are a GNU extension (GCC and Clang)
+#if defined(__GNUC__)
+#define RISCV_THREADED_AVAILABLE 1
+#else
+#define RISCV_THREADED_AVAILABLE 0
+#endif
+
+// Execution engine used by CPU::run()
+enum class Engine {
+    Block,      // Interpreted, chained basic blocks (switch dispatch)
+    Threaded,   // Chained basic blocks with direct-threaded (computed goto) dispatch
+    Jit         // Hot blocks translated to native x86-64 code
+};
+
+// Guest memory backing (see SparseMemory)
+enum class MemoryBackend {
+    Paged,      // Page table behind a software TLB, bounds-checked accesses
+    Reserved    // 4 GiB host reservation: direct accesses, faults via SIGSEGV
+};
+
+// Memory access policies the execution cores are instantiated with
+struct PagedAccess { static const bool reserved = false; };
+struct ReservedAccess { static const bool reserved = true; };
+
+// Why the last executeNext()/run() call returned
+enum class StopReason {
+    None,       // Still runnable (nothing has run yet, or stopped from the debugger)
+    Exit,       // Exit syscall (a7 = 10)
+    Halt,       // Null instruction (also fetched past the end of memory)
+    Fault,      // Out-of-bounds load or store
+    Illegal,    // Unknown opcode
+    Misaligned, // Misaligned load or store with MisalignedAccess::Trap
+    Budget      // Instruction budget used up; run() can be called again
+};
+
+const char* stopReasonName(StopReason reason);
+
+// Architectural state plus the old contents of every guest page written
+// since it was taken (saved on each page's first write). Only meaningful to
+// the CPU that took it; see CPU::snapshot().
+struct Snapshot {
+    uint32_t pc = 0;
+    uint32_t regs[32] = {};
+    uint64_t fregs[32] = {};
+    uint32_t fcsr = 0;
+    uint8_t vregs[32 * VLENB] = {};
+    uint32_t vl = 0;
+    uint32_t vtype = VTYPE_VILL;
+    uint64_t instruction_count = 0;
+    uint64_t load_count = 0;
+    uint64_t store_count = 0;
+    uint64_t taken_branch_count = 0;
+    StopReason stop_reason = StopReason::None;
+    LinuxProcess process;   // Descriptors (shared with the CPU) and heap
+    unordered_map<uint32_t, unique_ptr<uint8_t[]>> pages;   // Page number -> pre-image
+};
+
+// Guest-visible timing behind the cycle and time CSRs. Every instruction
+// costs cycles_per_instruction plus the extra cycles of the events it
+// caused; time ticks at timebase_hz on a core clocked at clock_hz.
+struct TimingModel {
+    uint32_t cycles_per_instruction = 1;
+    uint32_t load_cycles = 0;           // Extra cycles per load
+    uint32_t store_cycles = 0;          // Extra cycles per store
+    uint32_t taken_branch_cycles = 0;   // Extra cycles per taken conditional branch
+    uint64_t clock_hz = 100000000;
+    uint64_t timebase_hz = 10000000;
+};
+
+// Event counters, also readable by the guest as hpmcounter3-6. Atomic
+// read-modify-writes count as a load and a store; a vector load or store
+// counts once.
+struct PerfCounters {
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t taken_branches = 0;
+    uint64_t decode_misses = 0;     // Instructions decoded (decode cache misses)
+};
+
+// What a load or store that is not naturally aligned does
+enum class MisalignedAccess {
+    Allow,      // Completes like any other access (default)
+    Trap        // Stops the program with StopReason::Misaligned
+};
+
 class CPU {
+    friend class JIT;
+
 private:
     uint32_t pc;
     uint32_t regs[32];
-    vector<uint8_t> memory;
+    uint64_t fregs[32];     // F/D registers; singles are NaN-boxed (see FPU.h)
+
+    // fcsr. While running, frm is also the host rounding mode. fflags holds
+    // the flags raised in software; the host's sticky flags are only folded
+    // in when the guest reads them (fpFlags) and when a run ends.
+    uint32_t frm = 0;
+    uint32_t fflags = 0;
+    uint32_t fpFlags() {
+        fflags |= hostFlags();
+        feclearexcept(FE_ALL_EXCEPT);
+        return fflags;
+    }
+    // Installs the guest's floating-point environment for one run() or
+    // executeNext() and puts the host's back afterwards
+    struct FpEnvScope {
+        CPU& cpu;
+        fenv_t host;
+        explicit FpEnvScope(CPU& c) : cpu(c) {
+            fegetenv(&host);
+            feclearexcept(FE_ALL_EXCEPT);
+            fesetround(hostRounding(cpu.frm));
+        }
+        ~FpEnvScope() {
+            cpu.fflags |= hostFlags();
+            fesetenv(&host);
+        }
+    };
+
+    // Vector unit (see Vector.h). vsew is the element size in bytes and
+    // vgroup the registers per group (1 for fractional LMUL); vsew is 0
+    // while vtype is illegal, which every vector op but vset[i]vl[i] rejects.
+    alignas(64) uint8_t vregs[32 * VLENB];
+    uint32_t vl = 0;
+    uint32_t vtype = VTYPE_VILL;
+    uint32_t vsew = 0;
+    uint32_t vgroup = 1;
+    // vset[i]vl[i]: vl = min(avl, VLMAX); an unsupported vtype sets vill and vl = 0
+    uint32_t setVectorType(uint32_t new_vtype, uint32_t avl) {
+        uint32_t vlmax = vectorMax(new_vtype);
+        vtype = vlmax ? new_vtype : VTYPE_VILL;
+        vsew = vlmax ? 1u << ((new_vtype >> 3) & 0x7) : 0;
+        vgroup = vlmax ? (vlmax * vsew + VLENB - 1) / VLENB : 1;
+        vl = avl < vlmax ? avl : vlmax;
+        return vl;
+    }
+    uint8_t* vreg(uint32_t index) { return vregs + index * VLENB; }
+
+    // CSRs (Zicsr); false if the CSR does not exist or is read-only
+    bool readCsr(uint32_t csr, uint32_t& value);
+    bool writeCsr(uint32_t csr, uint32_t value);
+    shared_ptr<SparseMemory> memory_owner;  // Shared by every hart of a Machine
+    SparseMemory& memory;
+    uint32_t hart_id = 0;
     
     // Resume-Ready Feature: Quiet Mode for Unit Testing
     bool quiet_mode = false;
     
+    // Binary execution trace sink (takes precedence over the console trace)
+    TraceWriter* trace_writer = nullptr;
+    
+    // Print syscalls (1, 4) and writes to stdout append here when capturing,
+    // whatever the trace mode; otherwise they collect in guest_stdout
+    bool capture_output = false;
+    string captured_output;
+    OutputBuffer guest_stdout;
+    
     // Resume-Ready Feature: Instruction Counting
     uint64_t instruction_count = 0;
+    StopReason stop_reason = StopReason::None;
+
+    // Event counts (see PerfCounters; decode misses are decode_count) and
+    // the timing model the counter CSRs derive cycles and time from
+    uint64_t load_count = 0;
+    uint64_t store_count = 0;
+    uint64_t taken_branch_count = 0;
+    TimingModel timing;
+    uint64_t counterCsr(uint32_t index) const;
+
+    // Decode Cache: one lazily allocated slot array per 4 KiB page of code,
+    // a slot per halfword (compressed code). An instruction's slot is on the
+    // page it starts on, even if its second half is on the next page.
+    struct DecodedPage {
+        DecodedInst insts[2048];
+    };
+    static_assert(sizeof(DecodedPage) == DECODE_CACHE_PAGE_INSTS * sizeof(DecodedInst), "cache page layout");
+    unordered_map<uint32_t, DecodedPage*> decode_pages;     // Keyed by page number
+    vector<unique_ptr<DecodedPage>> decode_storage;         // Pages decoded in this process
+    uint64_t decode_count = 0;
+
+    // Persistent decode cache: pages and block starts mapped from a sidecar
+    // file keyed by the ELF's content hash (see DecodeCache.h)
+    bool decode_cache_enabled = false;
+    bool decode_cache_loaded = false;
+    shared_ptr<MappedFile> decode_image;    // Backs cached decode_pages (copy-on-write)
+    string elf_path;
+    uint64_t elf_hash = 0;
+    uint64_t elf_size = 0;
+    struct ElfSegment {
+        uint32_t addr;
+        uint32_t offset;
+        uint32_t size;
+        bool exec;      // PF_X
+    };
+    vector<ElfSegment> elf_segments;        // PT_LOAD file ranges of the loaded ELF
+    bool loadDecodeCache();
+
+    // Software TLB: direct-mapped page number -> host page. Tags hold the page
+    // base, and an access folds its low address bits into the compare, so only
+    // naturally aligned accesses hit and a hit never crosses a page.
+    static const size_t TLB_ENTRIES = 64;
+    static const uint32_t TLB_INVALID = 0xFFF;  // Never equals a masked address
+    struct TlbEntry {
+        uint32_t tag = TLB_INVALID;
+        uint8_t* host = nullptr;
+    };
+    struct StoreTlbEntry {
+        uint32_t tag = TLB_INVALID;
+        uint8_t* host = nullptr;
+        DecodedPage* code = nullptr;    // Decode cache for the page, if any
+    };
+    struct FetchTlbEntry {
+        uint32_t tag = TLB_INVALID;
+        DecodedPage* page = nullptr;
+    };
+    TlbEntry load_tlb[TLB_ENTRIES];
+    StoreTlbEntry store_tlb[TLB_ENTRIES];
+    FetchTlbEntry fetch_tlb[TLB_ENTRIES];
+
+    static uint32_t tlbTag(uint32_t addr, uint32_t len) { return addr & (~SparseMemory::PAGE_MASK | (len - 1)); }
+    static size_t tlbIndex(uint32_t addr) { return (addr >> SparseMemory::PAGE_BITS) % TLB_ENTRIES; }
+
+    // Misaligned data accesses either complete (split across pages if needed)
+    // or stop the program with StopReason::Misaligned
+    bool trap_misaligned = false;
+    StopReason access_fault = StopReason::Fault;    // Why the last failed access failed
+    bool misaligned(uint32_t addr, uint32_t len) {
+        if (!trap_misaligned || !(addr & (len - 1))) return false;
+        access_fault = StopReason::Misaligned;
+        return true;
+    }
+    const char* accessError(bool is_store) const {
+        if (access_fault == StopReason::Misaligned) return is_store ? "Misaligned Store" : "Misaligned Load";
+        return is_store ? "Store OOB" : "Load OOB";
+    }
+
+    // Guest memory access (little-endian); false on an out-of-bounds or
+    // trapped misaligned access. Misaligned accesses always miss the TLB.
+    template <class T> bool load(uint32_t addr, T& value) {
+        const TlbEntry& e = load_tlb[tlbIndex(addr)];
+        if (e.tag == tlbTag(addr, sizeof(T))) {
+            value = SparseMemory::read<T>(e.host + (addr & SparseMemory::PAGE_MASK));
+            return true;
+        }
+        uint64_t v = 0;
+        if (misaligned(addr, sizeof(T)) || !loadSlow(addr, sizeof(T), v)) return false;
+        value = (T)v;
+        return true;
+    }
+    template <class T> bool store(uint32_t addr, T value) {
+        const StoreTlbEntry& e = store_tlb[tlbIndex(addr)];
+        if (e.tag != tlbTag(addr, sizeof(T))) {
+            return !misaligned(addr, sizeof(T)) && storeSlow(addr, sizeof(T), value);
+        }
+        SparseMemory::write<T>(e.host + (addr & SparseMemory::PAGE_MASK), value);
+        if (e.code) invalidateSlot(e.code, addr, sizeof(T));
+        return true;
+    }
+    // An aligned store of up to 8 bytes within one page overlaps the slots of
+    // the halfwords it writes, plus a 4-byte instruction starting just before
+    // it (at the start of a page, on the previous page). Stores next to code
+    // only check those slots; anything decoded goes to invalidateDecoded.
+    void invalidateSlot(DecodedPage* code, uint32_t addr, uint32_t len) {
+        uint32_t i = (addr & SparseMemory::PAGE_MASK) >> 1;
+        const DecodedInst* slot = &code->insts[i];
+        bool clear = i > 0 && (slot[-1].op == Op::NONE || slot[-1].len == 2) && slot[0].op == Op::NONE &&
+                     (len < 4 || slot[1].op == Op::NONE) && (len < 8 || (slot[2].op == Op::NONE && slot[3].op == Op::NONE));
+        if (!clear) invalidateDecoded(addr, len);
+    }
+    bool loadSlow(uint32_t addr, uint32_t len, uint64_t& value);
+    bool storeSlow(uint32_t addr, uint32_t len, uint64_t value);
+    StoreTlbEntry& fillStoreTlb(uint32_t addr);
+    void storedToCodePage(uint32_t addr, uint32_t len);
+    void flushTlbs();
+
+    // One byte per guest page for stores that need more than the write itself.
+    // Allocated for the reserved backend and once a snapshot is taken. A store
+    // checks the pages of its first and last byte.
+    static const uint8_t PAGE_CODE = 1;     // Reserved backend: page has decoded code
+    static const uint8_t PAGE_CLEAN = 2;    // Not written since the current snapshot
+    vector<uint8_t> page_flags;
+    void storedToCleanPage(uint32_t addr, uint32_t len);
+    void markDirty(uint32_t page_num);
+
+    // Snapshot/restore: the snapshot restore() accepts, and the pages written since
+    shared_ptr<Snapshot> snapshot_state;
+    vector<uint32_t> dirty_pages;
+    void dropSnapshot();
+
+    // Core-side access. Under ReservedAccess every load and store is a single
+    // host access with no bounds check; out-of-range accesses hit PROT_NONE
+    // and come back through HostFaultGuard (see guardFaults).
+    template <class Mem, class T> bool guestLoad(uint32_t addr, T& value) {
+        if constexpr (Mem::reserved) {
+            if (misaligned(addr, sizeof(T))) return false;
+            atomic_signal_fence(memory_order_seq_cst); // pc, count and regs are in memory if this faults
+            value = SparseMemory::read<T>(memory.base() + addr);
+            return true;
+        } else {
+            return load(addr, value);
+        }
+    }
+    template <class Mem, class T> bool guestStore(uint32_t addr, T value) {
+        if constexpr (Mem::reserved) {
+            if (misaligned(addr, sizeof(T))) return false;
+            // Flags first: a snapshot needs the page's old contents
+            uint8_t flags = page_flags[addr >> SparseMemory::PAGE_BITS];
+            if constexpr (sizeof(T) > 1) flags |= page_flags[((addr + sizeof(T) - 1) >> SparseMemory::PAGE_BITS) & 0xFFFFF];
+            if (flags & PAGE_CLEAN) storedToCleanPage(addr, sizeof(T));
+            if (flags & PAGE_CODE) storedToCodePage(addr, sizeof(T));
+            atomic_signal_fence(memory_order_seq_cst);
+            SparseMemory::write<T>(memory.base() + addr, value);
+            return true;
+        } else {
+            return store(addr, value);
+        }
+    }
+
+    // Atomics (LR/SC/AMO) work on the host word in place, so harts running
+    // in parallel get real atomicity from the host. They must be naturally
+    // aligned whatever the misaligned-access policy. Returns the word's host
+    // address, or nullptr with access_fault set; a writing access first does
+    // the snapshot and decode cache bookkeeping guestStore would.
+    template <class Mem> uint8_t* atomicWord(uint32_t addr, bool is_store) {
+        if (addr & 3) {
+            access_fault = StopReason::Misaligned;
+            return nullptr;
+        }
+        if constexpr (Mem::reserved) {
+            if (is_store) {
+                uint8_t flags = page_flags[addr >> SparseMemory::PAGE_BITS];
+                if (flags & PAGE_CLEAN) storedToCleanPage(addr, 4);
+                if (flags & PAGE_CODE) storedToCodePage(addr, 4);
+            }
+            atomic_signal_fence(memory_order_seq_cst);
+            return memory.base() + addr;
+        } else {
+            uint32_t offset = addr & SparseMemory::PAGE_MASK;
+            if (!is_store) {
+                const TlbEntry& e = load_tlb[tlbIndex(addr)];
+                uint64_t ignored;
+                if (e.tag != tlbTag(addr, 4) && !loadSlow(addr, 4, ignored)) return nullptr;
+                return e.host + offset;
+            }
+            StoreTlbEntry* e = &store_tlb[tlbIndex(addr)];
+            if (e->tag != tlbTag(addr, 4)) {
+                if (!memory.contains(addr, 4)) {
+                    access_fault = StopReason::Fault;
+                    return nullptr;
+                }
+                if (!page_flags.empty()) storedToCleanPage(addr, 4);
+                e = &fillStoreTlb(addr);
+            }
+            if (e->code) invalidateSlot(e->code, addr, 4);
+            return e->host + offset;
+        }
+    }
+
+    // Bulk access to len bytes of guest memory, one page at a time: f(host,
+    // done, chunk) gets each page's piece in order. The whole range is
+    // bounds-checked first (on both backends), so a faulting access changes
+    // nothing; a store does the same snapshot and decode cache bookkeeping
+    // as guestStore for each piece before f writes it.
+    template <class Mem, class F> bool guestRange(uint32_t addr, uint32_t len, bool is_store, F f) {
+        if (!memory.contains(addr, len)) {
+            access_fault = StopReason::Fault;
+            return false;
+        }
+        for (uint32_t done = 0; done < len;) {
+            uint32_t a = addr + done;
+            uint32_t offset = a & SparseMemory::PAGE_MASK;
+            uint32_t chunk = min(len - done, SparseMemory::PAGE_SIZE - offset);
+            uint8_t* host;
+            if constexpr (Mem::reserved) {
+                host = memory.base() + a;
+                if (is_store) {
+                    uint8_t flags = page_flags[a >> SparseMemory::PAGE_BITS];
+                    if (flags & PAGE_CLEAN) storedToCleanPage(a, chunk);
+                    if (flags & PAGE_CODE) invalidateDecoded(a, chunk);
+                }
+            } else if (is_store) {
+                StoreTlbEntry* e = &store_tlb[tlbIndex(a)];
+                if (e->tag != tlbTag(a, 1)) {
+                    if (!page_flags.empty()) storedToCleanPage(a, chunk);
+                    e = &fillStoreTlb(a);
+                }
+                if (e->code) invalidateDecoded(a, chunk);
+                host = e->host + offset;
+            } else {
+                TlbEntry& e = load_tlb[tlbIndex(a)];
+                if (e.tag != tlbTag(a, 1)) {
+                    e.tag = a & ~SparseMemory::PAGE_MASK;
+                    e.host = memory.page(a);
+                }
+                host = e.host + offset;
+            }
+            f(host, done, chunk);
+            done += chunk;
+        }
+        return true;
+    }
+
+    // Unit-stride vector access: len bytes copied between guest memory and
+    // a register group
+    template <class Mem> bool vectorAccess(uint32_t addr, uint8_t* reg, uint32_t len, uint32_t eew, bool is_store) {
+        if (misaligned(addr, eew)) return false;
+#if !RISCV_HOST_LITTLE_ENDIAN
+        // Registers hold elements in host order, memory little-endian
+        auto swap = [reg, len, eew] { for (uint32_t i = 0; i < len; i += eew) reverse(reg + i, reg + i + eew); };
+        if (is_store) swap();
+#endif
+        bool ok = guestRange<Mem>(addr, len, is_store, [reg, is_store](uint8_t* host, uint32_t done, uint32_t chunk) {
+            if (is_store) memcpy(host, reg + done, chunk);
+            else memcpy(reg + done, host, chunk);
+        });
+#if !RISCV_HOST_LITTLE_ENDIAN
+        if (ok || is_store) swap();
+#endif
+        return ok;
+    }
+
+    // Linux syscalls (Syscall.cpp). linuxSyscall returns the value for a0,
+    // -errno on failure; ECALL itself handles the exits. Guest buffers become
+    // host iovecs over the guest pages themselves; these helpers return false
+    // if a buffer is out of bounds. Only hart 0 gets a heap.
+    LinuxProcess process;
+    template <class Mem> uint32_t linuxSyscall(uint32_t number);
+    template <class Mem> bool guestBuffer(uint32_t addr, uint32_t len, bool is_store, vector<iovec>& iov);
+    template <class Mem> bool guestCopy(uint32_t addr, void* data, uint32_t len, bool is_store);
+    bool guestPath(uint32_t addr, string& path);
+    void resetProcess(uint32_t image_end) { process.reset(image_end, hart_id == 0 ? memory.size() : 0); }
+
+    // Calls f(host, len) on the pieces of the NUL-terminated string at addr,
+    // a page at a time and straight from guest memory, looking at most max
+    // bytes ahead. False if no NUL turns up before max or the end of memory.
+    template <class F> bool guestString(uint32_t addr, uint32_t max, F f) {
+        for (uint32_t done = 0; done < max && memory.contains(addr, 1);) {
+            uint32_t chunk = min(SparseMemory::PAGE_SIZE - (addr & SparseMemory::PAGE_MASK), max - done);
+            if (!memory.contains(addr, chunk)) chunk = (uint32_t)(memory.size() - addr);
+            const char* host = (const char*)memory.page(addr) + (addr & SparseMemory::PAGE_MASK);
+            const char* nul = (const char*)memchr(host, 0, chunk);
+            if (nul != host) f(host, nul ? (uint32_t)(nul - host) : chunk);
+            if (nul) return true;
+            addr += chunk;
+            done += chunk;
+            if (addr == 0) break;   // Ran off the top of a 4 GiB memory
+        }
+        return false;
+    }
+
+    // Guest stdout (print syscalls and console writes)
+    void writeStdout(const char* data, size_t len) {
+        if (capture_output) captured_output.append(data, len);
+        else guest_stdout.write(data, len);
+    }
+    void printString(uint32_t addr);
+
+    // LR/SC reservation: SC succeeds if the word still holds the value LR
+    // read, checked with a host compare-and-swap. Harts never take a lock or
+    // watch each other's stores (an ABA change in between goes unnoticed,
+    // which is what lock-free guest code tolerates anyway).
+    bool reservation_valid = false;
+    uint32_t reservation_addr = 0;
+    uint32_t reservation_value = 0;
+
+    // Block Cache: straight-line runs of decoded ops, chained to their successors
+    static const size_t MAX_BLOCK_OPS = 64;
+    struct Block {
+        uint32_t start_pc = 0;
+        vector<DecodedInst> ops;
+        uint32_t next_pc[2] = {0, 0};           // [0] jump/branch target, [1] fall-through
+        Block* next[2] = {nullptr, nullptr};    // Lazily resolved direct links
+        uint32_t exec_count = 0;
+        JitFn jit_code = nullptr;               // Native translation of ops[0, jit_ops)
+        size_t jit_ops = 0;
+        bool jit_tried = false;
+    };
+    unordered_map<uint32_t, unique_ptr<Block>> blocks;
+    bool code_dirty = false;    // Set when a store hits decoded code
+
+    // JIT: blocks executed JIT_THRESHOLD times are translated to native code
+    static const uint32_t JIT_THRESHOLD = 16;
+    Engine engine = Engine::Block;
+    unique_ptr<JIT> jit;
+
+    uint32_t fetchAt(uint32_t addr);
+    DecodedInst decodeAt(uint32_t addr);
+    // Execution cores, instantiated per tracing policy (see Trace.h) and memory access policy
+    template <class Trace, class Mem> bool execute(const DecodedInst& d);
+    template <class Trace, class Mem> bool step();
+    template <class Trace, class Mem> bool runBlocks(uint64_t budget);
+    template <class Trace, class Mem> bool runThreaded(uint64_t budget);
+    template <class Trace> bool stepAny();
+    template <class Trace> bool runAny(uint64_t budget);
+    template <class Trace, class Body> bool guardFaults(Body body);
+    void invalidateDecoded(uint32_t addr, uint32_t len);
+    void invalidateAllDecoded();
+    void addDecodedPage(uint32_t page_num, DecodedPage* page);
+    DecodedPage* decodedPage(uint32_t page_num);
+    bool slotMatches(const DecodedInst& slot, uint32_t addr);
+    void flushDecodeCache();
+    Block* lookupBlock(uint32_t addr);
+    void flushBlocks();
+    Block* nextBlock(Block* block);
+    bool runJit(Block* block);
 
 public:
     CPU();
+    // A hart running on guest memory shared with other harts (see Machine).
+    // Loading, resizing or switching that memory goes through one hart; the
+    // others must then be told with memoryChanged().
+    CPU(shared_ptr<SparseMemory> shared_memory, uint32_t hart);
+    uint32_t getHartId() const { return hart_id; }
+    void memoryChanged();
     
     // Core Execution
     uint32_t fetch();
     bool executeNext();
+    // Block-chained execution of up to `budget` instructions (RUN_UNLIMITED: until the program stops)
+    static const uint64_t RUN_UNLIMITED = UINT64_MAX;
+    StopReason run(uint64_t budget = RUN_UNLIMITED);
+    
+    // Guest memory size (default 4 MB, up to 4 GiB). Pages are allocated on
+    // first touch; resizing clears memory and resets the stack pointer.
+    void setMemorySize(uint64_t bytes);
+    uint64_t getMemorySize() const { return memory.size(); }
+    
+    // Returns false if the backend is unavailable on this host. Clears memory.
+    bool setMemoryBackend(MemoryBackend backend);
+    MemoryBackend getMemoryBackend() const { return memory.base() ? MemoryBackend::Reserved : MemoryBackend::Paged; }
+    
+    // Applies to data loads and stores on every engine and backend
+    void setMisalignedAccess(MisalignedAccess mode) { trap_misaligned = (mode == MisalignedAccess::Trap); }
+    MisalignedAccess getMisalignedAccess() const { return trap_misaligned ? MisalignedAccess::Trap : MisalignedAccess::Allow; }
     
     // Memory Loaders
     void loadRaw(const vector<uint32_t>& code);
     bool loadELF(const string& filename);
     
+    // Program arguments, after loading: the strings and a Linux-style
+    // argc/argv/envp/auxv block go at the top of the stack, sp points at
+    // argc, a0 = argc and a1 = argv. False if they do not fit in guest memory.
+    bool setArgs(const vector<string>& args);
+    
+    // Fast re-execution: snapshot() captures registers, pc and counters and
+    // starts tracking dirty pages; restore() copies back only the pages
+    // written since, so resetting a run costs time proportional to what it
+    // touched. restore() accepts only the latest snapshot, and loading a
+    // program or resizing/switching memory discards it. Harts on shared
+    // memory cannot snapshot (other harts' stores are not tracked): nullptr.
+    shared_ptr<Snapshot> snapshot();
+    bool restore(const shared_ptr<Snapshot>& snap);
+    size_t getDirtyPageCount() const { return dirty_pages.size(); }
+    
+    // Host access to guest memory, e.g. to inject inputs; writes are tracked
+    // and invalidate decoded code like guest stores. False if out of bounds.
+    bool readMemory(uint32_t addr, void* data, size_t len) { return memory.read(addr, data, len); }
+    bool writeMemory(uint32_t addr, const void* data, size_t len);
+    
+    // Persistent decode cache for ELFs run many times. When enabled, loadELF
+    // maps "<elf>.dcache" if it matches the file's content hash, so a warm
+    // start decodes nothing; saveDecodeCache() writes the pages and blocks
+    // decoded so far (minus anything the guest rewrote) after a cold run.
+    void setDecodeCache(bool enable) { decode_cache_enabled = enable; }
+    bool saveDecodeCache();
+    // Decodes the loaded ELF's executable segments up front (a linear sweep),
+    // so a cache can be saved before any run has warmed it
+    void predecode();
+    bool decodeCacheLoaded() const { return decode_cache_loaded; }
+    uint64_t getDecodeCount() const { return decode_count; }   // Instructions decoded so far
+    
     // Debugging & Visualization
     void printStatus();
+
+    // Write out guest stdout still buffered (run() and exits do this too)
+    void flushOutput() { guest_stdout.flush(); }
     
     // Testing Utilities (New!)
     uint32_t getReg(int idx) const { 
@@ -40,9 +605,43 @@ public:
         return 0; 
     }
     
+    void setReg(int idx, uint32_t value) {
+        if (idx > 0 && idx < 32) regs[idx] = value;
+    }
+    
+    // Raw f register bits (a single is NaN-boxed: upper half all ones)
+    uint64_t getFReg(int idx) const { return (idx >= 0 && idx < 32) ? fregs[idx] : 0; }
+    void setFReg(int idx, uint64_t value) {
+        if (idx >= 0 && idx < 32) fregs[idx] = value;
+    }
+    uint32_t getFcsr() const { return frm << 5 | fflags; }   // As of the end of the last run
+    const uint8_t* getVReg(int idx) const { return (idx >= 0 && idx < 32) ? vregs + idx * VLENB : nullptr; }
+    uint32_t getVl() const { return vl; }
+    uint32_t getPC() const { return pc; }
+    void setPC(uint32_t value) { pc = value; }
+    
     uint64_t getInstructionCount() const { return instruction_count; }
+    PerfCounters getPerfCounters() const { return {load_count, store_count, taken_branch_count, decode_count}; }
+    void setTimingModel(const TimingModel& model) { timing = model; }
+    const TimingModel& getTimingModel() const { return timing; }
+    uint64_t getCycles() const;     // What the cycle CSR reads, as of now
+    size_t getPagesTouched() const { return memory.pageCount(); }
+    StopReason getStopReason() const { return stop_reason; }
     
     void setQuiet(bool q) { quiet_mode = q; }
+    
+    // Collect the guest's stdout (syscall 1: decimal a0, syscall 4:
+    // NUL-terminated string at a0, and writes to fd 1) instead of writing it
+    // to the simulator's stdout
+    void setOutputCapture(bool enable) { capture_output = enable; }
+    string takeOutput() { string out; out.swap(captured_output); return out; }
+    
+    // Stream binary TraceRecords instead of EXEC lines (nullptr to detach)
+    void setTraceWriter(TraceWriter* writer) { trace_writer = writer; }
+    
+    // Returns false if the engine is unavailable on this host
+    bool setEngine(Engine e);
+    Engine getEngine() const { return engine; }
 };
 
 #endif
\ No newline at end of file
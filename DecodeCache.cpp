@@ -0,0 +1,120 @@
+#include "DecodeCache.h"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+static size_t pagesOffset(uint32_t page_count, uint32_t block_count) {
+    size_t end = sizeof(DecodeCacheHeader) + 4 * ((size_t)page_count + block_count);
+    return (end + 63) & ~(size_t)63;
+}
+
+uint64_t contentHash(const uint8_t* data, size_t len) {
+    // Word-at-a-time multiply/xorshift mixing, finalised with the length
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = 0xCBF29CE484222325ull;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w = SparseMemory::read<uint32_t>(data + i) | (uint64_t)SparseMemory::read<uint32_t>(data + i + 4) << 32;
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    for (size_t j = 0; i + j < len; j++) tail |= (uint64_t)data[i + j] << (8 * j);
+    h = (h ^ tail ^ len) * k;
+    return h ^ (h >> 32);
+}
+
+uint64_t decodeCacheOpKey() {
+    static const uint64_t key = [] {
+        string names;
+        for (int i = 0; i < (int)Op::COUNT; i++) {
+            names += opName((Op)i);
+            names += '\0';
+        }
+        return contentHash((const uint8_t*)names.data(), names.size());
+    }();
+    return key;
+}
+
+string decodeCachePath(const string& elf_path) {
+    return elf_path + ".dcache";
+}
+
+bool openDecodeCache(const string& path, uint64_t elf_hash, uint64_t elf_size, DecodeCacheView& view) {
+    auto file = make_shared<MappedFile>();
+    if (!file->open(path) || file->size() < sizeof(DecodeCacheHeader)) return false;
+
+    DecodeCacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, DECODE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != DECODE_CACHE_VERSION || header.inst_size != sizeof(DecodedInst) ||
+        header.op_key != decodeCacheOpKey() || header.elf_hash != elf_hash || header.elf_size != elf_size) {
+        return false;
+    }
+    size_t pages_at = pagesOffset(header.page_count, header.block_count);
+    size_t page_bytes = (size_t)DECODE_CACHE_PAGE_INSTS * sizeof(DecodedInst);
+    if (pages_at + (uint64_t)header.page_count * page_bytes != file->size()) return false;
+
+    // The cores index dispatch tables and register files with these fields
+    // unchecked, so a corrupt slot anywhere rejects the whole file
+    const DecodedInst* slots = (const DecodedInst*)(file->data() + pages_at);
+    for (size_t i = 0; i < (size_t)header.page_count * DECODE_CACHE_PAGE_INSTS; i++) {
+        const DecodedInst& d = slots[i];
+        if (d.op == Op::NONE) continue;
+        if ((uint8_t)d.op >= (uint8_t)Op::COUNT || d.rd >= 32 || d.rs1 >= 32 || d.rs2 >= 32 || (d.len != 2 && d.len != 4)) {
+            return false;
+        }
+    }
+
+    const uint8_t* tables = file->data() + sizeof(DecodeCacheHeader);
+    view.page_count = header.page_count;
+    view.block_count = header.block_count;
+    view.page_numbers = (const uint32_t*)tables;
+    view.block_starts = (const uint32_t*)tables + header.page_count;
+    view.pages = (DecodedInst*)(file->data() + pages_at);
+    view.file = file;
+    return true;
+}
+
+bool writeDecodeCache(const string& path, uint64_t elf_hash, uint64_t elf_size,
+                      const vector<uint32_t>& page_numbers, const vector<const DecodedInst*>& pages,
+                      const vector<uint32_t>& block_starts) {
+    string tmp = path + ".tmp";
+#if defined(__unix__) || defined(__APPLE__)
+    tmp += "." + to_string(getpid());
+#endif
+    // Unique per writer: batch jobs on other threads may save the same cache
+    static atomic<uint64_t> writers(0);
+    tmp += "." + to_string(writers++);
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) return false;
+
+    DecodeCacheHeader header;
+    memcpy(header.magic, DECODE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = DECODE_CACHE_VERSION;
+    header.inst_size = sizeof(DecodedInst);
+    header.op_key = decodeCacheOpKey();
+    header.elf_hash = elf_hash;
+    header.elf_size = elf_size;
+    header.page_count = (uint32_t)page_numbers.size();
+    header.block_count = (uint32_t)block_starts.size();
+
+    size_t padding = pagesOffset(header.page_count, header.block_count) -
+                     (sizeof(header) + 4 * (page_numbers.size() + block_starts.size()));
+    const uint8_t zeros[64] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(page_numbers.data(), 4, page_numbers.size(), out) == page_numbers.size();
+    ok = ok && fwrite(block_starts.data(), 4, block_starts.size(), out) == block_starts.size();
+    ok = ok && fwrite(zeros, 1, padding, out) == padding;
+    for (const DecodedInst* page : pages) {
+        ok = ok && fwrite(page, sizeof(DecodedInst), DECODE_CACHE_PAGE_INSTS, out) == DECODE_CACHE_PAGE_INSTS;
+    }
+    ok = (fclose(out) == 0) && ok;
+    if (ok) ok = rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
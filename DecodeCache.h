@@ -0,0 +1,65 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "Decoder.h"
+#include "Memory.h"
+
+using namespace std;
+
+// Sidecar file of predecoded code for one ELF, written next to it as
+// "<elf>.dcache" and memory-mapped on later loads (see CPU::setDecodeCache).
+//
+// Layout: DecodeCacheHeader, page_count guest page numbers, block_count
+// block start PCs, zero padding to a 64-byte boundary, then page_count
+// arrays of DECODE_CACHE_PAGE_INSTS DecodedInsts. Slots never decoded (or
+// not matching the ELF file) hold Op::NONE and are decoded on demand.
+struct DecodeCacheHeader {
+    char magic[8];          // "RVDCACH\0"
+    uint32_t version;
+    uint32_t inst_size;     // sizeof(DecodedInst): rejects caches from other layouts
+    uint64_t op_key;        // decodeCacheOpKey() of the build that wrote it
+    uint64_t elf_hash;      // contentHash of the whole ELF file
+    uint64_t elf_size;
+    uint32_t page_count;
+    uint32_t block_count;
+};
+
+static const char DECODE_CACHE_MAGIC[8] = {'R', 'V', 'D', 'C', 'A', 'C', 'H', '\0'};
+static const uint32_t DECODE_CACHE_VERSION = 10;  // Bumped whenever the file layout changes
+static const uint32_t DECODE_CACHE_PAGE_INSTS = 2048;  // One 4 KiB guest page, a slot per halfword
+
+// A mapped cache file. Pages are writable (MAP_PRIVATE), so the CPU can
+// invalidate slots in place without touching the file.
+struct DecodeCacheView {
+    shared_ptr<MappedFile> file;
+    uint32_t page_count = 0;
+    uint32_t block_count = 0;
+    const uint32_t* page_numbers = nullptr;
+    const uint32_t* block_starts = nullptr;
+    DecodedInst* pages = nullptr;   // page_count * DECODE_CACHE_PAGE_INSTS
+};
+
+// 64-bit hash of a file's contents (not cryptographic)
+uint64_t contentHash(const uint8_t* data, size_t len);
+
+// Hash of this build's op count and names (the RISCV_OPS X-macro), so a
+// cache written by a build that numbers ops differently is never installed
+uint64_t decodeCacheOpKey();
+
+string decodeCachePath(const string& elf_path);
+
+// False if the file is missing, malformed, was built for another ELF or
+// build, or holds a slot naming an unknown op or a register past x31
+bool openDecodeCache(const string& path, uint64_t elf_hash, uint64_t elf_size, DecodeCacheView& view);
+
+// Writes to a temporary file and renames it into place, so concurrent
+// launches never map a half-written cache
+bool writeDecodeCache(const string& path, uint64_t elf_hash, uint64_t elf_size,
+                      const vector<uint32_t>& page_numbers, const vector<const DecodedInst*>& pages,
+                      const vector<uint32_t>& block_starts);
+
+#endif
@@ -0,0 +1,431 @@
+#include "Decoder.h"
+
+// RV32C: each compressed form is rewritten as its 32-bit equivalent once, at
+// decode time, so the execution cores only ever see 32-bit semantics
+static uint32_t iType(int32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
+    return ((uint32_t)imm & 0xFFF) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+static uint32_t sType(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t opcode) {
+    return ((uint32_t)imm >> 5 & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | ((uint32_t)imm & 0x1F) << 7 | opcode;
+}
+static uint32_t rType(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd) {
+    return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | 0x33;
+}
+static uint32_t bType(int32_t imm, uint32_t rs1, uint32_t funct3) {
+    uint32_t u = (uint32_t)imm;
+    return (u >> 12 & 1) << 31 | (u >> 5 & 0x3F) << 25 | rs1 << 15 | funct3 << 12 | (u >> 1 & 0xF) << 8 | (u >> 11 & 1) << 7 | 0x63;
+}
+static uint32_t jType(int32_t imm, uint32_t rd) {
+    uint32_t u = (uint32_t)imm;
+    return (u >> 20 & 1) << 31 | (u >> 1 & 0x3FF) << 21 | (u >> 11 & 1) << 20 | (u >> 12 & 0xFF) << 12 | rd << 7 | 0x6F;
+}
+static int32_t signExtend(uint32_t value, int bits) {
+    return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+uint32_t expandCompressed(uint16_t c) {
+    uint32_t funct3 = c >> 13;
+    uint32_t rd = (c >> 7) & 0x1F;              // Also rs1
+    uint32_t rs2 = (c >> 2) & 0x1F;
+    uint32_t rdp = 8 + ((c >> 2) & 0x7);        // rd'/rs2' (x8-x15)
+    uint32_t rs1p = 8 + ((c >> 7) & 0x7);       // rs1'
+    int32_t imm6 = signExtend((c >> 7 & 0x20) | (c >> 2 & 0x1F), 6);
+    uint32_t lw_imm = (c >> 7 & 0x38) | (c >> 4 & 0x4) | (c << 1 & 0x40);
+    uint32_t ld_imm = (c >> 7 & 0x38) | (c << 1 & 0xC0);
+    int32_t j_imm = signExtend((c >> 1 & 0x800) | (c >> 7 & 0x10) | (c >> 1 & 0x300) | (c << 2 & 0x400) |
+                               (c >> 1 & 0x40) | (c << 1 & 0x80) | (c >> 2 & 0xE) | (c << 3 & 0x20), 12);
+    int32_t b_imm = signExtend((c >> 4 & 0x100) | (c >> 7 & 0x18) | (c << 1 & 0xC0) | (c >> 2 & 0x6) | (c << 3 & 0x20), 9);
+
+    switch ((c & 0x3) << 3 | funct3) {
+        // Quadrant 0: register-based loads and stores, stack-relative address
+        case 0x00: { // C.ADDI4SPN
+            uint32_t imm = (c >> 7 & 0x30) | (c >> 1 & 0x3C0) | (c >> 4 & 0x4) | (c >> 2 & 0x8);
+            return imm ? iType(imm, 2, 0, rdp, 0x13) : 0;
+        }
+        case 0x01: return iType(ld_imm, rs1p, 3, rdp, 0x07);         // C.FLD
+        case 0x02: return iType(lw_imm, rs1p, 2, rdp, 0x03);         // C.LW
+        case 0x03: return iType(lw_imm, rs1p, 2, rdp, 0x07);         // C.FLW
+        case 0x05: return sType(ld_imm, rdp, rs1p, 3, 0x27);         // C.FSD
+        case 0x06: return sType(lw_imm, rdp, rs1p, 2, 0x23);         // C.SW
+        case 0x07: return sType(lw_imm, rdp, rs1p, 2, 0x27);         // C.FSW
+
+        // Quadrant 1: immediates, arithmetic, jumps and branches
+        case 0x08: return iType(imm6, rd, 0, rd, 0x13);              // C.ADDI (C.NOP)
+        case 0x09: return jType(j_imm, 1);                           // C.JAL
+        case 0x0A: return iType(imm6, 0, 0, rd, 0x13);               // C.LI
+        case 0x0B:
+            if (rd == 2) { // C.ADDI16SP
+                int32_t imm = signExtend((c >> 3 & 0x200) | (c >> 2 & 0x10) | (c << 1 & 0x40) | (c << 4 & 0x180) | (c << 3 & 0x20), 10);
+                return imm ? iType(imm, 2, 0, 2, 0x13) : 0;
+            }
+            return imm6 ? ((uint32_t)imm6 << 12 | rd << 7 | 0x37) : 0;  // C.LUI
+        case 0x0C:
+            switch ((c >> 10) & 0x3) {
+                case 0x0: return (c & 0x1000) ? 0 : iType(rs2, rs1p, 5, rs1p, 0x13);              // C.SRLI
+                case 0x1: return (c & 0x1000) ? 0 : iType(0x400 | rs2, rs1p, 5, rs1p, 0x13);      // C.SRAI
+                case 0x2: return iType(imm6, rs1p, 7, rs1p, 0x13);                                // C.ANDI
+                default: {
+                    if (c & 0x1000) return 0; // RV64 only
+                    static const uint32_t funct3s[4] = { 0, 4, 6, 7 };                            // C.SUB/XOR/OR/AND
+                    uint32_t op = (c >> 5) & 0x3;
+                    return rType(op == 0 ? 0x20 : 0, rdp, rs1p, funct3s[op], rs1p);
+                }
+            }
+        case 0x0D: return jType(j_imm, 0);                           // C.J
+        case 0x0E: return bType(b_imm, rs1p, 0);                     // C.BEQZ
+        case 0x0F: return bType(b_imm, rs1p, 1);                     // C.BNEZ
+
+        // Quadrant 2: full-register forms, stack-pointer loads and stores
+        case 0x10: return (c & 0x1000) ? 0 : iType(rs2, rd, 1, rd, 0x13);                         // C.SLLI
+        case 0x11: return iType((c >> 7 & 0x20) | (c >> 2 & 0x18) | (c << 4 & 0x1C0), 2, 3, rd, 0x07);  // C.FLDSP
+        case 0x12: {                                                                               // C.LWSP
+            uint32_t imm = (c >> 7 & 0x20) | (c >> 2 & 0x1C) | (c << 4 & 0xC0);
+            return rd ? iType(imm, 2, 2, rd, 0x03) : 0;
+        }
+        case 0x13: return iType((c >> 7 & 0x20) | (c >> 2 & 0x1C) | (c << 4 & 0xC0), 2, 2, rd, 0x07);  // C.FLWSP
+        case 0x14:
+            if (!(c & 0x1000)) {
+                if (rs2) return rType(0, rs2, 0, 0, rd);             // C.MV
+                return rd ? iType(0, rd, 0, 0, 0x67) : 0;            // C.JR
+            }
+            if (rs2) return rType(0, rs2, rd, 0, rd);                // C.ADD
+            return rd ? iType(0, rd, 0, 1, 0x67) : 0x00100073;       // C.JALR, C.EBREAK
+        case 0x15: return sType((c >> 7 & 0x38) | (c >> 1 & 0x1C0), rs2, 2, 3, 0x27);             // C.FSDSP
+        case 0x16: return sType((c >> 7 & 0x3C) | (c >> 1 & 0xC0), rs2, 2, 2, 0x23);              // C.SWSP
+        case 0x17: return sType((c >> 7 & 0x3C) | (c >> 1 & 0xC0), rs2, 2, 2, 0x27);              // C.FSWSP
+        default: return 0;
+    }
+}
+
+// Ops that round: rm 5 and 6 are reserved (7 is frm, checked when executed)
+static Op rounding(uint32_t rm, Op op) {
+    return (rm == 5 || rm == 6) ? Op::ILLEGAL : op;
+}
+
+// OP-FP (0x53). Single and double forms differ only in funct7 bit 0; where
+// the op rounds, funct3 is its rounding mode.
+static Op decodeFloat(uint32_t funct7, uint32_t funct3, uint32_t rs2) {
+    bool dbl = funct7 & 1;
+    switch (funct7 & ~1u) {
+        case 0x00: return rounding(funct3, dbl ? Op::FADD_D : Op::FADD_S);
+        case 0x04: return rounding(funct3, dbl ? Op::FSUB_D : Op::FSUB_S);
+        case 0x08: return rounding(funct3, dbl ? Op::FMUL_D : Op::FMUL_S);
+        case 0x0C: return rounding(funct3, dbl ? Op::FDIV_D : Op::FDIV_S);
+        case 0x2C: return rs2 != 0 ? Op::ILLEGAL : rounding(funct3, dbl ? Op::FSQRT_D : Op::FSQRT_S);
+        case 0x10:
+            if (funct3 > 2) return Op::ILLEGAL;
+            return (Op)((int)(dbl ? Op::FSGNJ_D : Op::FSGNJ_S) + funct3);
+        case 0x14:
+            if (funct3 > 1) return Op::ILLEGAL;
+            return funct3 ? (dbl ? Op::FMAX_D : Op::FMAX_S) : (dbl ? Op::FMIN_D : Op::FMIN_S);
+        case 0x20:
+            if (!dbl && rs2 == 1) return rounding(funct3, Op::FCVT_S_D);
+            if (dbl && rs2 == 0) return Op::FCVT_D_S;   // Exact
+            return Op::ILLEGAL;
+        case 0x50:
+        {
+            static const Op cmp[6] = { Op::FLE_S, Op::FLT_S, Op::FEQ_S, Op::FLE_D, Op::FLT_D, Op::FEQ_D };
+            return funct3 > 2 ? Op::ILLEGAL : cmp[dbl * 3 + funct3];
+        }
+        case 0x60:
+            if (rs2 > 1) return Op::ILLEGAL;
+            return rounding(funct3, dbl ? (rs2 ? Op::FCVT_WU_D : Op::FCVT_W_D) : (rs2 ? Op::FCVT_WU_S : Op::FCVT_W_S));
+        case 0x68:
+            if (rs2 > 1) return Op::ILLEGAL;
+            return rounding(funct3, dbl ? (rs2 ? Op::FCVT_D_WU : Op::FCVT_D_W) : (rs2 ? Op::FCVT_S_WU : Op::FCVT_S_W));
+        case 0x70:
+            if (rs2 != 0) return Op::ILLEGAL;
+            if (funct3 == 1) return dbl ? Op::FCLASS_D : Op::FCLASS_S;
+            return (funct3 == 0 && !dbl) ? Op::FMV_X_W : Op::ILLEGAL;
+        case 0x78:
+            return (funct7 == 0x78 && funct3 == 0 && rs2 == 0) ? Op::FMV_W_X : Op::ILLEGAL;
+        default:
+            return Op::ILLEGAL;
+    }
+}
+
+// OP-V (0x57) integer ops in operand form funct3: OPIVV 0, OPIVI 3, OPIVX 4
+static Op vectorForm(uint32_t funct3, Op vv, Op vi, Op vx) {
+    return funct3 == 0x0 ? vv : funct3 == 0x3 ? vi : funct3 == 0x4 ? vx : Op::ILLEGAL;
+}
+
+// OP-V arithmetic by funct6. The OPM forms (funct3 2: vector, 6: scalar)
+// hold the multiplies, reductions and element-0 moves.
+static Op decodeVector(uint32_t funct6, uint32_t funct3, uint32_t rs1, uint32_t rs2) {
+    if (funct3 == 0x2 && funct6 < 8) return (Op)((int)Op::VREDSUM + funct6);
+    switch (funct6) {
+        case 0x00: return vectorForm(funct3, Op::VADD_VV, Op::VADD_VI, Op::VADD_VX);
+        case 0x02: return vectorForm(funct3, Op::VSUB_VV, Op::ILLEGAL, Op::VSUB_VX);
+        case 0x03: return vectorForm(funct3, Op::ILLEGAL, Op::VRSUB_VI, Op::VRSUB_VX);
+        case 0x09: return vectorForm(funct3, Op::VAND_VV, Op::VAND_VI, Op::VAND_VX);
+        case 0x0A: return vectorForm(funct3, Op::VOR_VV, Op::VOR_VI, Op::VOR_VX);
+        case 0x0B: return vectorForm(funct3, Op::VXOR_VV, Op::VXOR_VI, Op::VXOR_VX);
+        case 0x17: return rs2 != 0 ? Op::ILLEGAL : vectorForm(funct3, Op::VMV_V_V, Op::VMV_V_I, Op::VMV_V_X);
+        case 0x10:
+            if (funct3 == 0x2 && rs1 == 0) return Op::VMV_X_S;
+            if (funct3 == 0x6 && rs2 == 0) return Op::VMV_S_X;
+            return Op::ILLEGAL;
+        case 0x25: return funct3 == 0x2 ? Op::VMUL_VV : funct3 == 0x6 ? Op::VMUL_VX : Op::ILLEGAL;
+        default: return Op::ILLEGAL;
+    }
+}
+
+// Element bytes of an unmasked unit-stride vector load/store (the FP
+// load/store opcodes with width 0, 5 or 6; 64-bit elements exceed ELEN),
+// or 0 for any other form of it
+static int32_t vectorWidth(uint32_t inst, uint32_t funct3) {
+    if ((inst >> 25) != 0x1 || ((inst >> 20) & 0x1F) != 0) return 0;  // nf, mew, mop, vm, lumop
+    return funct3 == 0x0 ? 1 : funct3 == 0x5 ? 2 : funct3 == 0x6 ? 4 : 0;
+}
+
+DecodedInst decode(uint32_t inst) {
+    DecodedInst d;
+    if ((inst & 0xFFFF) == 0) { // A null parcel: zero-filled memory halts as before
+        d.op = Op::HALT;
+        d.raw = inst;
+        return d;
+    }
+    if ((inst & 0x3) != 0x3) {
+        uint32_t expanded = expandCompressed((uint16_t)inst);
+        if (expanded) d = decode(expanded);
+        else d.op = Op::ILLEGAL;
+        d.raw = inst & 0xFFFF;
+        d.len = 2;
+        return d;
+    }
+
+    d.raw = inst;
+    d.rd = (inst >> 7) & 0x1F;
+    d.rs1 = (inst >> 15) & 0x1F;
+    d.rs2 = (inst >> 20) & 0x1F;
+
+    uint32_t opcode = inst & 0x7F;
+    uint32_t funct3 = (inst >> 12) & 0x7;
+
+    switch(opcode) {
+        case 0x13: // I-Type Arithmetic
+        {
+            d.imm = (int32_t)inst >> 20;
+            switch(funct3) {
+                case 0x0: d.op = Op::ADDI; break;
+                case 0x2: d.op = Op::SLTI; break;
+                case 0x3: d.op = Op::SLTIU; break;
+                case 0x4: d.op = Op::XORI; break;
+                case 0x6: d.op = Op::ORI; break;
+                case 0x7: d.op = Op::ANDI; break;
+                case 0x1:
+                    if ((inst >> 25) == 0x30) { // Zbb unary ops, selected by the rs2 field
+                        static const Op unary[8] = { Op::CLZ, Op::CTZ, Op::CPOP, Op::ILLEGAL, Op::SEXT_B, Op::SEXT_H, Op::ILLEGAL, Op::ILLEGAL };
+                        d.op = d.rs2 < 8 ? unary[d.rs2] : Op::ILLEGAL;
+                        break;
+                    }
+                    d.op = Op::SLLI; d.imm &= 0x1F; break;
+                case 0x5:
+                    if ((inst >> 20) == 0x287) { d.op = Op::ORC_B; break; }
+                    if ((inst >> 20) == 0x698) { d.op = Op::REV8; break; }
+                    if ((inst >> 25) == 0x30) { d.op = Op::RORI; d.imm &= 0x1F; break; }
+                    d.op = (inst & 0x40000000) ? Op::SRAI : Op::SRLI; d.imm &= 0x1F; break;
+            }
+            break;
+        }
+        case 0x33: // R-Type Arithmetic
+        {
+            if ((inst >> 25) == 0x01) { // RV32M, in funct3 order
+                static const Op muldiv[8] = { Op::MUL, Op::MULH, Op::MULHSU, Op::MULHU, Op::DIV, Op::DIVU, Op::REM, Op::REMU };
+                d.op = muldiv[funct3];
+                break;
+            }
+            // Zba/Zbb share the opcode; any other funct7 keeps the base decoding
+            uint32_t funct7 = inst >> 25;
+            if (funct7 == 0x10 && funct3 != 0 && (funct3 & 1) == 0) {
+                d.op = funct3 == 2 ? Op::SH1ADD : funct3 == 4 ? Op::SH2ADD : Op::SH3ADD;
+                break;
+            }
+            if (funct7 == 0x05 && funct3 >= 4) {
+                static const Op minmax[4] = { Op::MIN, Op::MINU, Op::MAX, Op::MAXU };
+                d.op = minmax[funct3 - 4];
+                break;
+            }
+            if (funct7 == 0x20 && (funct3 == 4 || funct3 >= 6)) {
+                d.op = funct3 == 4 ? Op::XNOR : funct3 == 6 ? Op::ORN : Op::ANDN;
+                break;
+            }
+            if (funct7 == 0x30 && (funct3 == 1 || funct3 == 5)) {
+                d.op = funct3 == 1 ? Op::ROL : Op::ROR;
+                break;
+            }
+            if (funct7 == 0x04 && funct3 == 4 && d.rs2 == 0) {
+                d.op = Op::ZEXT_H;
+                break;
+            }
+            bool alt = inst & 0x40000000;
+            switch(funct3) {
+                case 0x0: d.op = alt ? Op::SUB : Op::ADD; break;
+                case 0x1: d.op = Op::SLL; break;
+                case 0x2: d.op = Op::SLT; break;
+                case 0x3: d.op = Op::SLTU; break;
+                case 0x4: d.op = Op::XOR; break;
+                case 0x5: d.op = alt ? Op::SRA : Op::SRL; break;
+                case 0x6: d.op = Op::OR; break;
+                case 0x7: d.op = Op::AND; break;
+            }
+            break;
+        }
+        case 0x03: // Loads
+        {
+            d.imm = (int32_t)inst >> 20;
+            switch(funct3) {
+                case 0x0: d.op = Op::LB; break;
+                case 0x1: d.op = Op::LH; break;
+                case 0x2: d.op = Op::LW; break;
+                case 0x4: d.op = Op::LBU; break;
+                case 0x5: d.op = Op::LHU; break;
+                default: d.op = Op::LOAD_BAD; break;
+            }
+            break;
+        }
+        case 0x23: // Stores
+        {
+            int32_t imm11_5 = (inst >> 25) & 0x7F;
+            int32_t imm4_0  = (inst >> 7) & 0x1F;
+            d.imm = (imm11_5 << 5) | imm4_0;
+            if (d.imm & 0x800) d.imm |= 0xFFFFF000;
+            switch(funct3) {
+                case 0x0: d.op = Op::SB; break;
+                case 0x1: d.op = Op::SH; break;
+                case 0x2: d.op = Op::SW; break;
+                default: d.op = Op::STORE_BAD; break;
+            }
+            break;
+        }
+        case 0x63: // Branches
+        {
+            int32_t imm12 = (inst >> 31) & 0x1;
+            int32_t imm10_5 = (inst >> 25) & 0x3F;
+            int32_t imm4_1 = (inst >> 8) & 0xF;
+            int32_t imm11 = (inst >> 7) & 0x1;
+            d.imm = (imm12 << 12) | (imm11 << 11) | (imm10_5 << 5) | (imm4_1 << 1);
+            if (imm12) d.imm |= 0xFFFFE000;
+            switch(funct3) {
+                case 0x0: d.op = Op::BEQ; break;
+                case 0x1: d.op = Op::BNE; break;
+                case 0x4: d.op = Op::BLT; break;
+                case 0x5: d.op = Op::BGE; break;
+                case 0x6: d.op = Op::BLTU; break;
+                case 0x7: d.op = Op::BGEU; break;
+                default: d.op = Op::BRANCH_BAD; break;
+            }
+            break;
+        }
+        case 0x37: // LUI
+            d.op = Op::LUI;
+            d.imm = inst & 0xFFFFF000;
+            break;
+        case 0x17: // AUIPC
+            d.op = Op::AUIPC;
+            d.imm = inst & 0xFFFFF000;
+            break;
+        case 0x6F: // JAL
+        {
+            int32_t imm20 = (inst >> 31) & 0x1;
+            int32_t imm10_1 = (inst >> 21) & 0x3FF;
+            int32_t imm11 = (inst >> 20) & 0x1;
+            int32_t imm19_12 = (inst >> 12) & 0xFF;
+            d.imm = (imm20 << 20) | (imm19_12 << 12) | (imm11 << 11) | (imm10_1 << 1);
+            if (d.imm & 0x100000) d.imm |= 0xFFE00000;
+            d.op = Op::JAL;
+            break;
+        }
+        case 0x67: // JALR
+            d.imm = (int32_t)(inst & 0xFFF00000) >> 20;
+            d.op = (funct3 == 0x0) ? Op::JALR : Op::JALR_BAD;
+            break;
+        case 0x2F: // Atomics: funct5 in [31:27], aq/rl bits ignored
+        {
+            static const Op amo[32] = {
+                Op::AMOADD_W, Op::AMOSWAP_W, Op::LR_W, Op::SC_W, Op::AMOXOR_W, Op::ILLEGAL, Op::ILLEGAL, Op::ILLEGAL,
+                Op::AMOOR_W, Op::ILLEGAL, Op::ILLEGAL, Op::ILLEGAL, Op::AMOAND_W, Op::ILLEGAL, Op::ILLEGAL, Op::ILLEGAL,
+                Op::AMOMIN_W, Op::ILLEGAL, Op::ILLEGAL, Op::ILLEGAL, Op::AMOMAX_W, Op::ILLEGAL, Op::ILLEGAL, Op::ILLEGAL,
+                Op::AMOMINU_W, Op::ILLEGAL, Op::ILLEGAL, Op::ILLEGAL, Op::AMOMAXU_W, Op::ILLEGAL, Op::ILLEGAL, Op::ILLEGAL
+            };
+            d.op = (funct3 == 0x2) ? amo[inst >> 27] : Op::ILLEGAL;
+            if (d.op == Op::LR_W && d.rs2 != 0) d.op = Op::ILLEGAL;
+            break;
+        }
+        case 0x0F: // FENCE / FENCE.I (Zifencei)
+            d.op = (funct3 == 0x0) ? Op::FENCE : (funct3 == 0x1) ? Op::FENCE_I : Op::ILLEGAL;
+            break;
+        case 0x07: // FP Loads, or vector loads
+            if (funct3 != 0x2 && funct3 != 0x3) {
+                d.imm = vectorWidth(inst, funct3);
+                d.op = d.imm ? Op::VLE : Op::ILLEGAL;
+                break;
+            }
+            d.imm = (int32_t)inst >> 20;
+            d.op = (funct3 == 0x2) ? Op::FLW : Op::FLD;
+            break;
+        case 0x27: // FP Stores, or vector stores (the source group is in the rd field)
+            if (funct3 != 0x2 && funct3 != 0x3) {
+                d.imm = vectorWidth(inst, funct3);
+                d.op = d.imm ? Op::VSE : Op::ILLEGAL;
+                d.rs2 = d.rd;
+                d.rd = 0;
+                break;
+            }
+            d.imm = ((int32_t)(inst & 0xFE000000) >> 20) | ((inst >> 7) & 0x1F);
+            d.op = (funct3 == 0x2) ? Op::FSW : Op::FSD;
+            break;
+        case 0x43: case 0x47: case 0x4B: case 0x4F: // Fused multiply-add, by opcode then fmt
+        {
+            static const Op fma[8] = { Op::FMADD_S, Op::FMADD_D, Op::FMSUB_S, Op::FMSUB_D,
+                                       Op::FNMSUB_S, Op::FNMSUB_D, Op::FNMADD_S, Op::FNMADD_D };
+            uint32_t fmt = (inst >> 25) & 0x3;
+            d.op = fmt < 2 ? rounding(funct3, fma[((opcode >> 2) & 0x3) * 2 + fmt]) : Op::ILLEGAL;
+            d.imm = (int32_t)((inst >> 27) << 3 | funct3);
+            break;
+        }
+        case 0x53: // FP Arithmetic: funct7 is the operation and fmt (bit 0: double)
+        {
+            d.op = decodeFloat(inst >> 25, funct3, d.rs2);
+            d.imm = (int32_t)funct3;
+            break;
+        }
+        case 0x57: // Vector: funct3 7 sets vl and vtype (imm = vtype), the rest is arithmetic
+            if (funct3 == 0x7) {
+                if (!(inst >> 31)) {
+                    d.op = Op::VSETVLI;
+                    d.imm = (int32_t)((inst >> 20) & 0x7FF);
+                } else if ((inst >> 30) == 0x3) {
+                    d.op = Op::VSETIVLI;
+                    d.imm = (int32_t)((inst >> 20) & 0x3FF);
+                } else {
+                    d.op = (inst >> 25) == 0x40 ? Op::VSETVL : Op::ILLEGAL;
+                }
+                break;
+            }
+            d.op = ((inst >> 25) & 1) ? decodeVector(inst >> 26, funct3, d.rs1, d.rs2) : Op::ILLEGAL;   // Masked forms unsupported
+            if (funct3 == 0x3) d.imm = signExtend(d.rs1, 5);
+            break;
+        case 0x73: // System: ECALL, or a CSR access
+        {
+            static const Op csr[8] = { Op::ECALL, Op::CSRRW, Op::CSRRS, Op::CSRRC, Op::ILLEGAL, Op::CSRRWI, Op::CSRRSI, Op::CSRRCI };
+            d.op = csr[funct3];
+            if (funct3 != 0) d.imm = (int32_t)(inst >> 20);
+            else if (inst >> 7) d.op = Op::ILLEGAL;    // EBREAK and the privileged instructions
+            break;
+        }
+        default:
+            d.op = Op::ILLEGAL;
+            break;
+    }
+    return d;
+}
+
+const char* opName(Op op) {
+    static const char* const names[] = {
+#define RISCV_OP_NAME(name) #name,
+        RISCV_OPS(RISCV_OP_NAME)
+#undef RISCV_OP_NAME
+    };
+    return op < Op::COUNT ? names[(int)op] : "?";
+}
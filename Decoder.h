@@ -0,0 +1,84 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <cstdint>
+
+// Every instruction form the execution core knows about. Malformed encodings
+// get their own op so the core reproduces the original error behaviour
+// without looking at the raw bits again. Kept as an X-macro so dispatch
+// tables (see CPU::runThreaded) always line up with the enum.
+#define RISCV_OPS(X) \
+    X(NONE)     /* Empty decode-cache slot */ \
+    X(HALT)     /* Null instruction (0x00000000) */ \
+    /* I-Type Arithmetic */ \
+    X(ADDI) X(SLTI) X(SLTIU) X(XORI) X(ORI) X(ANDI) X(SLLI) X(SRLI) X(SRAI) \
+    /* R-Type Arithmetic */ \
+    X(ADD) X(SUB) X(SLL) X(SLT) X(SLTU) X(XOR) X(SRL) X(SRA) X(OR) X(AND) \
+    /* Multiply & Divide (RV32M) */ \
+    X(MUL) X(MULH) X(MULHSU) X(MULHU) X(DIV) X(DIVU) X(REM) X(REMU) \
+    /* Bit Manipulation (Zba, Zbb) */ \
+    X(SH1ADD) X(SH2ADD) X(SH3ADD) X(ANDN) X(ORN) X(XNOR) X(MIN) X(MINU) X(MAX) X(MAXU) \
+    X(ROL) X(ROR) X(RORI) X(CLZ) X(CTZ) X(CPOP) X(SEXT_B) X(SEXT_H) X(ZEXT_H) X(REV8) X(ORC_B) \
+    /* Loads & Stores */ \
+    X(LB) X(LH) X(LW) X(LBU) X(LHU) X(LOAD_BAD) \
+    X(SB) X(SH) X(SW) X(STORE_BAD) \
+    /* Branches */ \
+    X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU) X(BRANCH_BAD) \
+    /* Upper Immediates & Jumps */ \
+    X(LUI) X(AUIPC) X(JAL) X(JALR) X(JALR_BAD) \
+    /* Atomics (RV32A, word only) */ \
+    X(LR_W) X(SC_W) X(AMOSWAP_W) X(AMOADD_W) X(AMOXOR_W) X(AMOAND_W) X(AMOOR_W) \
+    X(AMOMIN_W) X(AMOMAX_W) X(AMOMINU_W) X(AMOMAXU_W) \
+    /* Floating-Point (RV32F/D): rm is in imm[2:0], an FMA's rs3 in imm[7:3] */ \
+    X(FLW) X(FLD) X(FSW) X(FSD) \
+    X(FMADD_S) X(FMSUB_S) X(FNMSUB_S) X(FNMADD_S) X(FMADD_D) X(FMSUB_D) X(FNMSUB_D) X(FNMADD_D) \
+    X(FADD_S) X(FSUB_S) X(FMUL_S) X(FDIV_S) X(FSQRT_S) X(FSGNJ_S) X(FSGNJN_S) X(FSGNJX_S) X(FMIN_S) X(FMAX_S) \
+    X(FADD_D) X(FSUB_D) X(FMUL_D) X(FDIV_D) X(FSQRT_D) X(FSGNJ_D) X(FSGNJN_D) X(FSGNJX_D) X(FMIN_D) X(FMAX_D) \
+    X(FEQ_S) X(FLT_S) X(FLE_S) X(FEQ_D) X(FLT_D) X(FLE_D) X(FCLASS_S) X(FCLASS_D) \
+    X(FCVT_W_S) X(FCVT_WU_S) X(FCVT_S_W) X(FCVT_S_WU) X(FCVT_W_D) X(FCVT_WU_D) X(FCVT_D_W) X(FCVT_D_WU) \
+    X(FCVT_S_D) X(FCVT_D_S) X(FMV_X_W) X(FMV_W_X) \
+    /* Vector (RVV 1.0 integer subset, unmasked): VSETIVLI's AVL is in rs1, VLE/VSE's */ \
+    /* element bytes in imm and VSE's source group in rs2; _VI ops take imm */ \
+    X(VSETVLI) X(VSETIVLI) X(VSETVL) X(VLE) X(VSE) \
+    X(VADD_VV) X(VADD_VX) X(VADD_VI) X(VSUB_VV) X(VSUB_VX) X(VRSUB_VX) X(VRSUB_VI) \
+    X(VAND_VV) X(VAND_VX) X(VAND_VI) X(VOR_VV) X(VOR_VX) X(VOR_VI) X(VXOR_VV) X(VXOR_VX) X(VXOR_VI) \
+    X(VMUL_VV) X(VMUL_VX) X(VMV_V_V) X(VMV_V_X) X(VMV_V_I) X(VMV_X_S) X(VMV_S_X) \
+    X(VREDSUM) X(VREDAND) X(VREDOR) X(VREDXOR) X(VREDMINU) X(VREDMIN) X(VREDMAXU) X(VREDMAX) \
+    /* System */ \
+    X(FENCE) X(FENCE_I) \
+    X(ECALL) \
+    X(CSRRW) X(CSRRS) X(CSRRC) X(CSRRWI) X(CSRRSI) X(CSRRCI)  /* Zicsr: imm = CSR number */ \
+    X(ILLEGAL)  /* Unknown opcode */
+
+enum class Op : uint8_t {
+#define RISCV_OP_ENUM(name) name,
+    RISCV_OPS(RISCV_OP_ENUM)
+#undef RISCV_OP_ENUM
+    COUNT
+};
+
+// Fully decoded instruction: register indices and a sign-extended immediate,
+// so the execution core never touches the raw encoding on the hot path.
+// Compressed instructions decode to the op of their 32-bit expansion and
+// only differ in len (raw keeps the 16-bit parcel).
+struct DecodedInst {
+    Op op = Op::NONE;
+    uint8_t rd = 0;
+    uint8_t rs1 = 0;
+    uint8_t rs2 = 0;
+    uint8_t len = 4;    // Instruction length in bytes: 4, or 2 (RVC)
+    int32_t imm = 0;
+    uint32_t raw = 0;
+};
+
+// Decodes the instruction in the low bits of inst: a 16-bit parcel whose
+// low two bits are not 11 is compressed, and the upper half is ignored
+DecodedInst decode(uint32_t inst);
+
+// 32-bit equivalent of an RV32C instruction, or 0 if it is illegal/reserved
+uint32_t expandCompressed(uint16_t inst);
+
+// Mnemonic for an op (e.g. "ADDI", "BRANCH_BAD")
+const char* opName(Op op);
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cfenv>
+#include <limits>
+#include <type_traits>
+
+using namespace std;
+
+// RV32F/D on the host FPU. Guest arithmetic is the host's own float and
+// double arithmetic, run in the guest's rounding mode (installed in the host
+// environment for a whole run), and the host's sticky exception flags are
+// only read back when the guest reads fflags or a run ends. Where x86 and
+// RISC-V disagree the helpers below follow the spec: NaN results are the
+// canonical NaN, singles are NaN-boxed in the 64-bit registers, and min/max,
+// compares and float-to-integer conversions saturate and flag like RISC-V.
+
+// fflags bits
+static const uint32_t FFLAG_NX = 1;     // Inexact
+static const uint32_t FFLAG_UF = 2;     // Underflow
+static const uint32_t FFLAG_OF = 4;     // Overflow
+static const uint32_t FFLAG_DZ = 8;     // Divide by zero
+static const uint32_t FFLAG_NV = 16;    // Invalid operation
+
+// Rounding modes (frm, or an instruction's rm field where 7 means frm)
+static const uint32_t RM_RNE = 0;
+static const uint32_t RM_RTZ = 1;
+static const uint32_t RM_RDN = 2;
+static const uint32_t RM_RUP = 3;
+static const uint32_t RM_RMM = 4;
+static const uint32_t RM_DYN = 7;
+
+// Host mode for a guest one. The host has no round-to-max-magnitude: RMM
+// arithmetic goes through roundMaxMagnitude instead, and while frm is RMM
+// the host mode is just left at nearest-even.
+inline int hostRounding(uint32_t rm) {
+    switch (rm) {
+        case RM_RTZ: return FE_TOWARDZERO;
+        case RM_RDN: return FE_DOWNWARD;
+        case RM_RUP: return FE_UPWARD;
+        default: return FE_TONEAREST;
+    }
+}
+
+// The host's sticky exception flags as fflags bits
+inline uint32_t hostFlags() {
+    int raised = fetestexcept(FE_ALL_EXCEPT);
+    return ((raised & FE_INEXACT) ? FFLAG_NX : 0) | ((raised & FE_UNDERFLOW) ? FFLAG_UF : 0) |
+           ((raised & FE_OVERFLOW) ? FFLAG_OF : 0) | ((raised & FE_DIVBYZERO) ? FFLAG_DZ : 0) |
+           ((raised & FE_INVALID) ? FFLAG_NV : 0);
+}
+
+// Round-to-max-magnitude (nearest, ties away from zero) for an arithmetic
+// result of type T. op(W()) evaluates the operation on operands widened to
+// W, which has at least one more significand bit than T, in round-toward-
+// zero. Every T value and every midpoint between two of them is then a W
+// value, so the truncated wide result reaches a midpoint exactly when the
+// true result does, and comparing against the midpoint decides the final
+// rounding. fflags are worked out for the final result; the host mode and
+// flags are otherwise left as they were, with host_mode installed.
+template <class T> using WideFloat = typename conditional<is_same<T, float>::value, double, long double>::type;
+template <class T> constexpr bool hasRoundMaxMagnitude() {
+    return numeric_limits<WideFloat<T>>::digits > numeric_limits<T>::digits;
+}
+
+template <class T, class F> T roundMaxMagnitude(F op, int host_mode) {
+    using W = WideFloat<T>;
+    fexcept_t saved;
+    fegetexceptflag(&saved, FE_ALL_EXCEPT);
+    feclearexcept(FE_ALL_EXCEPT);
+    fesetround(FE_TOWARDZERO);
+    W wide = op(W());
+    int raised = fetestexcept(FE_INVALID | FE_DIVBYZERO);
+    bool inexact = fetestexcept(FE_INEXACT) != 0;
+
+    T result = (T)wide;     // Truncated
+    if (isfinite(wide) && (W)result != wide) {
+        T away = nextafter(result, wide < 0 ? -numeric_limits<T>::infinity() : numeric_limits<T>::infinity());
+        // Half a step away from the truncated value; past the largest finite
+        // value the step is that of the binade below
+        W step = isinf(away) ? (W)result - (W)nextafter(result, (T)0) : (W)away - (W)result;
+        if (fabs(wide) >= fabs((W)result + step / 2)) result = away;
+        inexact = true;
+    }
+
+    fesetround(host_mode);
+    fesetexceptflag(&saved, FE_ALL_EXCEPT);
+    // Tiny after rounding: below the midpoint between the smallest normal
+    // and the value one step under it at full precision
+    const W normal = (W)numeric_limits<T>::min();
+    bool tiny = fabs(wide) < normal - ldexp(normal, -numeric_limits<T>::digits - 1);
+    if (isinf(result) && isfinite(wide)) raised |= FE_OVERFLOW;
+    if (inexact && tiny) raised |= FE_UNDERFLOW;
+    if (inexact) raised |= FE_INEXACT;
+    if (raised) feraiseexcept(raised);
+    return result;
+}
+
+// Bit patterns. A single lives in the low half of an f register with the
+// upper half all ones; anything else reads as the canonical NaN.
+inline uint32_t floatBits(float f) { uint32_t b; memcpy(&b, &f, 4); return b; }
+inline float bitsFloat(uint32_t b) { float f; memcpy(&f, &b, 4); return f; }
+inline uint64_t doubleBits(double v) { uint64_t b; memcpy(&b, &v, 8); return b; }
+inline double bitsDouble(uint64_t b) { double v; memcpy(&v, &b, 8); return v; }
+
+static const uint32_t CANONICAL_NAN_S = 0x7FC00000;
+static const uint64_t CANONICAL_NAN_D = 0x7FF8000000000000ull;
+
+inline uint64_t boxSingle(uint32_t bits) { return 0xFFFFFFFF00000000ull | bits; }
+inline float unboxSingle(uint64_t reg) {
+    return bitsFloat((reg >> 32) == 0xFFFFFFFF ? (uint32_t)reg : CANONICAL_NAN_S);
+}
+
+// Register value of an arithmetic result: NaNs become the canonical NaN
+inline uint64_t resultBits(float f) { return boxSingle(f != f ? CANONICAL_NAN_S : floatBits(f)); }
+inline uint64_t resultBits(double v) { return v != v ? CANONICAL_NAN_D : doubleBits(v); }
+
+inline bool isSignaling(float f) { return (floatBits(f) & 0x7FC00000) == 0x7F800000 && (floatBits(f) & 0x003FFFFF); }
+inline bool isSignaling(double v) {
+    return (doubleBits(v) & 0x7FF8000000000000ull) == 0x7FF0000000000000ull && (doubleBits(v) & 0x0007FFFFFFFFFFFFull);
+}
+
+// FMIN/FMAX: a NaN operand loses to a number, -0 is below +0, and only
+// signaling NaNs raise invalid
+template <class T> T fpMinMax(T a, T b, bool is_max, uint32_t& flags) {
+    if (isSignaling(a) || isSignaling(b)) flags |= FFLAG_NV;
+    if (a != a) return b;   // Canonicalised by the caller if both are NaN
+    if (b != b) return a;
+    if (a == b) return (signbit(a) != is_max) ? a : b;
+    return ((a < b) != is_max) ? a : b;
+}
+
+// FEQ is quiet (invalid only for signaling NaNs), FLT/FLE signal on any NaN
+template <class T> uint32_t fpCompare(T a, T b, int kind, uint32_t& flags) {
+    if (a != a || b != b) {
+        if (kind != 0 || isSignaling(a) || isSignaling(b)) flags |= FFLAG_NV;
+        return 0;
+    }
+    return kind == 0 ? a == b : kind == 1 ? a < b : a <= b;
+}
+
+// FCLASS: one-hot class mask
+template <class T> uint32_t fpClass(T v) {
+    bool neg = signbit(v);
+    switch (fpclassify(v)) {
+        case FP_INFINITE: return neg ? 1u << 0 : 1u << 7;
+        case FP_NORMAL: return neg ? 1u << 1 : 1u << 6;
+        case FP_SUBNORMAL: return neg ? 1u << 2 : 1u << 5;
+        case FP_ZERO: return neg ? 1u << 3 : 1u << 4;
+        default: return isSignaling(v) ? 1u << 8 : 1u << 9;
+    }
+}
+
+// FCVT.W[U]: round in the given (resolved) mode without touching the host
+// mode, then saturate. NaN and out-of-range values give the spec's limits
+// and invalid; anything else that was rounded is inexact. Singles convert
+// through double, which holds them exactly.
+template <class I> I fpToInt(double v, uint32_t rm, uint32_t& flags) {
+    if (v != v) {
+        flags |= FFLAG_NV;
+        return numeric_limits<I>::max();
+    }
+    double r;
+    switch (rm) {
+        case RM_RTZ: r = trunc(v); break;
+        case RM_RDN: r = floor(v); break;
+        case RM_RUP: r = ceil(v); break;
+        case RM_RMM: r = round(v); break;
+        default: r = (v - floor(v) == 0.5) ? 2 * round(v / 2) : round(v); break;   // Ties to even
+    }
+    if (r < (double)numeric_limits<I>::min() || r > (double)numeric_limits<I>::max()) {
+        flags |= FFLAG_NV;
+        return r < 0 ? numeric_limits<I>::min() : numeric_limits<I>::max();
+    }
+    if (r != v) flags |= FFLAG_NX;
+    return (I)r;
+}
+
+#endif
@@ -0,0 +1,394 @@
+#include "JIT.h"
+#include "CPU.h"
+#include <cstring>
+
+#if RISCV_JIT_AVAILABLE
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cpuid.h>
+#endif
+
+// Translated blocks only run in quiet mode (NoTrace), so faults are
+// reported through the exit state alone, with no message.
+int JIT::loadHelper(CPU* cpu, uint32_t addr, uint32_t rd, uint32_t op) {
+    uint32_t value = 0;
+    bool ok = false;
+    switch((Op)op) {
+        case Op::LB: { uint8_t v; ok = cpu->load(addr, v); value = (int8_t)v; break; }
+        case Op::LH: { uint16_t v; ok = cpu->load(addr, v); value = (int16_t)v; break; }
+        case Op::LW: ok = cpu->load(addr, value); break;
+        case Op::LBU: { uint8_t v; ok = cpu->load(addr, v); value = v; break; }
+        case Op::LHU: { uint16_t v; ok = cpu->load(addr, v); value = v; break; }
+        default: break;
+    }
+    if (!ok) return 1;
+    cpu->regs[rd] = value;
+    cpu->load_count++;
+    return 0;
+}
+
+int JIT::storeHelper(CPU* cpu, uint32_t addr, uint32_t val, uint32_t op) {
+    bool ok = false;
+    switch((Op)op) {
+        case Op::SB: ok = cpu->store(addr, (uint8_t)val); break;
+        case Op::SH: ok = cpu->store(addr, (uint16_t)val); break;
+        case Op::SW: ok = cpu->store(addr, val); break;
+        default: break;
+    }
+    if (!ok) return 1;
+    cpu->store_count++;
+    return cpu->code_dirty ? 2 : 0;
+}
+
+#if RISCV_JIT_AVAILABLE
+
+// The code buffer is never writable and executable at once: it stays
+// read/execute, and compile() opens a writable window over just the pages
+// a new block lands on. Chaining goes through the Block structs, so
+// emitted code is never patched afterwards.
+JIT::JIT() {
+    void* mem = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        buffer = (uint8_t*)mem;
+        capacity = CODE_BUFFER_SIZE;
+    }
+    unsigned a, b, c, d;
+    if (__get_cpuid(1, &a, &b, &c, &d)) has_popcnt = c & bit_POPCNT;
+    if (__get_cpuid(0x80000001, &a, &b, &c, &d)) has_lzcnt = c & bit_LZCNT;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) has_tzcnt = b & bit_BMI;
+}
+
+JIT::~JIT() {
+    if (buffer) munmap(buffer, capacity);
+}
+
+namespace {
+
+// x86-64 register numbers
+enum Reg : uint8_t { EAX = 0, ECX = 1, EDX = 2, ESI = 6 };
+
+// Minimal x86-64 emitter. Guest registers live in memory at [rbx + 4*i],
+// the CPU pointer is kept in r12 for helper calls.
+struct Emitter {
+    vector<uint8_t> code;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) byte((v >> (8 * i)) & 0xFF); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; i++) byte((v >> (8 * i)) & 0xFF); }
+
+    // reg <- guest x[idx]  (x0 is always zero)
+    void loadGuest(Reg r, uint32_t idx) {
+        if (idx == 0) { byte(0x31); byte(0xC0 | (r << 3) | r); return; }   // xor r, r
+        byte(0x8B); byte(0x40 | (r << 3) | 3); byte(idx * 4);               // mov r, [rbx+disp8]
+    }
+
+    // guest x[idx] <- reg  (writes to x0 are dropped)
+    void storeGuest(uint32_t idx, Reg r) {
+        if (idx == 0) return;
+        byte(0x89); byte(0x40 | (r << 3) | 3); byte(idx * 4);               // mov [rbx+disp8], r
+    }
+
+    void movImm(Reg r, uint32_t v) { byte(0xB8 + r); u32(v); }             // mov r, imm32
+
+    // ALU op with register source: op dst, src
+    void aluReg(uint8_t opcode, Reg dst, Reg src) { byte(opcode); byte(0xC0 | (src << 3) | dst); }
+
+    // ALU op with immediate (81 /digit id)
+    void aluImm(uint8_t digit, Reg dst, uint32_t imm) { byte(0x81); byte(0xC0 | (digit << 3) | dst); u32(imm); }
+
+    // Shift by immediate (C1 /digit ib) or by CL (D3 /digit)
+    void shiftImm(uint8_t digit, Reg dst, uint8_t amount) { byte(0xC1); byte(0xC0 | (digit << 3) | dst); byte(amount); }
+    void shiftCl(uint8_t digit, Reg dst) { byte(0xD3); byte(0xC0 | (digit << 3) | dst); }
+
+    // eax <- (flags satisfy cc) ? 1 : 0
+    void setccEax(uint8_t cc) {
+        byte(0x0F); byte(0x90 | cc); byte(0xC0);     // setcc al
+        byte(0x0F); byte(0xB6); byte(0xC0);          // movzx eax, al
+    }
+
+    // jcc rel32 / jmp rel32, return offset of the rel32 field for patching
+    size_t jcc(uint8_t cc) { byte(0x0F); byte(0x80 | cc); size_t at = code.size(); u32(0); return at; }
+    size_t jmp() { byte(0xE9); size_t at = code.size(); u32(0); return at; }
+
+    void patch(size_t at) {
+        uint32_t rel = (uint32_t)(code.size() - (at + 4));
+        memcpy(&code[at], &rel, 4);
+    }
+
+    void prologue() {
+        byte(0x53);                                  // push rbx
+        byte(0x41); byte(0x54);                      // push r12
+        byte(0x48); byte(0x83); byte(0xEC); byte(0x08);  // sub rsp, 8 (keep 16-byte alignment)
+        byte(0x48); byte(0x89); byte(0xFB);          // mov rbx, rdi
+        byte(0x49); byte(0x89); byte(0xF4);          // mov r12, rsi
+    }
+
+    // Return the packed exit state
+    void exit(uint64_t state) {
+        byte(0x48); byte(0xB8); u64(state);          // movabs rax, state
+        byte(0x48); byte(0x83); byte(0xC4); byte(0x08);  // add rsp, 8
+        byte(0x41); byte(0x5C);                      // pop r12
+        byte(0x5B);                                  // pop rbx
+        byte(0xC3);                                  // ret
+    }
+
+    void callHelper(const void* fn) {
+        byte(0x4C); byte(0x89); byte(0xE7);          // mov rdi, r12
+        byte(0x48); byte(0xB8); u64((uint64_t)fn);   // movabs rax, fn
+        byte(0xFF); byte(0xD0);                      // call rax
+        byte(0x85); byte(0xC0);                      // test eax, eax
+    }
+};
+
+// x86 condition codes
+const uint8_t CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD;
+
+uint64_t exitState(uint32_t pc, uint64_t retired, bool fault = false, bool taken = false) {
+    return (uint64_t)pc | (retired << 32) | ((uint64_t)taken << 62) | ((uint64_t)fault << 63);
+}
+
+} // namespace
+
+JitFn JIT::compile(const vector<DecodedInst>& ops, uint32_t start_pc, size_t& compiled_ops) {
+    compiled_ops = 0;
+    if (!buffer || full()) return nullptr;
+
+    Emitter e;
+    e.prologue();
+
+    struct PendingExit { size_t at; uint64_t state; bool store; uint64_t store_state; };
+    vector<PendingExit> exits;
+
+    uint32_t pc = start_pc;
+    size_t i = 0;
+    bool terminated = false;
+
+    for (; i < ops.size() && !terminated; pc += ops[i].len, i++) {
+        const DecodedInst& d = ops[i];
+        uint32_t imm = (uint32_t)d.imm;
+        bool handled = true;
+
+        switch(d.op) {
+            case Op::ADDI:  e.loadGuest(EAX, d.rs1); e.aluImm(0, EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::XORI:  e.loadGuest(EAX, d.rs1); e.aluImm(6, EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::ORI:   e.loadGuest(EAX, d.rs1); e.aluImm(1, EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::ANDI:  e.loadGuest(EAX, d.rs1); e.aluImm(4, EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::SLTI:  e.loadGuest(EAX, d.rs1); e.aluImm(7, EAX, imm); e.setccEax(CC_L); e.storeGuest(d.rd, EAX); break;
+            case Op::SLTIU: e.loadGuest(EAX, d.rs1); e.aluImm(7, EAX, imm); e.setccEax(CC_B); e.storeGuest(d.rd, EAX); break;
+            case Op::SLLI:  e.loadGuest(EAX, d.rs1); e.shiftImm(4, EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::SRLI:  e.loadGuest(EAX, d.rs1); e.shiftImm(5, EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::SRAI:  e.loadGuest(EAX, d.rs1); e.shiftImm(7, EAX, imm); e.storeGuest(d.rd, EAX); break;
+
+            case Op::ADD: case Op::SUB: case Op::XOR: case Op::OR: case Op::AND:
+            {
+                uint8_t opcode = d.op == Op::ADD ? 0x01 : d.op == Op::SUB ? 0x29 : d.op == Op::XOR ? 0x31 : d.op == Op::OR ? 0x09 : 0x21;
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2); e.aluReg(opcode, EAX, ECX); e.storeGuest(d.rd, EAX);
+                break;
+            }
+            case Op::SLL: case Op::SRL: case Op::SRA:
+            {
+                uint8_t digit = d.op == Op::SLL ? 4 : d.op == Op::SRL ? 5 : 7;
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2); e.shiftCl(digit, EAX); e.storeGuest(d.rd, EAX);
+                break;
+            }
+            case Op::SLT: case Op::SLTU:
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2); e.aluReg(0x39, EAX, ECX);
+                e.setccEax(d.op == Op::SLT ? CC_L : CC_B); e.storeGuest(d.rd, EAX);
+                break;
+
+            case Op::MUL:
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2);
+                e.byte(0x0F); e.byte(0xAF); e.byte(0xC1);           // imul eax, ecx
+                e.storeGuest(d.rd, EAX);
+                break;
+            case Op::MULH: case Op::MULHU:
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2);
+                e.byte(0xF7); e.byte(d.op == Op::MULH ? 0xE9 : 0xE1);  // imul/mul ecx: edx:eax = eax * ecx
+                e.storeGuest(d.rd, EDX);
+                break;
+            case Op::MULHSU:
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2);   // 32-bit loads zero-extend rcx
+                e.byte(0x48); e.byte(0x63); e.byte(0xC0);           // movsxd rax, eax
+                e.byte(0x48); e.byte(0x0F); e.byte(0xAF); e.byte(0xC1);  // imul rax, rcx
+                e.byte(0x48); e.byte(0xC1); e.byte(0xE8); e.byte(0x20);  // shr rax, 32
+                e.storeGuest(d.rd, EAX);
+                break;
+            case Op::DIV: case Op::DIVU: case Op::REM: case Op::REMU:
+            {
+                // x86 division faults on a zero divisor and on INT_MIN / -1, so
+                // both are branched around with the RISC-V results
+                bool is_signed = d.op == Op::DIV || d.op == Op::REM;
+                bool is_rem = d.op == Op::REM || d.op == Op::REMU;
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2);
+                e.byte(0x85); e.byte(0xC9);                          // test ecx, ecx
+                size_t by_zero = e.jcc(CC_E);
+                size_t overflow_done = 0;
+                if (is_signed) {
+                    e.byte(0x83); e.byte(0xF9); e.byte(0xFF);        // cmp ecx, -1
+                    size_t plain1 = e.jcc(CC_NE);
+                    e.aluImm(7, EAX, 0x80000000);                    // cmp eax, INT_MIN
+                    size_t plain2 = e.jcc(CC_NE);
+                    if (is_rem) { e.byte(0x31); e.byte(0xC0); }      // xor eax, eax (quotient stays INT_MIN)
+                    overflow_done = e.jmp();
+                    e.patch(plain1);
+                    e.patch(plain2);
+                    e.byte(0x99);                                    // cdq
+                    e.byte(0xF7); e.byte(0xF9);                      // idiv ecx
+                } else {
+                    e.byte(0x31); e.byte(0xD2);                      // xor edx, edx
+                    e.byte(0xF7); e.byte(0xF1);                      // div ecx
+                }
+                if (is_rem) { e.byte(0x89); e.byte(0xD0); }          // mov eax, edx
+                size_t divided = e.jmp();
+                e.patch(by_zero);
+                if (!is_rem) e.movImm(EAX, UINT32_MAX);              // remainder is the dividend, still in eax
+                if (is_signed) e.patch(overflow_done);
+                e.patch(divided);
+                e.storeGuest(d.rd, EAX);
+                break;
+            }
+
+            case Op::SH1ADD: case Op::SH2ADD: case Op::SH3ADD:
+            {
+                uint8_t scale = d.op == Op::SH1ADD ? 0x40 : d.op == Op::SH2ADD ? 0x80 : 0xC0;
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2);
+                e.byte(0x8D); e.byte(0x04); e.byte(scale | 0x01);   // lea eax, [rcx + rax*scale]
+                e.storeGuest(d.rd, EAX);
+                break;
+            }
+            case Op::ANDN: case Op::ORN: case Op::XNOR:
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2);
+                if (d.op != Op::XNOR) { e.byte(0xF7); e.byte(0xD1); }   // not ecx
+                e.aluReg(d.op == Op::ANDN ? 0x21 : d.op == Op::ORN ? 0x09 : 0x31, EAX, ECX);
+                if (d.op == Op::XNOR) { e.byte(0xF7); e.byte(0xD0); }   // not eax
+                e.storeGuest(d.rd, EAX);
+                break;
+            case Op::MIN: case Op::MINU: case Op::MAX: case Op::MAXU:
+            {
+                // eax <- rs2 when rs1 is not already the result
+                uint8_t cc = d.op == Op::MIN ? 0xF : d.op == Op::MINU ? 0x7 : d.op == Op::MAX ? CC_L : CC_B;
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2); e.aluReg(0x39, EAX, ECX);
+                e.byte(0x0F); e.byte(0x40 | cc); e.byte(0xC1);      // cmovcc eax, ecx
+                e.storeGuest(d.rd, EAX);
+                break;
+            }
+            case Op::ROL: case Op::ROR:
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2); e.shiftCl(d.op == Op::ROL ? 0 : 1, EAX); e.storeGuest(d.rd, EAX);
+                break;
+            case Op::RORI:  e.loadGuest(EAX, d.rs1); e.shiftImm(1, EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::CLZ: case Op::CTZ: case Op::CPOP:
+            {
+                bool native = d.op == Op::CLZ ? has_lzcnt : d.op == Op::CTZ ? has_tzcnt : has_popcnt;
+                if (!native) { handled = false; break; }
+                e.loadGuest(EAX, d.rs1);
+                e.byte(0xF3); e.byte(0x0F);                          // lzcnt/tzcnt/popcnt eax, eax (32 for zero)
+                e.byte(d.op == Op::CLZ ? 0xBD : d.op == Op::CTZ ? 0xBC : 0xB8); e.byte(0xC0);
+                e.storeGuest(d.rd, EAX);
+                break;
+            }
+            case Op::SEXT_B: case Op::SEXT_H: case Op::ZEXT_H:
+                e.loadGuest(EAX, d.rs1);
+                e.byte(0x0F); e.byte(d.op == Op::SEXT_B ? 0xBE : d.op == Op::SEXT_H ? 0xBF : 0xB7); e.byte(0xC0);  // movsx/movzx eax, al/ax
+                e.storeGuest(d.rd, EAX);
+                break;
+            case Op::REV8:  e.loadGuest(EAX, d.rs1); e.byte(0x0F); e.byte(0xC8); e.storeGuest(d.rd, EAX); break;  // bswap eax
+            case Op::ORC_B:
+                e.loadGuest(EAX, d.rs1);
+                e.byte(0x89); e.byte(0xC1);                          // mov ecx, eax
+                e.aluImm(4, ECX, 0x7F7F7F7F); e.aluImm(0, ECX, 0x7F7F7F7F);
+                e.aluReg(0x09, ECX, EAX); e.aluImm(4, ECX, 0x80808080);
+                e.shiftImm(5, ECX, 7);
+                e.byte(0x69); e.byte(0xC1); e.u32(0xFF);             // imul eax, ecx, 0xFF
+                e.storeGuest(d.rd, EAX);
+                break;
+
+            case Op::LUI:   e.movImm(EAX, imm); e.storeGuest(d.rd, EAX); break;
+            case Op::AUIPC: e.movImm(EAX, pc + imm); e.storeGuest(d.rd, EAX); break;
+
+            case Op::LB: case Op::LH: case Op::LW: case Op::LBU: case Op::LHU:
+                e.loadGuest(ESI, d.rs1); e.aluImm(0, ESI, imm);
+                e.movImm(EDX, d.rd); e.movImm(ECX, (uint32_t)d.op);
+                e.callHelper((const void*)&JIT::loadHelper);
+                exits.push_back({e.jcc(CC_NE), exitState(pc, i + 1, true), false, 0});
+                break;
+
+            case Op::SB: case Op::SH: case Op::SW:
+                e.loadGuest(ESI, d.rs1); e.aluImm(0, ESI, imm);
+                e.loadGuest(EDX, d.rs2); e.movImm(ECX, (uint32_t)d.op);
+                e.callHelper((const void*)&JIT::storeHelper);
+                exits.push_back({e.jcc(CC_NE), exitState(pc, i + 1, true), true, exitState(pc + d.len, i + 1)});
+                break;
+
+            case Op::BEQ: case Op::BNE: case Op::BLT: case Op::BGE: case Op::BLTU: case Op::BGEU:
+            {
+                uint8_t cc = d.op == Op::BEQ ? CC_E : d.op == Op::BNE ? CC_NE : d.op == Op::BLT ? CC_L :
+                             d.op == Op::BGE ? CC_GE : d.op == Op::BLTU ? CC_B : CC_AE;
+                e.loadGuest(EAX, d.rs1); e.loadGuest(ECX, d.rs2); e.aluReg(0x39, EAX, ECX);
+                size_t taken = e.jcc(cc);
+                e.exit(exitState(pc + d.len, i + 1));
+                e.patch(taken);
+                e.exit(exitState(pc + imm, i + 1, false, true));
+                terminated = true;
+                break;
+            }
+
+            case Op::JAL:
+                e.movImm(EAX, pc + d.len); e.storeGuest(d.rd, EAX);
+                e.exit(exitState(pc + imm, i + 1));
+                terminated = true;
+                break;
+
+            default:
+                // JALR, ECALL, malformed encodings: leave to the interpreter
+                handled = false;
+                break;
+        }
+        if (!handled) break;
+    }
+
+    if (i == 0) return nullptr;
+    if (!terminated) e.exit(exitState(pc, i));
+
+    // Out-of-line exits for memory helpers
+    for (const PendingExit& x : exits) {
+        e.patch(x.at);
+        if (x.store) {
+            e.byte(0x83); e.byte(0xF8); e.byte(0x02);   // cmp eax, 2
+            size_t modified = e.jcc(CC_E);
+            e.exit(x.state);
+            e.patch(modified);
+            e.exit(x.store_state);
+        } else {
+            e.exit(x.state);
+        }
+    }
+
+    if (e.code.size() > MAX_BLOCK_BYTES || used + e.code.size() > capacity) return nullptr;
+    uint8_t* entry = buffer + used;
+    // Only this hart runs code from the buffer, and none runs while compiling
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uint8_t* first = (uint8_t*)((uintptr_t)entry & ~(page - 1));
+    size_t span = ((uintptr_t)entry + e.code.size() + page - 1 - (uintptr_t)first) & ~(page - 1);
+    if (mprotect(first, span, PROT_READ | PROT_WRITE) != 0) return nullptr;
+    memcpy(entry, e.code.data(), e.code.size());
+    if (mprotect(first, span, PROT_READ | PROT_EXEC) != 0) {
+        used = capacity;    // Earlier blocks on these pages cannot run: report full so every translation is dropped
+        return nullptr;
+    }
+    used += (e.code.size() + 15) & ~(size_t)15;
+    compiled_ops = i;
+    return (JitFn)entry;
+}
+
+#else
+
+JIT::JIT() {}
+JIT::~JIT() {}
+
+JitFn JIT::compile(const vector<DecodedInst>&, uint32_t, size_t& compiled_ops) {
+    compiled_ops = 0;
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Decoder.h"
+
+using namespace std;
+
+#if defined(__x86_64__) && defined(__linux__)
+#define RISCV_JIT_AVAILABLE 1
+#else
+#define RISCV_JIT_AVAILABLE 0
+#endif
+
+class CPU;
+
+// Translated block entry point. Works directly on the CPU's regs[32] and
+// returns the exit state packed as:
+//   bits  0-31 : next PC
+//   bits 32-61 : number of ops retired from the block
+//   bit     62 : the block ended in a taken conditional branch
+//   bit     63 : memory fault (PC is the faulting instruction)
+typedef uint64_t (*JitFn)(uint32_t* regs, CPU* cpu);
+
+// x86-64 Dynamic Binary Translator for RV32I basic blocks.
+// ALU ops (RV32M and Zba/Zbb included), LUI/AUIPC, conditional branches and
+// JAL become native code;
+// loads and stores call back into the CPU so bounds checks and decode-cache
+// invalidation stay in one place. JALR, ECALL, floating point, vector ops,
+// CSR accesses and anything unusual end the translated prefix and are handed
+// back to the interpreter.
+class JIT {
+public:
+    JIT();
+    ~JIT();
+
+    bool available() const { return buffer != nullptr; }
+
+    // Translate a decoded block starting at start_pc. On success returns the
+    // entry point and sets compiled_ops to the length of the translated
+    // prefix. Returns nullptr if nothing could be translated or the code
+    // buffer is full (drop every translation, call reset() and retry).
+    JitFn compile(const vector<DecodedInst>& ops, uint32_t start_pc, size_t& compiled_ops);
+
+    // Drop all translations
+    void reset() { used = 0; }
+
+    bool full() const { return used + MAX_BLOCK_BYTES > capacity; }
+
+    // Memory callbacks used by translated code (0 = ok, 1 = fault, 2 = code modified)
+    static int loadHelper(CPU* cpu, uint32_t addr, uint32_t rd, uint32_t op);
+    static int storeHelper(CPU* cpu, uint32_t addr, uint32_t val, uint32_t op);
+
+private:
+    static const size_t CODE_BUFFER_SIZE = 16 * 1024 * 1024;
+    static const size_t MAX_BLOCK_BYTES = 64 * 1024;
+
+    uint8_t* buffer = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+
+    // Host bit-counting instructions (CPUID); clz/ctz/cpop are left to the
+    // interpreter on hosts without them
+    bool has_lzcnt = false;
+    bool has_tzcnt = false;
+    bool has_popcnt = false;
+};
+
+#endif
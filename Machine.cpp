@@ -0,0 +1,162 @@
+#include "Machine.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+namespace {
+
+// Quantum barrier. A hart that stops for good drops out, so the rest never
+// wait for it.
+class QuantumBarrier {
+public:
+    explicit QuantumBarrier(size_t count) : participants(count) {}
+
+    void arriveAndWait() {
+        unique_lock<mutex> guard(lock);
+        uint64_t phase = generation;
+        if (++waiting == participants) {
+            release();
+            return;
+        }
+        wake.wait(guard, [&] { return generation != phase; });
+    }
+
+    void arriveAndDrop() {
+        lock_guard<mutex> guard(lock);
+        participants--;
+        if (waiting > 0 && waiting == participants) release();
+    }
+
+private:
+    void release() {
+        waiting = 0;
+        generation++;
+        wake.notify_all();
+    }
+
+    mutex lock;
+    condition_variable wake;
+    size_t participants;
+    size_t waiting = 0;
+    uint64_t generation = 0;
+};
+
+}
+
+Machine::Machine(unsigned hart_count) : memory(make_shared<SparseMemory>(4 * 1024 * 1024)) {
+    for (unsigned i = 0; i < std::max(1u, hart_count); i++) {
+        harts.emplace_back(new CPU(memory, i));
+        harts.back()->setQuiet(true);  // Console traces of concurrent harts would interleave
+        harts.back()->setOutputCapture(true);
+    }
+}
+
+void Machine::setMemorySize(uint64_t bytes) {
+    harts[0]->setMemorySize(bytes);
+    for (size_t i = 1; i < harts.size(); i++) harts[i]->memoryChanged();
+}
+
+bool Machine::setMemoryBackend(MemoryBackend backend) {
+    if (!harts[0]->setMemoryBackend(backend)) return false;
+    for (size_t i = 1; i < harts.size(); i++) harts[i]->memoryChanged();
+    return true;
+}
+
+bool Machine::setEngine(Engine e) {
+    for (auto& cpu : harts) {
+        if (!cpu->setEngine(e)) return false;
+    }
+    return true;
+}
+
+void Machine::setMisalignedAccess(MisalignedAccess mode) {
+    for (auto& cpu : harts) cpu->setMisalignedAccess(mode);
+}
+
+void Machine::setTimingModel(const TimingModel& model) {
+    for (auto& cpu : harts) cpu->setTimingModel(model);
+}
+
+bool Machine::loadELF(const string& filename) {
+    if (!harts[0]->loadELF(filename)) return false;
+    for (size_t i = 1; i < harts.size(); i++) harts[i]->memoryChanged();
+    startHarts(harts[0]->getPC());
+    return true;
+}
+
+void Machine::loadRaw(const vector<uint32_t>& code) {
+    harts[0]->loadRaw(code);
+    for (size_t i = 1; i < harts.size(); i++) harts[i]->memoryChanged();
+    startHarts(0);
+}
+
+void Machine::startHarts(uint32_t entry) {
+    uint64_t top = memory->size();
+    for (auto& cpu : harts) {
+        uint32_t id = cpu->getHartId();
+        for (int r = 1; r < 32; r++) cpu->setReg(r, 0);
+        cpu->setReg(2, (uint32_t)(top - (uint64_t)id * stack_size)); // 4 GiB: hart 0 wraps to 0 like a single CPU
+        cpu->setReg(10, id);
+        cpu->setPC(entry);
+        cpu->takeOutput();
+    }
+}
+
+StopReason Machine::run(uint64_t budget) {
+    QuantumBarrier barrier(harts.size());
+    atomic<bool> ending(false);
+    mutex result_lock;
+    uint64_t end_phase = UINT64_MAX;
+    StopReason end_reason = StopReason::None;
+    vector<StopReason> reasons(harts.size(), StopReason::Budget);
+
+    auto runHart = [&](unsigned id) {
+        CPU& cpu = *harts[id];
+        uint64_t start = cpu.getInstructionCount();
+        for (uint64_t phase = 0;; phase++) {
+            uint64_t done = cpu.getInstructionCount() - start;
+            StopReason reason = done < budget ? cpu.run(std::min(quantum, budget - done)) : StopReason::Budget;
+            bool finished = reason != StopReason::Budget || cpu.getInstructionCount() - start >= budget;
+            reasons[id] = reason;
+            if (reason != StopReason::Budget && reason != StopReason::Halt) {
+                // The earliest quantum wins, then the lowest hart id, whatever the host timing
+                lock_guard<mutex> guard(result_lock);
+                if (phase < end_phase || (phase == end_phase && id < stop_hart)) {
+                    end_phase = phase;
+                    end_reason = reason;
+                    stop_hart = id;
+                }
+                ending = true;
+            }
+            if (finished) {
+                barrier.arriveAndDrop();
+                return;
+            }
+            barrier.arriveAndWait();
+            if (ending.load(memory_order_relaxed)) return; // Set before the barrier: seen by every hart alike
+        }
+    };
+
+    stop_hart = 0;
+    vector<thread> threads;
+    for (unsigned id = 1; id < harts.size(); id++) threads.emplace_back(runHart, id);
+    runHart(0);
+    for (thread& t : threads) t.join();
+
+    if (end_reason != StopReason::None) return end_reason;
+    if (all_of(reasons.begin(), reasons.end(), [](StopReason r) { return r == StopReason::Halt; })) return StopReason::Halt;
+    return StopReason::Budget;
+}
+
+uint64_t Machine::getInstructionCount() const {
+    uint64_t total = 0;
+    for (const auto& cpu : harts) total += cpu->getInstructionCount();
+    return total;
+}
+
+string Machine::takeOutput() {
+    string out;
+    for (auto& cpu : harts) out += cpu->takeOutput();
+    return out;
+}
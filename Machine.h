@@ -0,0 +1,66 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "CPU.h"
+
+using namespace std;
+
+// Symmetric multiprocessing: N harts (one CPU each, with private TLBs,
+// decode and block caches and JIT) over one shared guest memory, each hart
+// on its own host thread. Harts run in quanta of a fixed instruction count
+// and meet at a barrier between quanta, so no hart gets more than one
+// quantum ahead of another; memory accesses themselves take no lock.
+//
+// Every hart starts at the entry point with a0 = its hart id (the boot
+// convention mhartid-aware code expects) and its own stack: hart i's sp is
+// the top of memory minus i stack sizes. An exit syscall, fault or illegal
+// instruction on any hart ends the program, and the other harts stop at the
+// end of their quantum. A null instruction parks only the hart that hits it.
+class Machine {
+public:
+    static const uint64_t DEFAULT_QUANTUM = 100000;
+    static const uint32_t DEFAULT_STACK_SIZE = 64 * 1024;
+
+    explicit Machine(unsigned hart_count);
+
+    unsigned hartCount() const { return (unsigned)harts.size(); }
+    CPU& hart(unsigned id) { return *harts[id]; }
+    const CPU& hart(unsigned id) const { return *harts[id]; }
+
+    // Configuration, applied to every hart (before loading a program)
+    void setMemorySize(uint64_t bytes);
+    bool setMemoryBackend(MemoryBackend backend);
+    bool setEngine(Engine e);
+    void setMisalignedAccess(MisalignedAccess mode);
+    void setTimingModel(const TimingModel& model);
+    void setQuantum(uint64_t instructions) { quantum = instructions ? instructions : 1; }
+    void setStackSize(uint32_t bytes) { stack_size = bytes; }
+
+    bool loadELF(const string& filename);
+    void loadRaw(const vector<uint32_t>& code);
+
+    // Runs every hart for up to `budget` instructions each. Returns why the
+    // program stopped: the reason of the hart that ended it, Halt once every
+    // hart is parked, else Budget.
+    StopReason run(uint64_t budget = CPU::RUN_UNLIMITED);
+    unsigned getStopHart() const { return stop_hart; }     // Hart that ended the program
+    uint64_t getInstructionCount() const;                  // All harts
+
+    // Harts are quiet; what their print syscalls produced, hart by hart
+    string takeOutput();
+
+private:
+    shared_ptr<SparseMemory> memory;
+    vector<unique_ptr<CPU>> harts;
+    uint64_t quantum = DEFAULT_QUANTUM;
+    uint32_t stack_size = DEFAULT_STACK_SIZE;
+    unsigned stop_hart = 0;
+
+    void startHarts(uint32_t entry);
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include "Memory.h"
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RISCV_MMAP_FILES_AVAILABLE 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define RISCV_MMAP_FILES_AVAILABLE 0
+#endif
+
+#if RISCV_RESERVED_MEMORY_AVAILABLE
+#include <csignal>
+#endif
+
+MappedFile::~MappedFile() {
+#if RISCV_MMAP_FILES_AVAILABLE
+    if (fd >= 0) {
+        munmap(bytes, length);
+        close(fd);
+    }
+#endif
+}
+
+bool MappedFile::open(const string& path) {
+#if RISCV_MMAP_FILES_AVAILABLE
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return false;
+    struct stat st;
+    if (fstat(file, &st) == 0 && st.st_size > 0) {
+        // Writable but private: guest stores through aliased pages never reach the file
+        void* mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+        if (mem != MAP_FAILED) {
+            bytes = (uint8_t*)mem;
+            length = st.st_size;
+            fd = file;
+            return true;
+        }
+    }
+    close(file);
+#endif
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    bytes = buffer.data();
+    length = buffer.size();
+    return length > 0;
+}
+
+SparseMemory::SparseMemory(uint64_t bytes) {
+    resize(bytes);
+}
+
+SparseMemory::~SparseMemory() {
+    useReservation(false);
+    clear();
+}
+
+void SparseMemory::resize(uint64_t bytes) {
+    clear(); // Before the protection changes: file views are replaced by anonymous memory
+    bytes = (bytes + PAGE_MASK) & ~(uint64_t)PAGE_MASK;
+    limit = std::min(bytes, MAX_SIZE);
+#if RISCV_RESERVED_MEMORY_AVAILABLE
+    if (host_base) {
+        // Open [0, limit), keep the rest of the reservation as guard
+        if (limit > 0) mprotect(host_base, limit, PROT_READ | PROT_WRITE);
+        mprotect(host_base + limit, RESERVATION_SIZE - limit, PROT_NONE);
+    }
+#endif
+}
+
+bool SparseMemory::useReservation(bool enable) {
+#if RISCV_RESERVED_MEMORY_AVAILABLE
+    if (enable == (host_base != nullptr)) return true;
+    if (!enable) {
+        munmap(host_base, RESERVATION_SIZE);
+        host_base = nullptr;
+        clear();
+        return true;
+    }
+    if (sysconf(_SC_PAGESIZE) != PAGE_SIZE) return false;
+    void* mem = mmap(nullptr, RESERVATION_SIZE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) return false;
+    clear(); // Drop the page table
+    host_base = (uint8_t*)mem;
+    resize(limit);
+    return true;
+#else
+    return !enable;
+#endif
+}
+
+uint8_t* SparseMemory::page(uint32_t addr) {
+    if (host_base) return host_base + (addr & ~PAGE_MASK);
+    Table* t = table(addr);
+    size_t i = (addr >> PAGE_BITS) & 0x3FF;
+    uint8_t* p = t->pages[i].load(memory_order_acquire);
+    return p ? p : allocatePage(t, i);
+}
+
+// Another hart may install the same table or page first: the loser of the
+// compare-and-swap frees its copy and uses the winner's
+SparseMemory::Table* SparseMemory::table(uint32_t addr) {
+    atomic<Table*>& slot = root[addr >> 22];
+    Table* t = slot.load(memory_order_acquire);
+    if (t) return t;
+    Table* fresh = new Table();
+    if (slot.compare_exchange_strong(t, fresh, memory_order_acq_rel)) return fresh;
+    delete fresh;
+    return t;
+}
+
+uint8_t* SparseMemory::allocatePage(Table* t, size_t index) {
+    unique_ptr<Page> fresh(new Page()); // Value-initialised: zero-filled
+    uint8_t* p = nullptr;
+    if (!t->pages[index].compare_exchange_strong(p, fresh->bytes, memory_order_acq_rel)) return p;
+    pages_used++;
+    t->owned[index] = std::move(fresh);
+    return t->pages[index].load(memory_order_relaxed);
+}
+
+bool SparseMemory::read(uint32_t addr, void* dst, size_t len) {
+    if ((uint64_t)addr + len > limit) return false;
+    uint8_t* out = (uint8_t*)dst;
+    while (len > 0) {
+        size_t chunk = std::min<size_t>(len, PAGE_SIZE - (addr & PAGE_MASK));
+        memcpy(out, page(addr) + (addr & PAGE_MASK), chunk);
+        addr += chunk;
+        out += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool SparseMemory::write(uint32_t addr, const void* src, size_t len) {
+    if ((uint64_t)addr + len > limit) return false;
+    const uint8_t* in = (const uint8_t*)src;
+    while (len > 0) {
+        size_t chunk = std::min<size_t>(len, PAGE_SIZE - (addr & PAGE_MASK));
+        memcpy(page(addr) + (addr & PAGE_MASK), in, chunk);
+        addr += chunk;
+        in += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool SparseMemory::mapFile(uint32_t addr, const shared_ptr<MappedFile>& file, uint64_t offset, uint32_t len) {
+    if ((uint64_t)addr + len > limit || offset + len > file->size()) return false;
+    const uint8_t* src = file->data() + offset;
+
+    // Only whole pages can be aliased, and only if the file offset is
+    // congruent to the guest address (as ELF segment alignment guarantees)
+    uint32_t head = std::min<uint32_t>(len, (PAGE_SIZE - (addr & PAGE_MASK)) & PAGE_MASK);
+    uint32_t whole = ((len - head) & ~PAGE_MASK);
+    if (!file->mapped() || ((addr ^ offset) & PAGE_MASK)) {
+        head = len;
+        whole = 0;
+    }
+    uint32_t tail = len - head - whole;
+    write(addr, src, head);
+    write(addr + head + whole, src + head + whole, tail);
+    if (whole == 0) return true;
+
+    uint32_t start = addr + head;
+#if RISCV_RESERVED_MEMORY_AVAILABLE
+    if (host_base) {
+        // One MAP_FIXED view over the run; clear() puts anonymous memory back
+        void* view = mmap(host_base + start, whole, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, file->fd, offset + head);
+        if (view == MAP_FAILED) return write(start, src + head, whole);
+        file_ranges.push_back({start, whole});
+        return true;
+    }
+#endif
+    bool aliased = false;
+    for (uint32_t done = 0; done < whole; done += PAGE_SIZE) {
+        uint32_t a = start + done;
+        atomic<uint8_t*>& p = table(a)->pages[(a >> PAGE_BITS) & 0x3FF];
+        if (uint8_t* in_use = p.load(memory_order_relaxed)) {
+            memcpy(in_use, src + head + done, PAGE_SIZE); // Already in use (shared with another segment)
+        } else {
+            p.store(file->bytes + offset + head + done, memory_order_release);
+            pages_used++;
+            aliased = true;
+        }
+    }
+    if (aliased) files.push_back(file);
+    return true;
+}
+
+void SparseMemory::clear() {
+#if RISCV_RESERVED_MEMORY_AVAILABLE
+    if (host_base) {
+        for (const auto& range : file_ranges) {
+            mmap(host_base + range.first, range.second, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+        }
+        // The kernel only has to walk the pages that were actually touched
+        if (limit > 0) madvise(host_base, limit, MADV_DONTNEED);
+    }
+#endif
+    file_ranges.clear();
+    for (auto& t : root) delete t.exchange(nullptr);
+    files.clear();
+    pages_used = 0;
+}
+
+size_t SparseMemory::pageCount() const {
+#if RISCV_RESERVED_MEMORY_AVAILABLE
+    if (host_base) {
+        // Diagnostic only: ask the kernel which pages are resident
+        vector<unsigned char> resident(limit >> PAGE_BITS);
+        if (resident.empty() || mincore(host_base, limit, resident.data()) != 0) return 0;
+        return std::count_if(resident.begin(), resident.end(), [](unsigned char r) { return r & 1; });
+    }
+#endif
+    return pages_used;
+}
+
+#if RISCV_RESERVED_MEMORY_AVAILABLE
+
+static thread_local HostFaultGuard* active_guard = nullptr;
+static struct sigaction previous_segv;
+
+static void onHostFault(int sig, siginfo_t* info, void* context) {
+    const uint8_t* addr = (const uint8_t*)info->si_addr;
+    for (HostFaultGuard* guard = active_guard; guard; guard = guard->outer) {
+        if (addr >= guard->lo && addr < guard->hi) siglongjmp(guard->env, 1);
+    }
+
+    // Not a guest access: let the previous disposition handle it
+    if (previous_segv.sa_flags & SA_SIGINFO) {
+        previous_segv.sa_sigaction(sig, info, context);
+    } else if (previous_segv.sa_handler != SIG_DFL && previous_segv.sa_handler != SIG_IGN) {
+        previous_segv.sa_handler(sig);
+    } else {
+        signal(sig, SIG_DFL); // Returning re-executes the access and crashes normally
+    }
+}
+
+HostFaultGuard::HostFaultGuard(const SparseMemory& mem)
+    : lo(mem.base()), hi(mem.base() + SparseMemory::RESERVATION_SIZE), outer(active_guard) {
+    static bool installed = [] {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = onHostFault;
+        // SA_NODEFER: we leave the handler with siglongjmp and no saved mask
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        return sigaction(SIGSEGV, &action, &previous_segv) == 0;
+    }();
+    (void)installed;
+    active_guard = this;
+}
+
+HostFaultGuard::~HostFaultGuard() {
+    active_guard = outer;
+}
+
+#else
+
+HostFaultGuard::HostFaultGuard(const SparseMemory& mem) : lo(mem.base()), hi(mem.base()), outer(nullptr) {}
+HostFaultGuard::~HostFaultGuard() {}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <csetjmp>
+#include <cstring>
+#include <atomic>
+
+using namespace std;
+
+// A 4 GiB host reservation needs a 64-bit address space, and guard pages need
+// host pages no larger than guest pages
+#if defined(__linux__) && UINTPTR_MAX > 0xFFFFFFFFu
+#define RISCV_RESERVED_MEMORY_AVAILABLE 1
+#else
+#define RISCV_RESERVED_MEMORY_AVAILABLE 0
+#endif
+
+// Guest memory is little-endian; on a little-endian host a guest value is
+// just the host value at the same bytes
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define RISCV_HOST_LITTLE_ENDIAN 1
+#else
+#define RISCV_HOST_LITTLE_ENDIAN 0
+#endif
+
+// A whole file as a private, writable view. On POSIX hosts it is mmapped
+// MAP_PRIVATE (copy-on-write), so guest pages can alias it and only pages
+// that get written are ever copied; elsewhere it is read into a heap buffer.
+// Writes never reach the file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const string& path);
+    uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool mapped() const { return fd >= 0; }
+
+private:
+    friend class SparseMemory;
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+    int fd = -1;                // Kept open while mapped, for MAP_FIXED views
+    vector<uint8_t> buffer;     // Fallback copy
+};
+
+// Sparse guest memory covering the full 32-bit address space. 4 KiB pages are
+// allocated (zero-filled) on first touch through a two-level table, so setting
+// up or clearing a memory costs time proportional to the pages a program
+// actually used, not to its configured size. Harts sharing one memory may
+// touch new pages concurrently: tables and pages are installed with a
+// compare-and-swap, so page() needs no lock. Everything else that changes
+// the layout (resize, mapFile, clear, useReservation) is for one thread only.
+//
+// Alternatively the whole guest space can live in one host reservation
+// (useReservation): guest address A is host address base() + A, [0, size())
+// is mapped read/write with the kernel supplying zero pages on first touch,
+// and everything above it (plus a guard page past 4 GiB for accesses that
+// straddle the top) is PROT_NONE. Cores can then access memory without any
+// bounds check and let HostFaultGuard turn the SIGSEGV into a guest fault.
+class SparseMemory {
+public:
+    static const uint32_t PAGE_BITS = 12;
+    static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+    static const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+    static const uint64_t MAX_SIZE = 1ull << 32;
+
+    explicit SparseMemory(uint64_t bytes);
+    ~SparseMemory();
+
+    // Addressable range is [0, size()); anything beyond faults
+    uint64_t size() const { return limit; }
+    void resize(uint64_t bytes);    // Rounded up to whole pages, at most 4 GiB
+    bool contains(uint32_t addr, uint32_t len) const { return (uint64_t)addr + len <= limit; }
+
+    // Host pointer to the page holding addr, allocated on first use (addr must be in range)
+    uint8_t* page(uint32_t addr);
+
+    // Bulk copies for loaders; false if the range is out of bounds
+    bool read(uint32_t addr, void* dst, size_t len);
+    bool write(uint32_t addr, const void* src, size_t len);
+
+    // Place file bytes [offset, offset + len) at addr. Whole pages whose file
+    // offset is congruent to their address are aliased copy-on-write instead of
+    // copied (the memory keeps the file alive until clear()); partial pages and
+    // pages already in use are copied. False if out of bounds.
+    bool mapFile(uint32_t addr, const shared_ptr<MappedFile>& file, uint64_t offset, uint32_t len);
+
+    // Typed little-endian access to host bytes (no bounds check, any alignment).
+    // memcpy compiles to a single host load/store; big-endian hosts assemble bytes.
+    template <class T> static T read(const uint8_t* p) {
+#if RISCV_HOST_LITTLE_ENDIAN
+        T value;
+        memcpy(&value, p, sizeof(T));
+        return value;
+#else
+        uint64_t v = 0;
+        for (size_t i = 0; i < sizeof(T); i++) v |= (uint64_t)p[i] << (8 * i);
+        return (T)v;
+#endif
+    }
+    template <class T> static void write(uint8_t* p, T value) {
+#if RISCV_HOST_LITTLE_ENDIAN
+        memcpy(p, &value, sizeof(T));
+#else
+        for (size_t i = 0; i < sizeof(T); i++) p[i] = (uint8_t)((uint64_t)value >> (8 * i));
+#endif
+    }
+
+    // Atomic access to an aligned guest word (no bounds check), sequentially
+    // consistent, for harts sharing memory. Read-modify-writes return the old
+    // value; those x86 and ARM have native instructions for map onto them.
+    enum class Rmw { Swap, Add, Xor, And, Or, Min, Max, MinU, MaxU };
+    static uint32_t atomicLoad(const uint8_t* p) {
+        return fromHostWord(__atomic_load_n((const uint32_t*)p, __ATOMIC_SEQ_CST));
+    }
+    static bool compareExchange(uint8_t* p, uint32_t expected, uint32_t desired) {
+        uint32_t raw = toHostWord(expected);
+        return __atomic_compare_exchange_n((uint32_t*)p, &raw, toHostWord(desired), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    template <Rmw op> static uint32_t atomicRmw(uint8_t* p, uint32_t operand) {
+        uint32_t* word = (uint32_t*)p;
+#if RISCV_HOST_LITTLE_ENDIAN
+        if constexpr (op == Rmw::Swap) return __atomic_exchange_n(word, operand, __ATOMIC_SEQ_CST);
+        if constexpr (op == Rmw::Add) return __atomic_fetch_add(word, operand, __ATOMIC_SEQ_CST);
+        if constexpr (op == Rmw::Xor) return __atomic_fetch_xor(word, operand, __ATOMIC_SEQ_CST);
+        if constexpr (op == Rmw::And) return __atomic_fetch_and(word, operand, __ATOMIC_SEQ_CST);
+        if constexpr (op == Rmw::Or) return __atomic_fetch_or(word, operand, __ATOMIC_SEQ_CST);
+#endif
+        // Compare-and-swap loop (min/max, and everything on big-endian hosts)
+        uint32_t raw = __atomic_load_n(word, __ATOMIC_RELAXED);
+        while (true) {
+            uint32_t old = fromHostWord(raw);
+            uint32_t next = rmwResult<op>(old, operand);
+            if (__atomic_compare_exchange_n(word, &raw, toHostWord(next), true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return old;
+        }
+    }
+
+    // Release every page, so all memory reads as zero again
+    void clear();
+
+    size_t pageCount() const;
+
+    // Switch between the page table and a host reservation (clears memory).
+    // Returns false if the reservation is unavailable or cannot be mapped.
+    bool useReservation(bool enable);
+    uint8_t* base() const { return host_base; }
+    static const uint64_t RESERVATION_SIZE = MAX_SIZE + PAGE_SIZE;
+
+private:
+    uint8_t* host_base = nullptr;   // Reservation, if in use
+
+    static uint32_t fromHostWord(uint32_t raw) {
+#if RISCV_HOST_LITTLE_ENDIAN
+        return raw;
+#else
+        return __builtin_bswap32(raw);
+#endif
+    }
+    static uint32_t toHostWord(uint32_t value) { return fromHostWord(value); }
+    template <Rmw op> static uint32_t rmwResult(uint32_t old, uint32_t operand) {
+        switch (op) {
+            case Rmw::Swap: return operand;
+            case Rmw::Add: return old + operand;
+            case Rmw::Xor: return old ^ operand;
+            case Rmw::And: return old & operand;
+            case Rmw::Or: return old | operand;
+            case Rmw::Min: return (int32_t)old < (int32_t)operand ? old : operand;
+            case Rmw::Max: return (int32_t)old > (int32_t)operand ? old : operand;
+            case Rmw::MinU: return old < operand ? old : operand;
+            case Rmw::MaxU: return old > operand ? old : operand;
+        }
+        return old;
+    }
+
+    struct Page {
+        uint8_t bytes[PAGE_SIZE];
+    };
+    struct Table {
+        atomic<uint8_t*> pages[1024] = {};  // Owned page or a view into a mapped file
+        unique_ptr<Page> owned[1024];       // Written only by the thread that installed the page
+    };
+    atomic<Table*> root[1024] = {};     // Indexed by addr[31:22], then addr[21:12]
+    uint64_t limit = 0;
+    atomic<size_t> pages_used{0};
+    Table* table(uint32_t addr);
+    uint8_t* allocatePage(Table* table, size_t index);
+
+    vector<shared_ptr<MappedFile>> files;               // Aliased by the page table
+    vector<pair<uint32_t, uint32_t>> file_ranges;       // Reservation: [addr, len) mapped from files
+};
+
+// While alive, a SIGSEGV inside mem's reservation on this thread jumps back
+// to `env` (set with sigsetjmp(env, 0)) instead of killing the process.
+// Faults anywhere else go to the previously installed handler.
+struct HostFaultGuard {
+    explicit HostFaultGuard(const SparseMemory& mem);
+    ~HostFaultGuard();
+
+    sigjmp_buf env;
+    const uint8_t* lo;
+    const uint8_t* hi;
+    HostFaultGuard* outer;
+};
+
+#endif
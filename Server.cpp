@@ -0,0 +1,183 @@
+#include "Server.h"
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#if RISCV_SERVER_AVAILABLE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+
+static bool readAll(int fd, void* data, size_t len) {
+    uint8_t* p = (uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads and discards len bytes
+static bool skipAll(int fd, uint64_t len) {
+    uint8_t scratch[65536];
+    while (len > 0) {
+        size_t chunk = (size_t)min<uint64_t>(len, sizeof(scratch));
+        if (!readAll(fd, scratch, chunk)) return false;
+        len -= chunk;
+    }
+    return true;
+}
+
+// Sockets are written with MSG_NOSIGNAL, so a client that has hung up is
+// an EPIPE on its own connection instead of a SIGPIPE for the whole server
+static ssize_t writeSome(int fd, const void* data, size_t len) {
+#ifdef MSG_NOSIGNAL
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n >= 0 || errno != ENOTSOCK) return n;
+#endif
+    return write(fd, data, len);
+}
+
+static bool writeAll(int fd, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = writeSome(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static const size_t RESPONSE_HEADER = 20;
+
+bool serveConnection(CPU& cpu, const shared_ptr<Snapshot>& start, const ServerOptions& options, int in_fd, int out_fd) {
+    cpu.setOutputCapture(true);
+    vector<uint8_t> input;
+    uint8_t length[4];
+    // A clean EOF between requests ends the connection
+    while (readAll(in_fd, length, 4)) {
+        uint32_t input_len = SparseMemory::read<uint32_t>(length);
+        // Checked before anything is allocated: an input that cannot fit is
+        // read and dropped, which keeps the stream in step
+        uint64_t memory_size = cpu.getMemorySize();
+        bool fits = input_len <= (options.input_addr < memory_size ? memory_size - options.input_addr : 0);
+        if (fits) {
+            input.resize(input_len);
+            if (!readAll(in_fd, input.data(), input_len)) return false;
+        } else if (!skipAll(in_fd, input_len)) {
+            return false;
+        }
+
+        ServerResponse response;
+        if (!fits || !cpu.restore(start) || !cpu.writeMemory(options.input_addr, input.data(), input_len)) {
+            response.stop_reason = StopReason::Fault; // Input does not fit in guest memory
+        } else {
+            cpu.setReg(10, options.input_addr);
+            cpu.setReg(11, input_len);
+            response.stop_reason = cpu.run(options.budget);
+            if (response.stop_reason == StopReason::Exit) response.exit_code = (int32_t)cpu.getReg(10);
+            response.instructions = cpu.getInstructionCount() - start->instruction_count;
+        }
+        response.output = cpu.takeOutput();
+
+        uint8_t header[RESPONSE_HEADER];
+        SparseMemory::write<uint32_t>(header, (uint32_t)response.stop_reason);
+        SparseMemory::write<uint32_t>(header + 4, (uint32_t)response.exit_code);
+        SparseMemory::write<uint32_t>(header + 8, (uint32_t)response.instructions);
+        SparseMemory::write<uint32_t>(header + 12, (uint32_t)(response.instructions >> 32));
+        SparseMemory::write<uint32_t>(header + 16, (uint32_t)response.output.size());
+        if (!writeAll(out_fd, header, sizeof(header)) ||
+            !writeAll(out_fd, response.output.data(), response.output.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool serveSocket(CPU& cpu, const shared_ptr<Snapshot>& start, const ServerOptions& options, const string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) return false;
+    unlink(path.c_str()); // Stale socket from an earlier server
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        close(listener);
+        return false;
+    }
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            // Only a broken listener ends the server. Aborted connections are
+            // skipped, and running out of descriptors or buffers is waited out.
+            if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK || errno == EOPNOTSUPP) break;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) usleep(10000);
+            continue;
+        }
+#ifdef SO_NOSIGPIPE
+        int one = 1;    // No MSG_NOSIGNAL on these hosts
+        setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        if (options.client_timeout_ms) {
+            // Clients are served one at a time, so a silent one would hold up
+            // the rest: its next read or write fails instead (EAGAIN)
+            timeval timeout = { (time_t)(options.client_timeout_ms / 1000), (suseconds_t)(options.client_timeout_ms % 1000 * 1000) };
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+        serveConnection(cpu, start, options, client, client); // A broken client only ends its own connection
+        close(client);
+    }
+    close(listener);
+    unlink(path.c_str());
+    return false;
+}
+
+bool requestRun(int fd, const string& input, ServerResponse& response) {
+    uint8_t length[4];
+    SparseMemory::write<uint32_t>(length, (uint32_t)input.size());
+    if (!writeAll(fd, length, 4) || !writeAll(fd, input.data(), input.size())) return false;
+
+    uint8_t header[RESPONSE_HEADER];
+    if (!readAll(fd, header, sizeof(header))) return false;
+    response.stop_reason = (StopReason)SparseMemory::read<uint32_t>(header);
+    response.exit_code = (int32_t)SparseMemory::read<uint32_t>(header + 4);
+    response.instructions = SparseMemory::read<uint32_t>(header + 8) |
+                            (uint64_t)SparseMemory::read<uint32_t>(header + 12) << 32;
+    response.output.resize(SparseMemory::read<uint32_t>(header + 16));
+    return readAll(fd, &response.output[0], response.output.size());
+}
+
+int connectServer(const string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) return -1;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#else
+
+bool serveConnection(CPU&, const shared_ptr<Snapshot>&, const ServerOptions&, int, int) { return false; }
+bool serveSocket(CPU&, const shared_ptr<Snapshot>&, const ServerOptions&, const string&) { return false; }
+bool requestRun(int, const string&, ServerResponse&) { return false; }
+int connectServer(const string&) { return -1; }
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include "CPU.h"
+
+using namespace std;
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RISCV_SERVER_AVAILABLE 1
+#else
+#define RISCV_SERVER_AVAILABLE 0
+#endif
+
+// Run server for many short runs of one program. The program is loaded,
+// decoded and run to a start point once; every request then restores that
+// snapshot (copying back only the pages the last run wrote), writes its input
+// into guest memory and runs. Decoded code and blocks stay warm throughout.
+//
+// Wire format, little-endian, any number of requests per connection:
+//   request  : u32 input length, input bytes
+//   response : u32 stop reason (StopReason value), i32 exit code (a0 at the
+//              exit syscall, -1 for any other stop), u64 instructions run,
+//              u32 output length, then the guest's print syscall output
+// An input too big for guest memory above input_addr is read and dropped,
+// and answered with a Fault stop.
+struct ServerOptions {
+    uint32_t input_addr = 0;    // Inputs land here; a0 = address, a1 = length
+    uint64_t budget = CPU::RUN_UNLIMITED;   // Per request
+    uint32_t client_timeout_ms = 30000;     // Socket clients that send or take nothing for this long are dropped (0: never)
+};
+
+struct ServerResponse {
+    StopReason stop_reason = StopReason::None;
+    int32_t exit_code = -1;
+    uint64_t instructions = 0;
+    string output;
+};
+
+// Serves one connection (a socket, or a pipe pair) until the client closes it.
+// False on a malformed request or I/O error.
+bool serveConnection(CPU& cpu, const shared_ptr<Snapshot>& start, const ServerOptions& options, int in_fd, int out_fd);
+
+// Listens on a UNIX socket and serves clients one after another. A client
+// that misbehaves, hangs up or stalls past client_timeout_ms only ends its
+// own connection; returns false once the listener itself fails.
+bool serveSocket(CPU& cpu, const shared_ptr<Snapshot>& start, const ServerOptions& options, const string& path);
+
+// Client side: sends one request on fd and reads the response
+bool requestRun(int fd, const string& input, ServerResponse& response);
+int connectServer(const string& path);     // -1 on failure
+
+#endif
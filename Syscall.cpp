@@ -0,0 +1,396 @@
+#include "CPU.h"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#if RISCV_LINUX_SYSCALLS_AVAILABLE
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#endif
+
+HostFile::~HostFile() {
+#if RISCV_LINUX_SYSCALLS_AVAILABLE
+    if (owned) close(fd);
+#endif
+}
+
+void LinuxProcess::reset(uint32_t image_end, uint64_t memory_size) {
+    files.clear();
+    for (int fd = 0; fd < 3; fd++) files.push_back(make_shared<HostFile>(fd, false));
+    brk_start = (uint32_t)(((uint64_t)image_end + SparseMemory::PAGE_MASK) & ~(uint64_t)SparseMemory::PAGE_MASK);
+    brk = brk_high = brk_start;
+    mmap_bottom = 0;
+    if (memory_size > 0) {
+        uint64_t top = (memory_size - min<uint64_t>(STACK_RESERVE, memory_size / 4)) & ~(uint64_t)SparseMemory::PAGE_MASK;
+        mmap_bottom = (uint32_t)max<uint64_t>(top, brk_start);
+    }
+}
+
+void OutputBuffer::write(const char* data, size_t len) {
+    if (used + len > CAPACITY) {
+        emit(data, len);
+        return;
+    }
+    if (!buffer) buffer.reset(new char[CAPACITY]);
+    memcpy(buffer.get() + used, data, len);
+    used += len;
+}
+
+void OutputBuffer::emit(const char* extra, size_t len) {
+    cout.flush();   // Simulator messages printed before this output stay before it
+#if RISCV_LINUX_SYSCALLS_AVAILABLE
+    iovec iov[2] = { {buffer.get(), used}, {(void*)extra, len} };
+    int first = 0;
+    while (first < 2) {
+        ssize_t written = writev(1, iov + first, 2 - first);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            break;  // Nowhere to report it; the output is dropped
+        }
+        // Skip what went out and retry the rest of a short write
+        for (; first < 2 && (size_t)written >= iov[first].iov_len; first++) written -= iov[first].iov_len;
+        if (first < 2) {
+            iov[first].iov_base = (char*)iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+#else
+    fwrite(buffer.get(), 1, used, stdout);
+    fwrite(extra, 1, len, stdout);
+    fflush(stdout);
+#endif
+    used = 0;
+}
+
+bool CPU::guestPath(uint32_t addr, string& path) {
+    // At most PATH_MAX bytes, NUL included
+    path.clear();
+    return guestString(addr, 4096, [&path](const char* host, uint32_t len) { path.append(host, len); });
+}
+
+void CPU::printString(uint32_t addr) {
+    // Stops at the end of memory if there is no NUL, like a byte-by-byte walk would
+    guestString(addr, UINT32_MAX, [this](const char* host, uint32_t len) { writeStdout(host, len); });
+}
+
+#if RISCV_LINUX_SYSCALLS_AVAILABLE
+
+// A transfer never hands the host more pieces than UIO_MAXIOV; past that it
+// comes up short, which read/write callers must handle anyway
+static const size_t MAX_PIECES = 1024;
+
+template <class Mem>
+bool CPU::guestBuffer(uint32_t addr, uint32_t len, bool is_store, vector<iovec>& iov) {
+    // Neighbouring pieces merge, so a reserved-backend buffer is one iovec
+    return guestRange<Mem>(addr, len, is_store, [&iov](uint8_t* host, uint32_t, uint32_t chunk) {
+        if (!iov.empty() && (uint8_t*)iov.back().iov_base + iov.back().iov_len == host) iov.back().iov_len += chunk;
+        else iov.push_back({host, chunk});
+    });
+}
+
+template <class Mem>
+bool CPU::guestCopy(uint32_t addr, void* data, uint32_t len, bool is_store) {
+    uint8_t* bytes = (uint8_t*)data;
+    return guestRange<Mem>(addr, len, is_store, [bytes, is_store](uint8_t* host, uint32_t done, uint32_t chunk) {
+        if (is_store) memcpy(host, bytes + done, chunk);
+        else memcpy(bytes + done, host, chunk);
+    });
+}
+
+// Guest timestamps and stat buffers, little-endian
+template <class T> static void put(uint8_t* buffer, size_t offset, T value) {
+    SparseMemory::write<T>(buffer + offset, value);
+}
+
+// struct stat64 (asm-generic): 104 bytes
+static void statLayout(const struct stat& st, uint8_t* out) {
+    memset(out, 0, 104);
+    put<uint64_t>(out, 0, st.st_dev);
+    put<uint64_t>(out, 8, st.st_ino);
+    put<uint32_t>(out, 16, st.st_mode);
+    put<uint32_t>(out, 20, (uint32_t)st.st_nlink);
+    put<uint32_t>(out, 24, st.st_uid);
+    put<uint32_t>(out, 28, st.st_gid);
+    put<uint64_t>(out, 32, st.st_rdev);
+    put<int64_t>(out, 48, st.st_size);
+    put<int32_t>(out, 56, (int32_t)st.st_blksize);
+    put<int64_t>(out, 64, st.st_blocks);
+    const struct timespec* times[3] = { &st.st_atim, &st.st_mtim, &st.st_ctim };
+    for (int i = 0; i < 3; i++) {
+        put<int32_t>(out, 72 + 8 * i, (int32_t)times[i]->tv_sec);
+        put<uint32_t>(out, 76 + 8 * i, (uint32_t)times[i]->tv_nsec);
+    }
+}
+
+// struct statx: 256 bytes, basic stats only
+static void statxLayout(const struct stat& st, uint8_t* out) {
+    memset(out, 0, 256);
+    put<uint32_t>(out, 0, 0x7FF);   // STATX_BASIC_STATS
+    put<uint32_t>(out, 4, (uint32_t)st.st_blksize);
+    put<uint32_t>(out, 16, (uint32_t)st.st_nlink);
+    put<uint32_t>(out, 20, st.st_uid);
+    put<uint32_t>(out, 24, st.st_gid);
+    put<uint16_t>(out, 28, (uint16_t)st.st_mode);
+    put<uint64_t>(out, 32, st.st_ino);
+    put<uint64_t>(out, 40, st.st_size);
+    put<uint64_t>(out, 48, st.st_blocks);
+    const struct timespec* times[3] = { &st.st_atim, &st.st_ctim, &st.st_mtim };   // At 64, 96, 112 (btime unset)
+    const size_t offsets[3] = { 64, 96, 112 };
+    for (int i = 0; i < 3; i++) {
+        put<int64_t>(out, offsets[i], times[i]->tv_sec);
+        put<uint32_t>(out, offsets[i] + 8, (uint32_t)times[i]->tv_nsec);
+    }
+    put<uint32_t>(out, 128, major(st.st_rdev));
+    put<uint32_t>(out, 132, minor(st.st_rdev));
+    put<uint32_t>(out, 136, major(st.st_dev));
+    put<uint32_t>(out, 140, minor(st.st_dev));
+}
+
+// Guest open flags (asm-generic values) to the host's
+static int hostOpenFlags(uint32_t flags) {
+    static const pair<uint32_t, int> map[] = {
+        {0100, O_CREAT}, {0200, O_EXCL}, {0400, O_NOCTTY}, {01000, O_TRUNC}, {02000, O_APPEND},
+        {04000, O_NONBLOCK}, {010000, O_DSYNC}, {0200000, O_DIRECTORY}, {0400000, O_NOFOLLOW},
+        {04000000, O_SYNC}
+    };
+    int host = (int)(flags & 3);    // O_RDONLY, O_WRONLY, O_RDWR
+    for (const auto& m : map) {
+        if (flags & m.first) host |= m.second;
+    }
+    return host | O_CLOEXEC;        // Never inherited by anything the simulator runs
+}
+
+static uint32_t hostResult(int64_t result) {
+    return result < 0 ? (uint32_t)-errno : (uint32_t)result;
+}
+
+template <class Mem>
+uint32_t CPU::linuxSyscall(uint32_t number) {
+    uint32_t a0 = regs[10], a1 = regs[11], a2 = regs[12], a3 = regs[13], a4 = regs[14], a5 = regs[15];
+    auto file = [this](uint32_t fd) -> HostFile* { return fd < process.files.size() ? process.files[fd].get() : nullptr; };
+    auto fail = [](int error) { return (uint32_t)-error; };
+
+    // Reads and writes run readv/writev on the guest pages themselves. Writes
+    // to the simulator's own stdout join the print syscalls' output buffer;
+    // for stdin and stderr that buffer and cout are flushed first so guest
+    // output lands in order. The console goes to the capture buffer when
+    // capturing.
+    auto transfer = [&](HostFile* f, const vector<pair<uint32_t, uint32_t>>& buffers, bool is_read) -> uint32_t {
+        if (!f) return fail(EBADF);
+        vector<iovec> iov;
+        for (const auto& b : buffers) {
+            size_t room = MAX_PIECES - 1 - min(iov.size(), MAX_PIECES - 1);
+            uint32_t len = (uint32_t)min<uint64_t>(b.second, (uint64_t)room * SparseMemory::PAGE_SIZE);
+            if (!guestBuffer<Mem>(b.first, len, is_read, iov)) return fail(EFAULT);
+            if (len < b.second) break;
+        }
+        bool console = !f->owned && f->fd <= 2;
+        if (console && capture_output) {
+            if (is_read) return 0;  // The guest's stdin is not the simulator's when capturing
+            size_t total = 0;
+            for (const iovec& v : iov) {
+                captured_output.append((const char*)v.iov_base, v.iov_len);
+                total += v.iov_len;
+            }
+            return (uint32_t)total;
+        }
+        if (console && f->fd == 1 && !is_read) {
+            size_t total = 0;
+            for (const iovec& v : iov) {
+                guest_stdout.write((const char*)v.iov_base, v.iov_len);
+                total += v.iov_len;
+            }
+            return (uint32_t)total;
+        }
+        if (console) {
+            guest_stdout.flush();
+            cout.flush();
+        }
+        return hostResult(is_read ? readv(f->fd, iov.data(), (int)iov.size()) : writev(f->fd, iov.data(), (int)iov.size()));
+    };
+
+    switch (number) {
+        case LINUX_READ:
+        case LINUX_WRITE:
+            return transfer(file(a0), { {a1, a2} }, number == LINUX_READ);
+        case LINUX_READV:
+        case LINUX_WRITEV: {
+            // a1: guest array of a2 { base, len } pairs
+            if (a2 > MAX_PIECES) return fail(EINVAL);
+            vector<uint8_t> raw(a2 * 8);
+            if (!guestCopy<Mem>(a1, raw.data(), a2 * 8, false)) return fail(EFAULT);
+            vector<pair<uint32_t, uint32_t>> buffers;
+            for (uint32_t i = 0; i < a2; i++) {
+                buffers.push_back({ SparseMemory::read<uint32_t>(&raw[8 * i]), SparseMemory::read<uint32_t>(&raw[8 * i + 4]) });
+            }
+            return transfer(file(a0), buffers, number == LINUX_READV);
+        }
+        case LINUX_OPENAT: {
+            string path;
+            if (!guestPath(a1, path)) return fail(EFAULT);
+            int dir = AT_FDCWD;
+            if ((int32_t)a0 != -100) {  // Guest AT_FDCWD
+                if (!file(a0)) return fail(EBADF);
+                dir = file(a0)->fd;
+            }
+            int fd = openat(dir, path.c_str(), hostOpenFlags(a2), (mode_t)a3);
+            if (fd < 0) return fail(errno);
+            // Lowest free guest descriptor, as on Linux
+            auto slot = find(process.files.begin(), process.files.end(), nullptr);
+            uint32_t guest_fd = (uint32_t)(slot - process.files.begin());
+            if (slot == process.files.end()) process.files.push_back(nullptr);
+            process.files[guest_fd] = make_shared<HostFile>(fd, true);
+            return guest_fd;
+        }
+        case LINUX_CLOSE:
+            // The host descriptor closes once no snapshot refers to it either
+            if (!file(a0)) return fail(EBADF);
+            process.files[a0].reset();
+            return 0;
+        case LINUX_LSEEK: {
+            HostFile* f = file(a0);
+            if (!f) return fail(EBADF);
+            // _llseek (musl): a1 offset high, a2 offset low, a3 result, a4 whence.
+            // Plain lseek (newlib): a1 offset, a2 whence, a3-a5 left at 0.
+            bool llseek = a3 != 0;
+            int64_t offset = llseek ? (int64_t)((uint64_t)a1 << 32 | a2) : (int64_t)(int32_t)a1;
+            uint32_t whence = llseek ? a4 : a2;
+            if (whence > 2) return fail(EINVAL);
+            off_t position = lseek(f->fd, offset, whence == 0 ? SEEK_SET : whence == 1 ? SEEK_CUR : SEEK_END);
+            if (position < 0) return fail(errno);
+            if (!llseek) return position > INT32_MAX ? fail(EOVERFLOW) : (uint32_t)position;
+            uint8_t out[8];
+            put<uint64_t>(out, 0, (uint64_t)position);
+            return guestCopy<Mem>(a3, out, 8, true) ? 0 : fail(EFAULT);
+        }
+        case LINUX_FSTAT: {
+            HostFile* f = file(a0);
+            if (!f) return fail(EBADF);
+            struct stat st;
+            if (fstat(f->fd, &st) < 0) return fail(errno);
+            uint8_t out[104];
+            statLayout(st, out);
+            return guestCopy<Mem>(a1, out, sizeof(out), true) ? 0 : fail(EFAULT);
+        }
+        case LINUX_STATX: {
+            // a0 dirfd, a1 path, a2 flags (AT_SYMLINK_NOFOLLOW 0x100, AT_EMPTY_PATH 0x1000), a4 buffer
+            string path;
+            if (!guestPath(a1, path)) return fail(EFAULT);
+            struct stat st;
+            int result;
+            if (path.empty() && (a2 & 0x1000)) {
+                if (!file(a0)) return fail(EBADF);
+                result = fstat(file(a0)->fd, &st);
+            } else {
+                int dir = AT_FDCWD;
+                if ((int32_t)a0 != -100) {
+                    if (!file(a0)) return fail(EBADF);
+                    dir = file(a0)->fd;
+                }
+                result = fstatat(dir, path.c_str(), &st, (a2 & 0x100) ? AT_SYMLINK_NOFOLLOW : 0);
+            }
+            if (result < 0) return fail(errno);
+            uint8_t out[256];
+            statxLayout(st, out);
+            return guestCopy<Mem>(a4, out, sizeof(out), true) ? 0 : fail(EFAULT);
+        }
+        case LINUX_CLOCK_GETTIME:
+        case LINUX_CLOCK_GETTIME64: {
+            static const clockid_t clocks[] = {
+                CLOCK_REALTIME, CLOCK_MONOTONIC, CLOCK_PROCESS_CPUTIME_ID, CLOCK_THREAD_CPUTIME_ID,
+                CLOCK_MONOTONIC, CLOCK_REALTIME, CLOCK_MONOTONIC, CLOCK_MONOTONIC   // RAW, COARSE and BOOTTIME
+            };
+            if (a0 >= 8) return fail(EINVAL);
+            struct timespec ts;
+            if (clock_gettime(clocks[a0], &ts) < 0) return fail(errno);
+            uint8_t out[16];
+            if (number == LINUX_CLOCK_GETTIME64) {
+                put<int64_t>(out, 0, ts.tv_sec);
+                put<int64_t>(out, 8, ts.tv_nsec);
+            } else {
+                put<int32_t>(out, 0, (int32_t)ts.tv_sec);
+                put<int32_t>(out, 4, (int32_t)ts.tv_nsec);
+            }
+            return guestCopy<Mem>(a1, out, number == LINUX_CLOCK_GETTIME64 ? 16 : 8, true) ? 0 : fail(EFAULT);
+        }
+        case LINUX_GETTIMEOFDAY: {
+            if (a0 == 0) return 0;
+            struct timeval tv;
+            gettimeofday(&tv, nullptr);
+            uint8_t out[8];
+            put<int32_t>(out, 0, (int32_t)tv.tv_sec);
+            put<int32_t>(out, 4, (int32_t)tv.tv_usec);
+            return guestCopy<Mem>(a0, out, 8, true) ? 0 : fail(EFAULT);
+        }
+        case LINUX_BRK: {
+            // Out-of-range requests leave the break alone, and the guest sees the old value
+            if (!process.mmap_bottom || a0 < process.brk_start || a0 > process.mmap_bottom) return process.brk;
+            if (a0 > process.brk && process.brk < process.brk_high) {
+                uint32_t end = min(a0, process.brk_high);
+                guestRange<Mem>(process.brk, end - process.brk, true, [](uint8_t* host, uint32_t, uint32_t chunk) { memset(host, 0, chunk); });
+            }
+            process.brk = a0;
+            process.brk_high = max(process.brk_high, a0);
+            return a0;
+        }
+        case LINUX_MMAP: {
+            // a0 addr, a1 length, a3 flags (MAP_SHARED 1, MAP_FIXED 0x10, MAP_ANONYMOUS 0x20), a4 fd, a5 offset in pages
+            uint64_t size = ((uint64_t)a1 + SparseMemory::PAGE_MASK) & ~(uint64_t)SparseMemory::PAGE_MASK;
+            if (a1 == 0) return fail(EINVAL);
+            if (size > UINT32_MAX || !process.mmap_bottom) return fail(ENOMEM);   // Lengths that round up to 4 GiB too
+            HostFile* f = nullptr;
+            if (!(a3 & 0x20)) {
+                f = file(a4);
+                if (!f) return fail(EBADF);
+                if (a3 & 1) return fail(EINVAL);    // Writes could never reach the file
+            }
+            uint32_t base;
+            if (a3 & 0x10) {
+                if ((a0 & SparseMemory::PAGE_MASK) || a0 + size > memory.size()) return fail(EINVAL);
+                base = a0;
+                guestRange<Mem>(base, (uint32_t)size, true, [](uint8_t* host, uint32_t, uint32_t chunk) { memset(host, 0, chunk); });
+            } else {
+                if (size > process.mmap_bottom - process.brk) return fail(ENOMEM);
+                base = process.mmap_bottom - (uint32_t)size;
+                process.mmap_bottom = base;
+            }
+            if (f) {
+                // Copied in; bytes past the end of the file stay zero
+                int error = 0;
+                off_t offset = (off_t)a5 * SparseMemory::PAGE_SIZE;
+                guestRange<Mem>(base, a1, true, [&](uint8_t* host, uint32_t done, uint32_t chunk) {
+                    if (!error && pread(f->fd, host, chunk, offset + done) < 0) error = errno;
+                });
+                if (error) return fail(error);
+            }
+            return base;
+        }
+        case LINUX_MUNMAP:      // Mappings are never reused, so there is nothing to release
+        case LINUX_MPROTECT:    // Guest memory has no page permissions
+            return 0;
+        case LINUX_SET_TID_ADDRESS:
+            return 1;           // The only thread's id
+        case LINUX_IOCTL:
+            return fail(ENOTTY);
+        default:
+            return fail(ENOSYS);
+    }
+}
+
+#else
+
+template <class Mem>
+uint32_t CPU::linuxSyscall(uint32_t) {
+    return (uint32_t)-38;   // ENOSYS
+}
+
+#endif
+
+template uint32_t CPU::linuxSyscall<PagedAccess>(uint32_t);
+template uint32_t CPU::linuxSyscall<ReservedAccess>(uint32_t);
@@ -0,0 +1,127 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Guest flags, errno values and struct layouts are Linux's, so host calls
+// pass them through on Linux hosts; elsewhere every syscall is -ENOSYS
+#if defined(__linux__)
+#define RISCV_LINUX_SYSCALLS_AVAILABLE 1
+#else
+#define RISCV_LINUX_SYSCALLS_AVAILABLE 0
+#endif
+
+// Linux user-mode syscall emulation for static newlib and musl binaries
+// (RV32 Linux ABI: number in a7, arguments in a0-a5, result or -errno in
+// a0). Guest descriptors name host files through a table, so a guest only
+// reaches stdin, stdout, stderr and the files it opened itself. Reads and
+// writes go straight between the host file and the guest's own pages with
+// readv/writev; nothing passes through a bounce buffer.
+
+// Syscall numbers (asm-generic, as used by RV32)
+static const uint32_t LINUX_IOCTL = 29;
+static const uint32_t LINUX_OPENAT = 56;
+static const uint32_t LINUX_CLOSE = 57;
+static const uint32_t LINUX_LSEEK = 62;         // _llseek with a result pointer in a3 (musl), else lseek (newlib)
+static const uint32_t LINUX_READ = 63;
+static const uint32_t LINUX_WRITE = 64;
+static const uint32_t LINUX_READV = 65;
+static const uint32_t LINUX_WRITEV = 66;
+static const uint32_t LINUX_FSTAT = 80;         // struct stat64 layout
+static const uint32_t LINUX_EXIT = 93;
+static const uint32_t LINUX_EXIT_GROUP = 94;
+static const uint32_t LINUX_SET_TID_ADDRESS = 96;
+static const uint32_t LINUX_CLOCK_GETTIME = 113;    // 32-bit timespec
+static const uint32_t LINUX_GETTIMEOFDAY = 169;
+static const uint32_t LINUX_BRK = 214;
+static const uint32_t LINUX_MUNMAP = 215;
+static const uint32_t LINUX_MMAP = 222;         // mmap2: offset in 4 KiB units
+static const uint32_t LINUX_MPROTECT = 226;
+static const uint32_t LINUX_STATX = 291;        // musl's fstat on RV32
+static const uint32_t LINUX_CLOCK_GETTIME64 = 403;
+
+// Trace name of an emulated syscall ("unknown" for the rest, which return -ENOSYS)
+inline const char* linuxSyscallName(uint32_t number) {
+    switch (number) {
+        case LINUX_IOCTL: return "ioctl";
+        case LINUX_OPENAT: return "openat";
+        case LINUX_CLOSE: return "close";
+        case LINUX_LSEEK: return "lseek";
+        case LINUX_READ: return "read";
+        case LINUX_WRITE: return "write";
+        case LINUX_READV: return "readv";
+        case LINUX_WRITEV: return "writev";
+        case LINUX_FSTAT: return "fstat";
+        case LINUX_EXIT: return "exit";
+        case LINUX_EXIT_GROUP: return "exit_group";
+        case LINUX_SET_TID_ADDRESS: return "set_tid_address";
+        case LINUX_CLOCK_GETTIME: return "clock_gettime";
+        case LINUX_GETTIMEOFDAY: return "gettimeofday";
+        case LINUX_BRK: return "brk";
+        case LINUX_MUNMAP: return "munmap";
+        case LINUX_MMAP: return "mmap";
+        case LINUX_MPROTECT: return "mprotect";
+        case LINUX_STATX: return "statx";
+        case LINUX_CLOCK_GETTIME64: return "clock_gettime64";
+        default: return "unknown";
+    }
+}
+
+// A host file the guest has open. Descriptors and snapshots share it, and
+// the host descriptor is closed when the last of them lets go, so a
+// restored snapshot still finds the files it had open.
+struct HostFile {
+    int fd;
+    bool owned;     // False for the simulator's own stdin/stdout/stderr
+    HostFile(int host_fd, bool owns) : fd(host_fd), owned(owns) {}
+    HostFile(const HostFile&) = delete;
+    HostFile& operator=(const HostFile&) = delete;
+    ~HostFile();
+};
+
+// Descriptors and heap of the guest process. The break grows up from the
+// end of the loaded image and anonymous mappings grow down from below the
+// stack; each fails with ENOMEM where they would meet. Mappings are never
+// reused, so memory below mmap_bottom is still untouched and zero.
+struct LinuxProcess {
+    static const uint32_t STACK_RESERVE = 1u << 20;    // Kept free below the top of memory (at most a quarter of it)
+
+    vector<shared_ptr<HostFile>> files;     // Guest fd -> host file (null: free)
+    uint32_t brk_start = 0;
+    uint32_t brk = 0;
+    uint32_t brk_high = 0;      // Highest break so far; memory above brk up to it is re-zeroed on growth
+    uint32_t mmap_bottom = 0;   // Lowest mapping so far (0: no heap, e.g. harts other than hart 0)
+
+    // Fresh process: the three standard descriptors and an empty heap
+    void reset(uint32_t image_end, uint64_t memory_size);
+};
+
+// Guest output bound for the simulator's stdout. Small writes are gathered
+// in one large host buffer, which goes out with a single writev when the
+// next write would overflow it and on flush() (the guest exiting or reading
+// the console, the end of a run, or on demand). A write too big to buffer
+// goes out in that same writev straight from guest memory.
+class OutputBuffer {
+public:
+    static const size_t CAPACITY = 64 * 1024;
+
+    OutputBuffer() = default;
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    ~OutputBuffer() { flush(); }
+
+    void write(const char* data, size_t len);
+    void flush() { if (used) emit(nullptr, 0); }
+
+private:
+    unique_ptr<char[]> buffer;  // Allocated on first use
+    size_t used = 0;
+    void emit(const char* extra, size_t len);
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "Trace.h"
+#include "Syscall.h"
+#include <chrono>
+#include <cstring>
+
+void formatExec(ostream& os, const DecodedInst& d, uint32_t value, uint32_t addr) {
+    uint32_t rd = d.rd;
+    uint32_t rs1 = d.rs1;
+    uint32_t rs2 = d.rs2;
+
+    switch(d.op) {
+        case Op::ADDI: case Op::SLTI: case Op::SLTIU: case Op::XORI: case Op::ORI: case Op::ANDI:
+        case Op::SLLI: case Op::SRLI: case Op::SRAI: case Op::RORI:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", x" << rs1 << ", " << d.imm << '\n';
+            break;
+        case Op::ADD: case Op::SUB: case Op::SLL: case Op::SLT: case Op::SLTU: case Op::XOR:
+        case Op::SRL: case Op::SRA: case Op::OR: case Op::AND:
+        case Op::MUL: case Op::MULH: case Op::MULHSU: case Op::MULHU:
+        case Op::DIV: case Op::DIVU: case Op::REM: case Op::REMU:
+        case Op::SH1ADD: case Op::SH2ADD: case Op::SH3ADD: case Op::ANDN: case Op::ORN: case Op::XNOR:
+        case Op::MIN: case Op::MINU: case Op::MAX: case Op::MAXU: case Op::ROL: case Op::ROR:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", x" << rs1 << ", x" << rs2 << '\n';
+            break;
+        case Op::CLZ: case Op::CTZ: case Op::CPOP: case Op::SEXT_B: case Op::SEXT_H: case Op::ZEXT_H:
+        case Op::REV8: case Op::ORC_B:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", x" << rs1 << '\n';
+            break;
+        case Op::LB: case Op::LH: case Op::LW: case Op::LBU: case Op::LHU:
+        case Op::SB: case Op::SH: case Op::SW:
+        case Op::FLW: case Op::FLD: case Op::FSW: case Op::FSD:
+            os << "EXEC: " << opName(d.op) << '\n';
+            break;
+        case Op::LOAD_BAD: os << "[ERROR] Unknown Load funct3" << '\n'; break;
+        case Op::STORE_BAD: os << "[ERROR] Unknown Store funct3" << '\n'; break;
+        case Op::BRANCH_BAD:
+            os << "[ERROR] Unknown Branch funct3" << '\n';
+            // fall through
+        case Op::BEQ: case Op::BNE: case Op::BLT: case Op::BGE: case Op::BLTU: case Op::BGEU:
+            os << "EXEC: BRANCH " << (value ? "TAKEN" : "NOT TAKEN") << '\n';
+            break;
+        case Op::LUI: case Op::AUIPC:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << '\n';
+            break;
+        case Op::JAL: case Op::JALR:
+            os << "EXEC: " << opName(d.op) << " -> 0x" << hex << addr << '\n';
+            break;
+        case Op::JALR_BAD:
+            os << "[ERROR] Invalid JALR funct3: " << ((d.raw >> 12) & 0x7) << '\n';
+            break;
+        case Op::LR_W: case Op::SC_W: case Op::AMOSWAP_W: case Op::AMOADD_W: case Op::AMOXOR_W:
+        case Op::AMOAND_W: case Op::AMOOR_W: case Op::AMOMIN_W: case Op::AMOMAX_W: case Op::AMOMINU_W: case Op::AMOMAXU_W:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", x" << rs2 << ", (x" << rs1 << ")" << '\n';
+            break;
+        case Op::FMADD_S: case Op::FMSUB_S: case Op::FNMSUB_S: case Op::FNMADD_S:
+        case Op::FMADD_D: case Op::FMSUB_D: case Op::FNMSUB_D: case Op::FNMADD_D:
+            os << "EXEC: " << opName(d.op) << " f" << dec << rd << ", f" << rs1 << ", f" << rs2 << ", f" << (d.imm >> 3) << '\n';
+            break;
+        case Op::FADD_S: case Op::FSUB_S: case Op::FMUL_S: case Op::FDIV_S:
+        case Op::FSGNJ_S: case Op::FSGNJN_S: case Op::FSGNJX_S: case Op::FMIN_S: case Op::FMAX_S:
+        case Op::FADD_D: case Op::FSUB_D: case Op::FMUL_D: case Op::FDIV_D:
+        case Op::FSGNJ_D: case Op::FSGNJN_D: case Op::FSGNJX_D: case Op::FMIN_D: case Op::FMAX_D:
+            os << "EXEC: " << opName(d.op) << " f" << dec << rd << ", f" << rs1 << ", f" << rs2 << '\n';
+            break;
+        case Op::FSQRT_S: case Op::FSQRT_D: case Op::FCVT_S_D: case Op::FCVT_D_S:
+            os << "EXEC: " << opName(d.op) << " f" << dec << rd << ", f" << rs1 << '\n';
+            break;
+        case Op::FEQ_S: case Op::FLT_S: case Op::FLE_S: case Op::FEQ_D: case Op::FLT_D: case Op::FLE_D:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", f" << rs1 << ", f" << rs2 << '\n';
+            break;
+        case Op::FCLASS_S: case Op::FCLASS_D: case Op::FMV_X_W:
+        case Op::FCVT_W_S: case Op::FCVT_WU_S: case Op::FCVT_W_D: case Op::FCVT_WU_D:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", f" << rs1 << '\n';
+            break;
+        case Op::FCVT_S_W: case Op::FCVT_S_WU: case Op::FCVT_D_W: case Op::FCVT_D_WU: case Op::FMV_W_X:
+            os << "EXEC: " << opName(d.op) << " f" << dec << rd << ", x" << rs1 << '\n';
+            break;
+        case Op::VSETVLI: case Op::VSETIVLI: case Op::VSETVL:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << " -> vl = " << value << '\n';
+            break;
+        case Op::VLE: case Op::VSE:
+            os << "EXEC: " << opName(d.op) << (d.imm * 8) << " v" << dec << (d.op == Op::VLE ? rd : rs2) << ", (x" << rs1 << ")" << '\n';
+            break;
+        case Op::VADD_VV: case Op::VSUB_VV: case Op::VAND_VV: case Op::VOR_VV: case Op::VXOR_VV: case Op::VMUL_VV:
+        case Op::VREDSUM: case Op::VREDAND: case Op::VREDOR: case Op::VREDXOR:
+        case Op::VREDMINU: case Op::VREDMIN: case Op::VREDMAXU: case Op::VREDMAX:
+            os << "EXEC: " << opName(d.op) << " v" << dec << rd << ", v" << rs2 << ", v" << rs1 << '\n';
+            break;
+        case Op::VADD_VX: case Op::VSUB_VX: case Op::VRSUB_VX: case Op::VAND_VX: case Op::VOR_VX: case Op::VXOR_VX: case Op::VMUL_VX:
+            os << "EXEC: " << opName(d.op) << " v" << dec << rd << ", v" << rs2 << ", x" << rs1 << '\n';
+            break;
+        case Op::VADD_VI: case Op::VRSUB_VI: case Op::VAND_VI: case Op::VOR_VI: case Op::VXOR_VI:
+            os << "EXEC: " << opName(d.op) << " v" << dec << rd << ", v" << rs2 << ", " << d.imm << '\n';
+            break;
+        case Op::VMV_V_V: os << "EXEC: VMV_V_V v" << dec << rd << ", v" << rs1 << '\n'; break;
+        case Op::VMV_V_X: case Op::VMV_S_X: os << "EXEC: " << opName(d.op) << " v" << dec << rd << ", x" << rs1 << '\n'; break;
+        case Op::VMV_V_I: os << "EXEC: VMV_V_I v" << dec << rd << ", " << d.imm << '\n'; break;
+        case Op::VMV_X_S: os << "EXEC: VMV_X_S x" << dec << rd << ", v" << rs2 << '\n'; break;
+        case Op::FENCE: case Op::FENCE_I:
+            os << "EXEC: " << opName(d.op) << '\n';
+            break;
+        case Op::ECALL: // value = a7, addr = a0 after the call
+            if (value == 10 || value == LINUX_EXIT || value == LINUX_EXIT_GROUP) os << "SYSCALL: EXIT" << '\n';
+            else if (value == 1) os << "SYSCALL: Print Int -> " << dec << (int32_t)addr << '\n';
+            else if (value == 4) os << "SYSCALL: Print Str -> [string at 0x" << hex << addr << "]" << '\n';
+            else os << "SYSCALL: " << linuxSyscallName(value) << " -> " << dec << (int32_t)addr << '\n';
+            break;
+        case Op::CSRRW: case Op::CSRRS: case Op::CSRRC:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", 0x" << hex << d.imm << ", x" << dec << rs1 << '\n';
+            break;
+        case Op::CSRRWI: case Op::CSRRSI: case Op::CSRRCI:
+            os << "EXEC: " << opName(d.op) << " x" << dec << rd << ", 0x" << hex << d.imm << ", " << dec << rs1 << '\n';
+            break;
+        case Op::ILLEGAL:
+            os << "[ERROR] Unknown Opcode: 0x" << hex << (d.raw & 0x7F) << '\n';
+            break;
+        default:
+            break;
+    }
+}
+
+TraceWriter::TraceWriter(size_t capacity_log2)
+    : ring((size_t)1 << capacity_log2), capacity((size_t)1 << capacity_log2), mask(capacity - 1) {}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const string& path) {
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    fwrite(&header, sizeof(header), 1, file);
+
+    head.store(0);
+    tail.store(0);
+    cached_tail = 0;
+    stopping.store(false);
+    consumer = thread(&TraceWriter::drain, this);
+    return true;
+}
+
+void TraceWriter::close() {
+    if (!file) return;
+    stopping.store(true, memory_order_release);
+    consumer.join();
+    fclose(file);
+    file = nullptr;
+}
+
+void TraceWriter::waitForSpace(uint64_t h) {
+    // Ring full: the simulator waits for the writer thread rather than dropping records
+    while (h - (cached_tail = tail.load(memory_order_acquire)) >= capacity) {
+        this_thread::yield();
+    }
+}
+
+void TraceWriter::drain() {
+    while (true) {
+        uint64_t t = tail.load(memory_order_relaxed);
+        uint64_t h = head.load(memory_order_acquire);
+        if (h == t) {
+            if (stopping.load(memory_order_acquire) && head.load(memory_order_acquire) == t) break;
+            this_thread::sleep_for(chrono::microseconds(100));
+            continue;
+        }
+
+        // Write the contiguous run up to the end of the ring in one call
+        size_t start = t & mask;
+        size_t count = (size_t)min<uint64_t>(h - t, capacity - start);
+        fwrite(&ring[start], sizeof(TraceRecord), count, file);
+        tail.store(t + count, memory_order_release);
+    }
+    fflush(file);
+}
@@ -0,0 +1,113 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include "Decoder.h"
+
+using namespace std;
+
+// Compact binary trace record, one per retired instruction.
+//   value : rd result (ALU, loads, LUI/AUIPC, link register of JAL/JALR,
+//           low word of an f register), stored value (stores), taken flag
+//           (branches), a7 (ECALL), old value (CSR accesses), vl (vector
+//           ops other than vmv.x.s)
+//   addr  : effective address (loads/stores/atomics), next PC (branches, jumps),
+//           a0 after the call (ECALL: the exit code, the printed value or
+//           string address, or a Linux syscall's result), so formatExec
+//           prints the same SYSCALL lines as the console trace
+struct TraceRecord {
+    uint32_t pc;
+    uint32_t inst;
+    uint32_t value;
+    uint32_t addr;
+};
+
+// Trace file layout: TraceFileHeader followed by TraceRecords
+struct TraceFileHeader {
+    char magic[8];          // "RVTRACE\0"
+    uint32_t version;
+    uint32_t record_size;
+};
+
+static const char TRACE_MAGIC[8] = {'R', 'V', 'T', 'R', 'A', 'C', 'E', '\0'};
+static const uint32_t TRACE_VERSION = 2;    // 2: ECALL records a0 after the call
+
+// Print a record in the simulator's human-readable EXEC format
+void formatExec(ostream& os, const DecodedInst& d, uint32_t value, uint32_t addr);
+
+// Lock-free single-producer/single-consumer ring buffer of TraceRecords.
+// The simulator thread pushes, a background thread drains to a file.
+class TraceWriter {
+public:
+    explicit TraceWriter(size_t capacity_log2 = 20);
+    ~TraceWriter();
+
+    bool open(const string& path);
+    void close();   // Drains everything still buffered, then joins the writer thread
+
+    void push(const TraceRecord& r) {
+        uint64_t h = head.load(memory_order_relaxed);
+        if (h - cached_tail >= capacity) waitForSpace(h);
+        ring[h & mask] = r;
+        head.store(h + 1, memory_order_release);
+    }
+
+    uint64_t recordsWritten() const { return tail.load(memory_order_acquire); }
+
+private:
+    void waitForSpace(uint64_t h);
+    void drain();
+
+    vector<TraceRecord> ring;
+    size_t capacity;
+    size_t mask;
+    FILE* file = nullptr;
+    thread consumer;
+    atomic<bool> stopping{false};
+
+    // Producer and consumer indices live on separate cache lines
+    alignas(64) atomic<uint64_t> head{0};
+    uint64_t cached_tail = 0;
+    alignas(64) atomic<uint64_t> tail{0};
+};
+
+// Compile-time tracing policies for the execution cores.
+//
+// The cores are templates over one of these, and every trace site is an
+// `if constexpr`, so the quiet instantiation carries no logging branches
+// at all. The runtime settings (quiet flag, attached TraceWriter) only pick
+// which instantiation runs, once per executeNext()/run() call.
+
+// Production: no tracing code is generated
+struct NoTrace {
+    static constexpr bool enabled = false;
+    static constexpr bool messages = false;
+    static void exec(TraceWriter*, uint32_t, const DecodedInst&, uint32_t, uint32_t) {}
+};
+
+// Human-readable EXEC lines on stdout (flushed at the end of each run,
+// not after every instruction)
+struct ConsoleTrace {
+    static constexpr bool enabled = true;
+    static constexpr bool messages = true;
+    static void exec(TraceWriter*, uint32_t, const DecodedInst& d, uint32_t value, uint32_t addr) {
+        if (d.op != Op::ECALL) formatExec(cout, d, value, addr); // Syscalls print their own lines
+    }
+};
+
+// Binary records into the TraceWriter's ring buffer
+struct BinaryTrace {
+    static constexpr bool enabled = true;
+    static constexpr bool messages = false;
+    static void exec(TraceWriter* writer, uint32_t pc, const DecodedInst& d, uint32_t value, uint32_t addr) {
+        writer->push(TraceRecord{pc, d.raw, value, addr});
+    }
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// Integer subset of RVV 1.0 on host SIMD. Registers are VLEN = 256 bits and
+// elements at most 32 bits (ELEN = 32), so SEW is 8, 16 or 32 and LMUL runs
+// from 1/4 (SEW 8) to 8. The register file is one flat array of elements in
+// host byte order, so a register group is contiguous host bytes and
+// unit-stride loads and stores are copies.
+//
+// The element loops below work one whole register at a time on local
+// fixed-size arrays: the trip count is a constant and nothing aliases, so the
+// host compiler vectorizes them at -O2 (an SSE2 instruction handles 16
+// 8-bit or 4 32-bit elements). Elements at or past vl are blended back
+// from the old destination, which keeps the tail undisturbed (allowed for
+// either vta). Masked forms are not part of the subset.
+static const uint32_t VLEN = 256;
+static const uint32_t VLENB = VLEN / 8;
+static const uint32_t ELEN = 32;
+static const uint32_t VTYPE_VILL = 0x80000000;
+
+// VLMAX for a vtype (vsew in bits 5:3, vlmul in bits 2:0, vta/vma in 7:6),
+// or 0 if this implementation does not support it
+inline uint32_t vectorMax(uint32_t vtype) {
+    uint32_t vsew = (vtype >> 3) & 0x7;
+    uint32_t vlmul = vtype & 0x7;
+    if ((vtype >> 8) || vsew > 2 || vlmul == 4) return 0;  // Reserved bits, SEW > ELEN, reserved LMUL
+    uint32_t sew = 8u << vsew;
+    if (vlmul < 4) return (VLEN / sew) << vlmul;
+    // Fractional LMUL = 1/2^(8 - vlmul), only while SEW <= LMUL * ELEN
+    uint32_t shift = 8 - vlmul;
+    return sew <= (ELEN >> shift) ? (VLEN / sew) >> shift : 0;
+}
+
+// vd = f(vs2, rhs) elementwise for the first vl elements, where rhs is the
+// group at vs1 or, if vs1 is null, the scalar splatted
+template <class T, class F>
+void vectorBinary(uint8_t* vd, const uint8_t* vs2, const uint8_t* vs1, T scalar, uint32_t vl, F f) {
+    const uint32_t N = VLENB / sizeof(T);
+    for (uint32_t base = 0; base < vl; base += N) {
+        T a[N], b[N], d[N];
+        memcpy(a, vs2, VLENB);
+        if (vs1) memcpy(b, vs1, VLENB);
+        else for (uint32_t i = 0; i < N; i++) b[i] = scalar;
+        memcpy(d, vd, VLENB);
+        for (uint32_t i = 0; i < N; i++) d[i] = (base + i < vl) ? (T)f(a[i], b[i]) : d[i];
+        memcpy(vd, d, VLENB);
+        vd += VLENB;
+        vs2 += VLENB;
+        if (vs1) vs1 += VLENB;
+    }
+}
+
+// f folded over the first vl elements of the group at vs2, starting from
+// init. Lanes accumulate separately and are combined at the end, which is
+// exact for the integer operations reductions use.
+template <class T, class F>
+T vectorReduce(const uint8_t* vs2, uint32_t vl, T init, T identity, F f) {
+    const uint32_t N = VLENB / sizeof(T);
+    T acc[N];
+    for (uint32_t i = 0; i < N; i++) acc[i] = identity;
+    for (uint32_t base = 0; base < vl; base += N) {
+        T a[N];
+        memcpy(a, vs2, VLENB);
+        for (uint32_t i = 0; i < N; i++) acc[i] = (T)f(acc[i], (base + i < vl) ? a[i] : identity);
+        vs2 += VLENB;
+    }
+    T result = init;
+    for (uint32_t i = 0; i < N; i++) result = (T)f(result, acc[i]);
+    return result;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "Batch.h"
+
+using namespace std;
+
+// Runs every job in a manifest in parallel and prints one JSON line per job
+// as it finishes.
+
+void printUsage() {
+    cout << "Usage: ./riscv_batch <manifest | -> [-j <threads>] [-m <MiB>] [--reserved] [--trap-misaligned] [--no-decode-cache] [--threaded | --jit]" << endl;
+    cout << "  Manifest lines: <elf> <budget> [args...]   (budget 0 = run until exit, '#' comments)" << endl;
+    cout << "  -j N       : Worker threads (default: one per hardware thread)" << endl;
+    cout << "  -m MiB     : Guest memory size per job in MiB (default 4, up to 4096)" << endl;
+    cout << "  --reserved : Back each job's memory with a 4 GiB host reservation" << endl;
+    cout << "  --trap-misaligned : Stop jobs on loads/stores that are not naturally aligned" << endl;
+    cout << "  --no-decode-cache : Do not read or write <elf>.dcache files" << endl;
+    cout << "  --threaded : Use the direct-threaded interpreter core" << endl;
+    cout << "  --jit      : Translate hot blocks to native x86-64 code" << endl;
+}
+
+static bool parseCount(const char* text, uint64_t& value) {
+    char* end = nullptr;
+    value = strtoull(text, &end, 10);
+    return *text != '\0' && *text != '-' && *end == '\0';
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    BatchOptions options;
+    for (int i = 2; i < argc; i++) {
+        string flag = argv[i];
+        uint64_t value = 0;
+        if (flag == "--reserved") options.backend = MemoryBackend::Reserved;
+        else if (flag == "--trap-misaligned") options.trap_misaligned = true;
+        else if (flag == "--no-decode-cache") options.decode_cache = false;
+        else if (flag == "--threaded") options.engine = Engine::Threaded;
+        else if (flag == "--jit") options.engine = Engine::Jit;
+        else if (flag == "-j" && i + 1 < argc && parseCount(argv[++i], value) && value > 0 && value <= 4096) {
+            options.threads = (unsigned)value;
+        }
+        else if (flag == "-m" && i + 1 < argc && parseCount(argv[++i], value) && value > 0 && value <= 4096) {
+            options.memory_bytes = value << 20;
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    vector<BatchJob> jobs;
+    string error;
+    string manifest = argv[1];
+    bool parsed;
+    if (manifest == "-") {
+        parsed = parseManifest(cin, jobs, error);
+    } else {
+        ifstream in(manifest);
+        if (!in) {
+            cerr << "[ERROR] Cannot open manifest: " << manifest << endl;
+            return 1;
+        }
+        parsed = parseManifest(in, jobs, error);
+    }
+    if (!parsed) {
+        cerr << "[ERROR] " << manifest << ", " << error << endl;
+        return 1;
+    }
+
+    bool failed = false;
+    uint64_t instructions = 0;
+    auto start = chrono::steady_clock::now();
+    runBatch(jobs, options, [&](const BatchResult& result) {
+        cout << resultJson(jobs[result.job], result) << '\n';
+        cout.flush();   // Stream: a consumer sees each job as soon as it finishes
+        instructions += result.instructions;
+        failed = failed || !result.loaded || result.stop_reason == StopReason::Fault ||
+                 result.stop_reason == StopReason::Misaligned || result.stop_reason == StopReason::Illegal;
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cerr << "Ran " << jobs.size() << " jobs: " << instructions << " instructions in " << seconds << " s ("
+         << (seconds > 0 ? instructions / seconds / 1e6 : 0) << " MIPS)" << endl;
+    return failed ? 1 : 0;
+}
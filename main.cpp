@@ -1,13 +1,78 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <cstdlib>
 #include "CPU.h"
+#include "Trace.h"
+#include "Server.h"
+#include "Machine.h"
 
 using namespace std;
 
 void printUsage() {
-    cout << "Usage: ./riscv_sim <elf_file> [-d]" << endl;
-    cout << "  -d : Enable Interactive Debug Mode (Step-by-step)" << endl;
+    cout << "Usage: ./riscv_sim <elf_file> [-d] [-q] [-n <count>] [-m <MiB>] [--reserved] [--trap-misaligned] [--timing <cpi,load,store,branch>] [--decode-cache] [--threaded | --jit] [--trace <file>] [--harts <N> [--quantum <count>]] [-- <args>]" << endl;
+    cout << "       ./riscv_sim <elf_file> --serve <socket | -> [--serve-at <pc>] [--input <addr>] [options]" << endl;
+    cout << "  -d         : Enable Interactive Debug Mode (Step-by-step)" << endl;
+    cout << "  -q         : Quiet Mode (no per-instruction trace)" << endl;
+    cout << "  -n N       : Stop after N instructions (default 0 = run until exit or fault)" << endl;
+    cout << "  -m MiB     : Guest memory size in MiB (default 4, up to 4096)" << endl;
+    cout << "  --reserved : Back guest memory with a 4 GiB host reservation (no bounds checks)" << endl;
+    cout << "  --trap-misaligned : Stop on loads/stores that are not naturally aligned" << endl;
+    cout << "  --timing C,L,S,B  : Cycles per instruction, plus extra cycles per load, store and taken branch" << endl;
+    cout << "                      (default 1,0,0,0; read by the guest through the cycle and time CSRs)" << endl;
+    cout << "  --decode-cache    : Reuse predecoded code from <elf_file>.dcache (written after a cold run)" << endl;
+    cout << "  --threaded : Use the direct-threaded interpreter core" << endl;
+    cout << "  --jit      : Translate hot blocks to native x86-64 code" << endl;
+    cout << "  --trace F  : Write a binary execution trace to F (decode with ./trace_dump)" << endl;
+    cout << "  --harts N  : Run N harts on N host threads over shared memory (a0 = hart id at entry)" << endl;
+    cout << "  --quantum C: Instructions each hart runs between synchronisations (default 100000)" << endl;
+    cout << "  -- ARGS    : Guest argv[1..] (argv[0] is <elf_file>)" << endl;
+    cout << "  --serve S  : Run server on UNIX socket S ('-' = stdin/stdout); each request restores" << endl;
+    cout << "               the start snapshot and runs on a new input (send with ./run_client)" << endl;
+    cout << "  --serve-at PC : Take the start snapshot when execution first reaches PC (default: entry)" << endl;
+    cout << "  --input A  : Guest address requests' input is written to (default: middle of memory)" << endl;
+}
+
+// Multi-hart run: quiet (harts run concurrently), guest output shown after the run
+static int runHarts(const string& filename, unsigned harts, uint64_t quantum, uint64_t budget, uint64_t memoryMiB,
+                    bool reservedMode, bool threadedMode, bool jitMode, bool trapMisaligned,
+                    const TimingModel& timing) {
+    Machine machine(harts);
+    machine.setMemorySize(memoryMiB << 20);
+    machine.setQuantum(quantum);
+    if (trapMisaligned) machine.setMisalignedAccess(MisalignedAccess::Trap);
+    machine.setTimingModel(timing);
+    if (reservedMode && !machine.setMemoryBackend(MemoryBackend::Reserved)) {
+        cout << "[WARN] Reserved guest memory unavailable on this host, using paged memory." << endl;
+    }
+    if (threadedMode && !machine.setEngine(Engine::Threaded)) {
+        cout << "[WARN] Threaded core unavailable with this compiler, using the switch interpreter." << endl;
+    }
+    if (jitMode && !machine.setEngine(Engine::Jit)) {
+        cout << "[WARN] JIT unavailable on this host, using the block interpreter." << endl;
+    }
+    if (!machine.loadELF(filename)) {
+        return 1;
+    }
+
+    cout << "--- RISC-V SIMULATOR STARTING (" << harts << " harts) ---" << endl;
+    StopReason reason = machine.run(budget);
+    string output = machine.takeOutput();
+    if (!output.empty()) cout << output << endl;
+    cout << "--- EXECUTION FINISHED ---" << endl;
+    machine.hart(machine.getStopHart()).printStatus();
+    for (unsigned i = 0; i < harts; i++) {
+        const CPU& hart = machine.hart(i);
+        cout << "Hart " << dec << i << ": " << hart.getInstructionCount() << " instructions, " << stopReasonName(hart.getStopReason()) << endl;
+    }
+    cout << "Stop Reason: " << stopReasonName(reason);
+    if (reason != StopReason::Budget && reason != StopReason::Halt) cout << " (hart " << machine.getStopHart() << ")";
+    cout << endl;
+
+    // The guest's exit code (low byte, as a Linux exit status) when it exits
+    if (reason == StopReason::Exit) return (int)(machine.hart(machine.getStopHart()).getReg(10) & 0xFF);
+    bool failed = reason == StopReason::Fault || reason == StopReason::Misaligned || reason == StopReason::Illegal;
+    return failed ? 1 : 0;
 }
 
 int main(int argc, char** argv) {
@@ -18,42 +83,213 @@ int main(int argc, char** argv) {
 
     string filename = argv[1];
     bool debugMode = false;
+    bool quietMode = false;
+    bool threadedMode = false;
+    bool jitMode = false;
+    bool reservedMode = false;
+    bool trapMisaligned = false;
+    bool decodeCache = false;
+    string traceFile;
+    string servePath;
+    bool serveAtSet = false;
+    uint32_t serveAt = 0;
+    bool inputSet = false;
+    uint32_t inputAddr = 0;
+    uint64_t budget = CPU::RUN_UNLIMITED;
+    uint64_t memoryMiB = 4;
+    uint64_t harts = 1;
+    uint64_t quantum = Machine::DEFAULT_QUANTUM;
+    TimingModel timing;
+    vector<string> guestArgs = { filename };
 
-    if (argc >= 3) {
-        string flag = argv[2];
+    for (int i = 2; i < argc; i++) {
+        string flag = argv[i];
         if (flag == "-d") debugMode = true;
+        else if (flag == "-q") quietMode = true;
+        else if (flag == "--threaded") threadedMode = true;
+        else if (flag == "--jit") jitMode = true;
+        else if (flag == "--reserved") reservedMode = true;
+        else if (flag == "--trap-misaligned") trapMisaligned = true;
+        else if (flag == "--decode-cache") decodeCache = true;
+        else if (flag == "--") {
+            guestArgs.insert(guestArgs.end(), argv + i + 1, argv + argc);
+            break;
+        }
+        else if (flag == "--trace" && i + 1 < argc) traceFile = argv[++i];
+        else if (flag == "--serve" && i + 1 < argc) servePath = argv[++i];
+        else if ((flag == "--serve-at" || flag == "--input") && i + 1 < argc) {
+            char* end = nullptr;
+            const char* value = argv[++i];
+            unsigned long long addr = strtoull(value, &end, 0);
+            if (*value == '\0' || *value == '-' || *end != '\0' || addr > UINT32_MAX) {
+                printUsage();
+                return 1;
+            }
+            if (flag == "--serve-at") {
+                serveAt = (uint32_t)addr;
+                serveAtSet = true;
+            } else {
+                inputAddr = (uint32_t)addr;
+                inputSet = true;
+            }
+        }
+        else if (flag == "-n" && i + 1 < argc) {
+            char* end = nullptr;
+            const char* count = argv[++i];
+            budget = strtoull(count, &end, 10);
+            if (*count == '\0' || *count == '-' || *end != '\0') {
+                printUsage();
+                return 1;
+            }
+            if (budget == 0) budget = CPU::RUN_UNLIMITED;
+        }
+        else if ((flag == "--harts" || flag == "--quantum") && i + 1 < argc) {
+            char* end = nullptr;
+            const char* count = argv[++i];
+            uint64_t value = strtoull(count, &end, 10);
+            if (*count == '\0' || *count == '-' || *end != '\0' || value == 0 || (flag == "--harts" && value > 1024)) {
+                printUsage();
+                return 1;
+            }
+            (flag == "--harts" ? harts : quantum) = value;
+        }
+        else if (flag == "--timing" && i + 1 < argc) {
+            // Four comma-separated cycle counts
+            const char* spec = argv[++i];
+            uint32_t* fields[] = { &timing.cycles_per_instruction, &timing.load_cycles, &timing.store_cycles, &timing.taken_branch_cycles };
+            for (int f = 0; f < 4; f++) {
+                char* end = nullptr;
+                unsigned long long value = strtoull(spec, &end, 10);
+                if (*spec < '0' || *spec > '9' || value > UINT32_MAX || *end != (f < 3 ? ',' : '\0')) {
+                    printUsage();
+                    return 1;
+                }
+                *fields[f] = (uint32_t)value;
+                spec = end + 1;
+            }
+        }
+        else if (flag == "-m" && i + 1 < argc) {
+            char* end = nullptr;
+            const char* size = argv[++i];
+            memoryMiB = strtoull(size, &end, 10);
+            if (*size == '\0' || *size == '-' || *end != '\0' || memoryMiB == 0 || memoryMiB > 4096) {
+                printUsage();
+                return 1;
+            }
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (harts > 1) {
+        if (debugMode || !traceFile.empty() || !servePath.empty() || decodeCache || guestArgs.size() > 1) {
+            printUsage();
+            return 1;
+        }
+        return runHarts(filename, (unsigned)harts, quantum, budget, memoryMiB, reservedMode, threadedMode, jitMode, trapMisaligned, timing);
+    }
+
+    // Serving on stdout: the protocol owns it, so nothing else may be printed there
+    bool serving = !servePath.empty();
+    ostream& notes = serving ? cerr : cout;
+    if (serving && (debugMode || !traceFile.empty())) {
+        printUsage();
+        return 1;
     }
 
     CPU cpu;
+    cpu.setQuiet(quietMode || serving);
+    cpu.setMemorySize(memoryMiB << 20);
+    if (trapMisaligned) cpu.setMisalignedAccess(MisalignedAccess::Trap);
+    cpu.setTimingModel(timing);
+    cpu.setDecodeCache(decodeCache);
+    if (reservedMode && !cpu.setMemoryBackend(MemoryBackend::Reserved)) {
+        notes << "[WARN] Reserved guest memory unavailable on this host, using paged memory." << endl;
+    }
+    if (threadedMode && !cpu.setEngine(Engine::Threaded)) {
+        notes << "[WARN] Threaded core unavailable with this compiler, using the switch interpreter." << endl;
+    }
+    if (jitMode && !cpu.setEngine(Engine::Jit)) {
+        notes << "[WARN] JIT unavailable on this host, using the block interpreter." << endl;
+    }
     if (!cpu.loadELF(filename)) {
         return 1;
     }
+    if (!cpu.setArgs(guestArgs)) {
+        notes << "[ERROR] Arguments do not fit in guest memory" << endl;
+        return 1;
+    }
+
+    if (serving) {
+        // Run up to the start point once; everything before it is shared by all requests
+        if (serveAtSet) {
+            while (cpu.getPC() != serveAt && cpu.getInstructionCount() < budget && cpu.executeNext()) {}
+            if (cpu.getPC() != serveAt) {
+                cerr << "[ERROR] Execution never reached 0x" << hex << serveAt << ": " << stopReasonName(cpu.getStopReason()) << endl;
+                return 1;
+            }
+        }
+        ServerOptions options;
+        options.input_addr = inputSet ? inputAddr : (uint32_t)((memoryMiB << 20) / 2);
+        options.budget = budget;
+        shared_ptr<Snapshot> start = cpu.snapshot();
+        if (servePath == "-") return serveConnection(cpu, start, options, 0, 1) ? 0 : 1;
+        cerr << "Serving " << filename << " on " << servePath << endl;
+        serveSocket(cpu, start, options, servePath);
+        cerr << "[ERROR] Cannot serve on " << servePath << endl;
+        return 1;
+    }
+
+    TraceWriter tracer;
+    if (!traceFile.empty()) {
+        if (!tracer.open(traceFile)) {
+            cout << "[ERROR] Cannot open trace file: " << traceFile << endl;
+            return 1;
+        }
+        cpu.setTraceWriter(&tracer);
+    }
 
     cout << "--- RISC-V SIMULATOR STARTING ---" << endl;
     if (debugMode) {
         cout << "[DEBUG MODE ENABLED] Press ENTER to step. Type 'q' to quit." << endl;
     }
     
-    // Run until Exit Syscall (returns false) or safety limit
-    int max_cycles = 10000;
-    while(max_cycles > 0) {
-        if (debugMode) {
+    // Run until Exit Syscall, a fault or the instruction budget runs out
+    StopReason reason;
+    if (debugMode) {
+        reason = StopReason::Budget;
+        while(cpu.getInstructionCount() < budget) {
             cout << "\n>>> Press ENTER to step...";
             string input;
             getline(cin, input);
-            if (input == "q") break;
-        }
+            if (input == "q") {
+                reason = StopReason::None;
+                break;
+            }
 
-        bool active = cpu.executeNext();
-        
-        if (debugMode) cpu.printStatus();
+            bool active = cpu.executeNext();
+            cpu.flushOutput();
+            cpu.printStatus();
 
-        if (!active) break; // Stop on Exit Syscall
-        max_cycles--;
+            if (!active) { // Stop on Exit Syscall or fault
+                reason = cpu.getStopReason();
+                break;
+            }
+        }
+    } else {
+        reason = cpu.run(budget);
     }
 
+    tracer.close();
+    if (decodeCache && !cpu.decodeCacheLoaded()) cpu.saveDecodeCache();
     cout << "--- EXECUTION FINISHED ---" << endl;
     if (!debugMode) cpu.printStatus();
+    cout << "Stop Reason: " << stopReasonName(reason) << endl;
 
-    return 0;
+    // The guest's exit code (low byte, as a Linux exit status) when it exits
+    if (reason == StopReason::Exit) return (int)(cpu.getReg(10) & 0xFF);
+    bool failed = reason == StopReason::Fault || reason == StopReason::Misaligned || reason == StopReason::Illegal;
+    return failed ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include "Server.h"
+
+using namespace std;
+
+// Sends one input to a `riscv_sim --serve` server and prints what the guest
+// printed. Exits with the guest's exit code, or 1 if it did not exit cleanly.
+
+void printUsage() {
+    cout << "Usage: ./run_client <socket> [input_file]" << endl;
+    cout << "  Input is read from input_file, or from stdin if none is given" << endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        printUsage();
+        return 1;
+    }
+
+    string input;
+    if (argc == 3) {
+        ifstream in(argv[2], ios::binary);
+        if (!in) {
+            cerr << "[ERROR] Cannot open " << argv[2] << endl;
+            return 1;
+        }
+        input.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    } else {
+        input.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+    }
+
+    int fd = connectServer(argv[1]);
+    if (fd < 0) {
+        cerr << "[ERROR] Cannot connect to " << argv[1] << endl;
+        return 1;
+    }
+    ServerResponse response;
+    bool ok = requestRun(fd, input, response);
+    close(fd);
+    if (!ok) {
+        cerr << "[ERROR] Server closed the connection" << endl;
+        return 1;
+    }
+
+    cout << response.output;
+    cerr << "Stop Reason: " << stopReasonName(response.stop_reason)
+         << " (" << response.instructions << " instructions)" << endl;
+    return response.stop_reason == StopReason::Exit ? response.exit_code : 1;
+}
@@ -1,15 +1,28 @@
 #include <iostream>
 #include <vector>
 #include <cassert>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <sstream>
 #include "CPU.h"
+#include "Server.h"
+#include "Batch.h"
+#include "Machine.h"
+
+#if RISCV_SERVER_AVAILABLE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
 
 using namespace std;
 
-// Test 1: Fibonacci Sequence (Iterative)
-bool runFibonacciTest() {
-    cout << "[TEST] Fibonacci(10) - Iterative Implementation" << endl;
-    
-    vector<uint32_t> program = {
+static vector<uint32_t> fibonacciProgram() {
+    return {
         0x00a00513, // ADDI x10, x0, 10   (n = 10)
         0x00000293, // ADDI x5, x0, 0     (a = 0)
         0x00100313, // ADDI x6, x0, 1     (b = 1)
@@ -46,6 +59,82 @@ bool runFibonacciTest() {
         0x00a00893, // ADDI x17, x0, 10 (Exit)
         0x00000073  // ECALL
     };
+}
+
+// Pass 1 adds 1 to x11, then patches 0x04 so pass 2 adds 2 (x11 = 3)
+static vector<uint32_t> selfModifyingProgram() {
+    return {
+        0x00000513, // ADDI x10, x0, 0    (pass = 0)
+        
+        // PATCH TARGET at 0x04: rewritten to ADDI x6, x0, 2 on the first pass
+        0x00100313, // ADDI x6, x0, 1
+        
+        0x006585b3, // ADD x11, x11, x6   (sum += x6)
+        0x00150513, // ADDI x10, x10, 1   (pass++)
+        0x002003b7, // LUI x7, 0x200
+        0x31338393, // ADDI x7, x7, 0x313 (x7 = 0x00200313)
+        0x00702223, // SW x7, 4(x0)       (overwrite cached instruction)
+        0x00200613, // ADDI x12, x0, 2
+        0xfec542e3, // BLT x10, x12, -28  (back to PATCH TARGET)
+        0x00a00893, // ADDI x17, x0, 10 (Exit)
+        0x00000073  // ECALL
+    };
+}
+
+// Loops 40 times over every RV32I ALU, load and store form (hot enough to JIT)
+static vector<uint32_t> aluLoopProgram() {
+    return {
+        0x02800a13, // 0x000: addi s4, zero, 40
+        0x876542b7, // 0x004: lui t0, 554580
+        0x32128293, // 0x008: addi t0, t0, 801
+        0xff900313, // 0x00c: addi t1, zero, -7
+        0xf9c28393, // 0x010: addi t2, t0, -100
+        0xffd32413, // 0x014: slti s0, t1, -3
+        0x00533493, // 0x018: sltiu s1, t1, 5
+        0xfff2c513, // 0x01c: xori a0, t0, -1
+        0x05536593, // 0x020: ori a1, t1, 85
+        0x7f02f613, // 0x024: andi a2, t0, 2032
+        0x00329693, // 0x028: slli a3, t0, 3
+        0x00735713, // 0x02c: srli a4, t1, 7
+        0x40235793, // 0x030: srai a5, t1, 2
+        0x00628833, // 0x034: add a6, t0, t1
+        0x406288b3, // 0x038: sub a7, t0, t1
+        0x00629933, // 0x03c: sll s2, t0, t1
+        0x0142d9b3, // 0x040: srl s3, t0, s4
+        0x41435ab3, // 0x044: sra s5, t1, s4
+        0x00532b33, // 0x048: slt s6, t1, t0
+        0x00533bb3, // 0x04c: sltu s7, t1, t0
+        0x0072cc33, // 0x050: xor s8, t0, t2
+        0x01836cb3, // 0x054: or s9, t1, s8
+        0x005cfd33, // 0x058: and s10, s9, t0
+        0x00012d97, // 0x05c: auipc s11, 18
+        0x21002023, // 0x060: sw a6, 512(zero)
+        0x21101323, // 0x064: sh a7, 518(zero)
+        0x20500423, // 0x068: sb t0, 520(zero)
+        0x20002e03, // 0x06c: lw t3, 512(zero)
+        0x20601e83, // 0x070: lh t4, 518(zero)
+        0x20605f03, // 0x074: lhu t5, 518(zero)
+        0x20800f83, // 0x078: lb t6, 520(zero)
+        0x20804083, // 0x07c: lbu ra, 520(zero)
+        0x010282b3, // 0x080: add t0, t0, a6
+        0x00d34333, // 0x084: xor t1, t1, a3
+        0xfffa0a13, // 0x088: addi s4, s4, -1
+        0xf94042e3, // 0x08c: blt zero, s4, 0x10 <loop>
+        0x005a7663, // 0x090: bgeu s4, t0, 0x9c <skip>
+        0x00506463, // 0x094: bltu zero, t0, 0x9c <skip>
+        0x00120213, // 0x098: addi tp, tp, 1
+        0x00035463, // 0x09c: bge t1, zero, 0xa4 <done>
+        0x004001ef, // 0x0a0: jal gp, 0xa4 <done>
+        0x00a00893, // 0x0a4: addi a7, zero, 10
+        0x00000073  // 0x0a8: ecall
+    };
+}
+
+// Test 1: Fibonacci Sequence (Iterative)
+bool runFibonacciTest() {
+    cout << "[TEST] Fibonacci(10) - Iterative Implementation" << endl;
+    
+    vector<uint32_t> program = fibonacciProgram();
 
     CPU cpu;
     cpu.setQuiet(true); // Disable logs for clean pass/fail output
@@ -153,6 +242,2203 @@ bool runMemoryTest() {
     return pass;
 }
 
+// Test 4: Self-Modifying Code (Decode Cache Invalidation)
+bool runSelfModifyingTest() {
+    cout << "[TEST] Self-Modifying Code (Decode Cache Invalidation)" << endl;
+    
+    vector<uint32_t> program = selfModifyingProgram();
+    
+    CPU cpu;
+    cpu.setQuiet(true);
+    cpu.loadRaw(program);
+    
+    while(cpu.executeNext());
+    
+    // Pass 1 adds 1, pass 2 must see the patched instruction and add 2
+    if (cpu.getReg(11) == 3) {
+        cout << "   [PASS] Patched instruction re-decoded." << endl;
+        return true;
+    } else {
+        cout << "   [FAIL] Expected 3, got " << cpu.getReg(11) << endl;
+        return false;
+    }
+}
+
+// Test 5: Block Cache Engine (run) matches single-stepping
+bool runBlockEngineTest() {
+    cout << "[TEST] Block Cache Engine (Chained Basic Blocks)" << endl;
+    bool pass = true;
+    
+    CPU stepped;
+    stepped.setQuiet(true);
+    stepped.loadRaw(fibonacciProgram());
+    while(stepped.executeNext());
+    
+    CPU blocked;
+    blocked.setQuiet(true);
+    blocked.loadRaw(fibonacciProgram());
+    if (blocked.run(1000) == StopReason::Budget) { cout << "   [FAIL] Fibonacci did not halt within budget" << endl; pass = false; }
+    if (blocked.getReg(10) != 55) { cout << "   [FAIL] Fibonacci: Expected 55, got " << blocked.getReg(10) << endl; pass = false; }
+    if (blocked.getInstructionCount() != stepped.getInstructionCount()) {
+        cout << "   [FAIL] Instruction count " << blocked.getInstructionCount() << " != " << stepped.getInstructionCount() << endl;
+        pass = false;
+    }
+    
+    CPU smc;
+    smc.setQuiet(true);
+    smc.loadRaw(selfModifyingProgram());
+    smc.run(1000);
+    if (smc.getReg(11) != 3) { cout << "   [FAIL] Self-modifying: Expected 3, got " << smc.getReg(11) << endl; pass = false; }
+    
+    // Budget must be honoured exactly, even when it ends mid-block
+    CPU partial;
+    partial.setQuiet(true);
+    partial.loadRaw(fibonacciProgram());
+    if (partial.run(7) != StopReason::Budget || partial.getInstructionCount() != 7) {
+        cout << "   [FAIL] Budget: Expected 7 instructions, got " << partial.getInstructionCount() << endl;
+        pass = false;
+    }
+    
+    if (pass) cout << "   [PASS] Block engine matches single-step execution." << endl;
+    return pass;
+}
+
+// Test 6: Every execution engine produces the same architectural state
+bool runEngineTest() {
+    cout << "[TEST] Execution Engines (Threaded, JIT) vs Switch Interpreter" << endl;
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<vector<uint32_t>> programs = { fibonacciProgram(), aluLoopProgram(), selfModifyingProgram() };
+    
+    for (const auto& engine : engines) {
+        CPU probe;
+        if (!probe.setEngine(engine.first)) {
+            cout << "   [SKIP] " << engine.second << " engine unavailable on this host." << endl;
+            continue;
+        }
+        for (const auto& program : programs) {
+            CPU interp;
+            interp.setQuiet(true);
+            interp.loadRaw(program);
+            interp.run(100000);
+            
+            CPU cpu;
+            cpu.setQuiet(true);
+            cpu.setEngine(engine.first);
+            cpu.loadRaw(program);
+            cpu.run(100000);
+            
+            for (int r = 1; r < 32; r++) {
+                if (cpu.getReg(r) != interp.getReg(r)) {
+                    cout << "   [FAIL] " << engine.second << " x" << dec << r << ": 0x" << hex << cpu.getReg(r) << " != interpreter 0x" << interp.getReg(r) << endl;
+                    pass = false;
+                }
+            }
+            if (cpu.getInstructionCount() != interp.getInstructionCount()) {
+                cout << "   [FAIL] " << engine.second << " instruction count " << dec << cpu.getInstructionCount() << " != " << interp.getInstructionCount() << endl;
+                pass = false;
+            }
+            
+            // The JIT's code buffer is never writable and executable at once
+            FILE* maps = fopen("/proc/self/maps", "r");
+            char line[512];
+            while (maps && fgets(line, sizeof(line), maps)) {
+                char perms[5] = {};
+                if (sscanf(line, "%*s %4s", perms) == 1 && perms[1] == 'w' && perms[2] == 'x') {
+                    cout << "   [FAIL] " << engine.second << " left a writable, executable mapping: " << line;
+                    pass = false;
+                }
+            }
+            if (maps) fclose(maps);
+        }
+    }
+    
+    
+    if (pass) cout << "   [PASS] All engines match the switch interpreter." << endl;
+    return pass;
+}
+
+// Test 7: Binary trace records every retired instruction
+bool runBinaryTraceTest() {
+    cout << "[TEST] Binary Execution Trace (Ring Buffer)" << endl;
+    
+    const char* path = "test_trace.bin";
+    CPU cpu;
+    cpu.setQuiet(true);
+    cpu.loadRaw(fibonacciProgram());
+    
+    TraceWriter tracer(4); // Tiny 16-entry ring to exercise wrap-around and back-pressure
+    if (!tracer.open(path)) {
+        cout << "   [FAIL] Cannot create " << path << endl;
+        return false;
+    }
+    cpu.setTraceWriter(&tracer);
+    cpu.run(1000);
+    tracer.close();
+    
+    bool pass = true;
+    FILE* file = fopen(path, "rb");
+    TraceFileHeader header;
+    vector<TraceRecord> records(cpu.getInstructionCount() + 1);
+    size_t n = 0;
+    if (!file || fread(&header, sizeof(header), 1, file) != 1) {
+        cout << "   [FAIL] Missing trace header" << endl;
+        pass = false;
+    } else {
+        n = fread(records.data(), sizeof(TraceRecord), records.size(), file);
+    }
+    if (file) fclose(file);
+    remove(path);
+    
+    if (pass && n != cpu.getInstructionCount()) {
+        cout << "   [FAIL] Expected " << cpu.getInstructionCount() << " records, got " << n << endl;
+        pass = false;
+    }
+    // First record: ADDI x10, x0, 10 at PC 0 writes 10
+    if (pass && (records[0].pc != 0 || records[0].inst != 0x00a00513 || records[0].value != 10)) {
+        cout << "   [FAIL] First record mismatch" << endl;
+        pass = false;
+    }
+    // Last record: the exit ECALL with a7 = 10
+    if (pass && (records[n - 1].inst != 0x00000073 || records[n - 1].value != 10)) {
+        cout << "   [FAIL] Last record mismatch" << endl;
+        pass = false;
+    }
+    
+    
+    // Linux syscalls dump as the same SYSCALL lines the console trace prints
+    vector<uint32_t> linux_calls = {
+        0x3e700893, // addi x17, x0, 999
+        0x00000073, // ecall   -> -ENOSYS
+        0x05d00893, // addi x17, x0, 93
+        0x00300513, // addi x10, x0, 3
+        0x00000073  // ecall   exit
+    };
+    CPU console_cpu;
+    ostringstream console;
+    streambuf* saved = cout.rdbuf(console.rdbuf());
+    console_cpu.loadRaw(linux_calls);
+    console_cpu.run();
+    cout.rdbuf(saved);
+    string expected, dumped;
+    istringstream lines(console.str());
+    for (string line; getline(lines, line);) {
+        if (line.rfind("SYSCALL:", 0) == 0) expected += line + '\n';
+    }
+    
+    CPU traced;
+    traced.setQuiet(true);
+    traced.loadRaw(linux_calls);
+    TraceWriter linux_tracer;
+    if (linux_tracer.open(path)) {
+        traced.setTraceWriter(&linux_tracer);
+        traced.run();
+        linux_tracer.close();
+    }
+    file = fopen(path, "rb");
+    TraceRecord r;
+    if (file && fread(&header, sizeof(header), 1, file) == 1) {
+        ostringstream text;
+        while (fread(&r, sizeof(r), 1, file) == 1) formatExec(text, decode(r.inst), r.value, r.addr);
+        istringstream dump(text.str());
+        for (string line; getline(dump, line);) {
+            if (line.rfind("SYSCALL:", 0) == 0) dumped += line + '\n';
+        }
+    }
+    if (file) fclose(file);
+    remove(path);
+    if (expected != "SYSCALL: unknown -> -38\nSYSCALL: EXIT\n" || dumped != expected) {
+        cout << "   [FAIL] Syscall lines: console '" << expected << "', dumped '" << dumped << "'" << endl;
+        pass = false;
+    }
+    
+    if (pass) cout << "   [PASS] " << dec << n << " records round-tripped." << endl;
+    return pass;
+}
+
+// Test 8: run() reports why it stopped, and an unlimited budget runs to exit
+bool runStopReasonTest() {
+    cout << "[TEST] Stop Reasons & Unlimited Budget" << endl;
+    
+    // 20480-iteration countdown: well past the old 10000-instruction cap
+    vector<uint32_t> longLoop = {
+        0x00000293, // addi x5, x0, 0
+        0x00005337, // lui x6, 5
+        0x00128293, // loop: addi x5, x5, 1
+        0xfe629ee3, // bne x5, x6, loop
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall (exit)
+    };
+    vector<uint32_t> loadFault = {
+        0xfffff2b7, // lui x5, 0xfffff
+        0x0002a303  // lw x6, 0(x5) -> out of bounds
+    };
+    vector<uint32_t> illegal = { 0x00000013, 0xffffffff }; // nop, unknown opcode
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    for (const auto& engine : engines) {
+        CPU cpu;
+        cpu.setQuiet(true);
+        if (!cpu.setEngine(engine.first)) continue;
+        
+        cpu.loadRaw(longLoop);
+        StopReason first = cpu.run(10000);
+        StopReason rest = cpu.run(CPU::RUN_UNLIMITED);
+        if (first != StopReason::Budget || rest != StopReason::Exit || cpu.getReg(5) != 20480 ||
+            cpu.getInstructionCount() != 2 + 2 * 20480 + 2) {
+            cout << "   [FAIL] " << engine.second << ": budget/exit, " << stopReasonName(first) << " then "
+                 << stopReasonName(rest) << " after " << dec << cpu.getInstructionCount() << " instructions" << endl;
+            pass = false;
+        }
+        
+        cpu.loadRaw(loadFault);
+        if (cpu.run() != StopReason::Fault) {
+            cout << "   [FAIL] " << engine.second << ": expected Memory fault, got " << stopReasonName(cpu.getStopReason()) << endl;
+            pass = false;
+        }
+        
+        cpu.loadRaw(illegal);
+        if (cpu.run() != StopReason::Illegal) {
+            cout << "   [FAIL] " << engine.second << ": expected Illegal instruction, got " << stopReasonName(cpu.getStopReason()) << endl;
+            pass = false;
+        }
+    }
+    
+    CPU halted;
+    halted.setQuiet(true);
+    halted.loadRaw({ 0x00000013 }); // nop, then zeroed memory
+    if (halted.run() != StopReason::Halt) {
+        cout << "   [FAIL] Expected Null instruction, got " << stopReasonName(halted.getStopReason()) << endl;
+        pass = false;
+    }
+    
+    if (pass) cout << "   [PASS] Exit, fault, illegal, halt and budget stops reported." << endl;
+    return pass;
+}
+
+// Test 9: Sparse paged memory, software TLB and code pages
+bool runSparseMemoryTest() {
+    cout << "[TEST] Sparse Paged Memory (4 GiB, Software TLB)" << endl;
+    
+    // Touches the top and bottom of the address space with aligned and
+    // page-crossing accesses
+    vector<uint32_t> farAccess = {
+        0xfffff2b7, // lui x5, 0xfffff
+        0x12300313, // addi x6, x0, 0x123
+        0x0062a223, // sw x6, 4(x5)      -> 0xfffff004
+        0x0042a383, // lw x7, 4(x5)
+        0x123454b7, // lui x9, 0x12345
+        0x67848493, // addi x9, x9, 0x678
+        0x00001437, // lui x8, 1
+        0xfe942f23, // sw x9, -2(x8)     -> 0xffe, crosses into page 1
+        0xffe42503, // lw x10, -2(x8)
+        0xfff41583, // lh x11, -1(x8)
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    
+    // A store fills the store TLB for page 1 before any code there is
+    // decoded; once func has run, rewriting it must still be seen
+    vector<uint32_t> codePage(0x1008 / 4, 0x00000013);
+    uint32_t caller[] = {
+        0x000012b7, // lui x5, 1
+        0x0002a423, // sw x0, 8(x5)      -> data word next to func
+        0x7f9000ef, // jal x1, func
+        0x00200337, // lui x6, 0x200
+        0x51330313, // addi x6, x6, 0x513 (x6 = addi x10, x0, 2)
+        0x0062a023, // sw x6, 0(x5)      -> patch func
+        0x7e9000ef, // jal x1, func
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    copy(begin(caller), end(caller), codePage.begin());
+    codePage[0x1000 / 4] = 0x00100513;   // func: addi x10, x0, 1
+    codePage[0x1004 / 4] = 0x00008067;   //       jalr x0, 0(x1)
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    for (const auto& engine : engines) {
+        CPU cpu;
+        cpu.setQuiet(true);
+        if (!cpu.setEngine(engine.first)) continue;
+        cpu.setMemorySize(1ull << 32);
+        
+        cpu.loadRaw(farAccess);
+        StopReason reason = cpu.run();
+        if (reason != StopReason::Exit || cpu.getReg(7) != 0x123 || cpu.getReg(10) != 0x12345678 || cpu.getReg(11) != 0x3456) {
+            cout << "   [FAIL] " << engine.second << ": far/crossing access got x7=0x" << hex << cpu.getReg(7)
+                 << " x10=0x" << cpu.getReg(10) << " x11=0x" << cpu.getReg(11) << " (" << stopReasonName(reason) << ")" << endl;
+            pass = false;
+        }
+        if (cpu.getPagesTouched() != 3) {
+            cout << "   [FAIL] " << engine.second << ": expected 3 pages touched, got " << dec << cpu.getPagesTouched() << endl;
+            pass = false;
+        }
+        
+        cpu.loadRaw(codePage);
+        cpu.run();
+        if (cpu.getReg(10) != 2) {
+            cout << "   [FAIL] " << engine.second << ": patched function returned " << dec << cpu.getReg(10) << ", expected 2" << endl;
+            pass = false;
+        }
+    }
+    
+    CPU stepped;
+    stepped.setQuiet(true);
+    stepped.loadRaw(codePage);
+    while(stepped.executeNext());
+    if (stepped.getReg(10) != 2) {
+        cout << "   [FAIL] Step: patched function returned " << dec << stepped.getReg(10) << ", expected 2" << endl;
+        pass = false;
+    }
+    
+    if (pass) cout << "   [PASS] Sparse memory and TLB behave like flat memory." << endl;
+    return pass;
+}
+
+// Test 10: The mmap-reserved backend (guard pages, SIGSEGV -> guest fault)
+// behaves exactly like the bounds-checked paged backend
+bool runReservedMemoryTest() {
+    cout << "[TEST] Reserved Memory Backend (Guard Pages)" << endl;
+    
+    CPU probe;
+    if (!probe.setMemoryBackend(MemoryBackend::Reserved)) {
+        cout << "   [SKIP] Reserved memory unavailable on this host." << endl;
+        return true;
+    }
+    
+    vector<uint32_t> storeFault = {
+        0x004002b7, // lui x5, 0x400     (x5 = 4 MB, one past the end)
+        0x00700313, // addi x6, x0, 7
+        0xfe62ae23, // sw x6, -4(x5)     last word: fine
+        0xffc2a383, // lw x7, -4(x5)
+        0x0002a023  // sw x0, 0(x5)      -> fault
+    };
+    vector<uint32_t> straddleTop = {
+        0xffe00293, // addi x5, x0, -2
+        0x0002a303  // lw x6, 0(x5)      -> crosses 2^32 into the guard page
+    };
+    struct Case { vector<uint32_t> program; uint64_t memory; };
+    vector<Case> cases = {
+        { fibonacciProgram(), 4 << 20 },
+        { aluLoopProgram(), 4 << 20 },
+        { selfModifyingProgram(), 4 << 20 },
+        { storeFault, 4 << 20 },
+        { straddleTop, 1ull << 32 }
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    for (size_t i = 0; i < cases.size(); i++) {
+        CPU reference;
+        reference.setQuiet(true);
+        reference.setMemorySize(cases[i].memory);
+        reference.loadRaw(cases[i].program);
+        StopReason expected = reference.run(100000);
+        
+        for (const auto& engine : engines) {
+            for (int stepped = 0; stepped < 2; stepped++) {
+                CPU cpu;
+                cpu.setQuiet(true);
+                if (!cpu.setEngine(engine.first)) continue;
+                cpu.setMemorySize(cases[i].memory);
+                cpu.setMemoryBackend(MemoryBackend::Reserved);
+                cpu.loadRaw(cases[i].program);
+                StopReason reason;
+                if (stepped) {
+                    while(cpu.executeNext());
+                    reason = cpu.getStopReason();
+                } else {
+                    reason = cpu.run(100000);
+                }
+                bool same = reason == expected && cpu.getInstructionCount() == reference.getInstructionCount();
+                for (int r = 0; r < 32; r++) same = same && cpu.getReg(r) == reference.getReg(r);
+                if (!same) {
+                    cout << "   [FAIL] Program " << i << " on " << engine.second << (stepped ? " (stepped)" : "") << ": "
+                         << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount() << " instructions, expected "
+                         << stopReasonName(expected) << " after " << reference.getInstructionCount() << endl;
+                    pass = false;
+                }
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Reserved backend matches the paged backend, faults included." << endl;
+    return pass;
+}
+
+// Test 11: Misaligned loads and stores complete by default and stop the
+// program under MisalignedAccess::Trap, on every engine and backend
+bool runMisalignedAccessTest() {
+    cout << "[TEST] Misaligned Access (Allow vs Trap)" << endl;
+    
+    vector<uint32_t> program = {
+        0x000012b7, // lui x5, 1
+        0x12345337, // lui x6, 0x12345
+        0x67830313, // addi x6, x6, 0x678
+        0x0062a023, // sw x6, 0(x5)      aligned
+        0x0002a503, // lw x10, 0(x5)
+        0x0062a123, // sw x6, 2(x5)      misaligned
+        0x0022a383, // lw x7, 2(x5)
+        0x00329403, // lh x8, 3(x5)
+        0x0012d483, // lhu x9, 1(x5)
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            for (int trap = 0; trap < 2; trap++) {
+                CPU cpu;
+                cpu.setQuiet(true);
+                if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+                if (trap) cpu.setMisalignedAccess(MisalignedAccess::Trap);
+                cpu.loadRaw(program);
+                StopReason reason = cpu.run();
+                string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+                if (trap) {
+                    if (reason != StopReason::Misaligned || cpu.getReg(10) != 0x12345678 || cpu.getReg(7) != 0 ||
+                        cpu.getInstructionCount() != 6) {   // The trapping store counts, like an OOB fault
+                        cout << "   [FAIL] " << name << ": trap mode got " << stopReasonName(reason) << " after "
+                             << dec << cpu.getInstructionCount() << " instructions" << endl;
+                        pass = false;
+                    }
+                } else if (reason != StopReason::Exit || cpu.getReg(7) != 0x12345678 || cpu.getReg(8) != 0x3456 ||
+                           cpu.getReg(9) != 0x7856) {
+                    cout << "   [FAIL] " << name << ": allow mode got x7=0x" << hex << cpu.getReg(7) << " x8=0x"
+                         << cpu.getReg(8) << " x9=0x" << cpu.getReg(9) << " (" << stopReasonName(reason) << ")" << endl;
+                    pass = false;
+                }
+            }
+        }
+    }
+    
+    CPU stepped;
+    stepped.setQuiet(true);
+    stepped.setMisalignedAccess(MisalignedAccess::Trap);
+    stepped.loadRaw(program);
+    while(stepped.executeNext());
+    if (stepped.getStopReason() != StopReason::Misaligned || stepped.getInstructionCount() != 6) {
+        cout << "   [FAIL] Step: trap mode got " << stopReasonName(stepped.getStopReason()) << endl;
+        pass = false;
+    }
+    
+    if (pass) cout << "   [PASS] Misaligned accesses allowed or trapped as configured." << endl;
+    return pass;
+}
+
+// Minimal RV32 ELF writer for loader tests: one PT_LOAD per segment, each at
+// a file offset congruent to its address
+struct TestSegment {
+    uint32_t addr;
+    vector<uint8_t> bytes;
+    uint32_t mem_size;
+};
+
+static void putLE(vector<uint8_t>& image, size_t offset, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) image[offset + i] = (uint8_t)(value >> (8 * i));
+}
+
+static vector<uint8_t> wordBytes(const vector<uint32_t>& words) {
+    vector<uint8_t> bytes(words.size() * 4);
+    for (size_t i = 0; i < words.size(); i++) putLE(bytes, 4 * i, words[i], 4);
+    return bytes;
+}
+
+static bool writeTestElf(const char* path, uint32_t entry, const vector<TestSegment>& segments) {
+    vector<uint8_t> image(0x1000, 0);
+    const char ident[] = { 0x7f, 'E', 'L', 'F', 1 /* ELFCLASS32 */, 1 /* ELFDATA2LSB */, 1 };
+    copy(begin(ident), end(ident), image.begin());
+    putLE(image, 16, 2, 2);         // e_type = ET_EXEC
+    putLE(image, 18, 243, 2);       // e_machine = EM_RISCV
+    putLE(image, 20, 1, 4);         // e_version
+    putLE(image, 24, entry, 4);     // e_entry
+    putLE(image, 28, 52, 4);        // e_phoff
+    putLE(image, 40, 52, 2);        // e_ehsize
+    putLE(image, 42, 32, 2);        // e_phentsize
+    putLE(image, 44, (uint32_t)segments.size(), 2);
+    for (size_t i = 0; i < segments.size(); i++) {
+        const TestSegment& seg = segments[i];
+        size_t offset = ((image.size() + 0xFFF) & ~(size_t)0xFFF) + (seg.addr & 0xFFF);
+        size_t ph = 52 + 32 * i;
+        putLE(image, ph, 1, 4);     // PT_LOAD
+        putLE(image, ph + 4, (uint32_t)offset, 4);
+        putLE(image, ph + 8, seg.addr, 4);
+        putLE(image, ph + 12, seg.addr, 4);
+        putLE(image, ph + 16, (uint32_t)seg.bytes.size(), 4);
+        putLE(image, ph + 20, seg.mem_size, 4);
+        putLE(image, ph + 24, 7, 4); // RWX
+        putLE(image, ph + 28, 0x1000, 4);
+        image.resize(offset);
+        image.insert(image.end(), seg.bytes.begin(), seg.bytes.end());
+    }
+    FILE* out = fopen(path, "wb");
+    if (!out) return false;
+    bool ok = fwrite(image.data(), 1, image.size(), out) == image.size();
+    return (fclose(out) == 0) && ok;
+}
+
+// Loads data at 0x12000 (aliased page), 0x13004 (copied tail) and .bss
+static vector<uint8_t> zeroCopyTestText() {
+    vector<uint32_t> text = {
+        0x000122b7, // lui x5, 0x12
+        0x0002a303, // lw x6, 0(x5)      aliased data page
+        0x00130313, // addi x6, x6, 1
+        0x0062a023, // sw x6, 0(x5)      -> private copy
+        0x0002a383, // lw x7, 0(x5)
+        0x000134b7, // lui x9, 0x13
+        0x0044a403, // lw x8, 4(x9)      copied partial page
+        0x0084a503, // lw x10, 8(x9)     .bss
+        0x000155b7, // lui x11, 0x15
+        0xffc5a603, // lw x12, -4(x11)   last .bss word
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    text.resize(0x1000 / 4, 0x00000013); // One whole page of text
+    return wordBytes(text);
+}
+
+static bool writeZeroCopyTestElf(const char* path) {
+    // Data: a whole page plus 8 bytes at 0x12000, then .bss up to 0x15000
+    vector<uint8_t> data(0x1008, 0);
+    putLE(data, 0, 0x11111111, 4);
+    putLE(data, 0x1000, 0x22222222, 4);
+    putLE(data, 0x1004, 0x33333333, 4);
+    return writeTestElf(path, 0x10000, { {0x10000, zeroCopyTestText(), 0x1000}, {0x12000, data, 0x3000} });
+}
+
+static bool zeroCopyTestResult(const CPU& cpu) {
+    return cpu.getStopReason() == StopReason::Exit && cpu.getReg(6) == 0x11111112 && cpu.getReg(7) == 0x11111112 &&
+           cpu.getReg(8) == 0x33333333 && cpu.getReg(10) == 0 && cpu.getReg(12) == 0;
+}
+
+// Test 12: Zero-copy ELF loading. Whole pages of PT_LOAD segments alias the
+// mapped file copy-on-write; partial pages are copied and .bss reads as zero.
+bool runZeroCopyElfTest() {
+    cout << "[TEST] Zero-Copy ELF Loading (mmap, Copy-on-Write)" << endl;
+    
+    const char* path = "zero_copy_test.elf";
+    if (!writeZeroCopyTestElf(path)) {
+        cout << "   [FAIL] Cannot write " << path << endl;
+        return false;
+    }
+    
+    bool pass = true;
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        CPU cpu;
+        cpu.setQuiet(true);
+        if (!cpu.setMemoryBackend(backend)) continue;
+        string name = backend == MemoryBackend::Reserved ? "Reserved" : "Paged";
+        for (int load = 0; load < 2; load++) { // The second load must not see the first run's store
+            if (!cpu.loadELF(path)) {
+                cout << "   [FAIL] " << name << ": loadELF failed" << endl;
+                pass = false;
+                break;
+            }
+            StopReason reason = cpu.run();
+            if (!zeroCopyTestResult(cpu)) {
+                cout << "   [FAIL] " << name << " load " << load << ": x7=0x" << hex << cpu.getReg(7) << " x8=0x"
+                     << cpu.getReg(8) << " x10=0x" << cpu.getReg(10) << " x12=0x" << cpu.getReg(12)
+                     << " (" << stopReasonName(reason) << ")" << endl;
+                pass = false;
+            }
+        }
+    }
+    
+    // Guest stores stay private to the process
+    FILE* in = fopen(path, "rb");
+    uint8_t word[4] = {0, 0, 0, 0};
+    if (in) {
+        fseek(in, 0x2000, SEEK_SET);
+        if (fread(word, 1, 4, in) != 4) word[0] = 0;
+        fclose(in);
+    }
+    if (word[0] != 0x11 || word[3] != 0x11) {
+        cout << "   [FAIL] Guest store reached the ELF file on disk" << endl;
+        pass = false;
+    }
+    remove(path);
+    
+    if (pass) cout << "   [PASS] Segments mapped copy-on-write, .bss zeroed, file untouched." << endl;
+    return pass;
+}
+
+// Test 13: Persistent decode cache. A cold run writes "<elf>.dcache", a warm
+// load maps it and runs without decoding; code the guest rewrote is not
+// cached, and a changed ELF invalidates the cache.
+bool runDecodeCacheTest() {
+    cout << "[TEST] Persistent Decode Cache (Sidecar File)" << endl;
+    
+    const char* path = "decode_cache_test.elf";
+    string cache = string(path) + ".dcache";
+    remove(cache.c_str());
+    
+    // Patches func between two calls: x11 must see the original encoding
+    vector<uint32_t> smc = {
+        0x000102b7, // lui x5, 0x10
+        0x020000ef, // jal x1, func
+        0x00050593, // addi x11, x10, 0
+        0x00200337, // lui x6, 0x200
+        0x51330313, // addi x6, x6, 0x513 (x6 = addi x10, x0, 2)
+        0x0262a223, // sw x6, 36(x5)     -> patch func
+        0x00c000ef, // jal x1, func
+        0x00a00893, // addi x17, x0, 10
+        0x00000073, // ecall
+        0x00100513, // func: addi x10, x0, 1
+        0x00008067  //       jalr x0, 0(x1)
+    };
+    
+    bool pass = true;
+    auto fail = [&](const string& what) {
+        cout << "   [FAIL] " << what << endl;
+        pass = false;
+    };
+    
+    if (!writeZeroCopyTestElf(path)) fail("Cannot write test ELF");
+    CPU cold;
+    cold.setQuiet(true);
+    cold.setDecodeCache(true);
+    cold.loadELF(path);
+    cold.run();
+    if (cold.decodeCacheLoaded() || !zeroCopyTestResult(cold)) fail("Cold run");
+    if (!cold.saveDecodeCache()) fail("Cache not written");
+    
+    CPU warm;
+    warm.setQuiet(true);
+    warm.setDecodeCache(true);
+    warm.loadELF(path);
+    warm.run();
+    if (!warm.decodeCacheLoaded() || !zeroCopyTestResult(warm) || warm.getDecodeCount() != 0) {
+        fail("Warm run decoded " + to_string(warm.getDecodeCount()) + " instructions, expected 0");
+    }
+    
+    // Same path, new contents: the old cache no longer matches
+    if (!writeTestElf(path, 0x10000, { {0x10000, wordBytes(smc), 0x1000} })) fail("Cannot write test ELF");
+    CPU smcCold;
+    smcCold.setQuiet(true);
+    smcCold.setDecodeCache(true);
+    smcCold.loadELF(path);
+    smcCold.run();
+    if (smcCold.decodeCacheLoaded()) fail("Stale cache loaded for a changed ELF");
+    if (!smcCold.saveDecodeCache()) fail("Cache not written for the self-modifying ELF");
+    
+    CPU smcWarm;
+    smcWarm.setQuiet(true);
+    smcWarm.setDecodeCache(true);
+    smcWarm.loadELF(path);
+    smcWarm.run();
+    if (!smcWarm.decodeCacheLoaded() || smcWarm.getReg(11) != 1 || smcWarm.getReg(10) != 2 ||
+        smcWarm.getDecodeCount() >= smcCold.getDecodeCount()) {
+        fail("Self-modifying warm run: x11=" + to_string(smcWarm.getReg(11)) + " x10=" + to_string(smcWarm.getReg(10)) +
+             ", decoded " + to_string(smcWarm.getDecodeCount()));
+    }
+    
+    // A slot naming an unknown op or register rejects the whole cache, and
+    // the program is decoded as usual
+    for (int field = 0; field < 2; field++) {
+        FILE* f = fopen(cache.c_str(), "r+b");
+        DecodeCacheHeader header = {};
+        if (!f || fread(&header, sizeof(header), 1, f) != 1) fail("Cannot read the cache");
+        long at = (long)((sizeof(header) + 4 * ((size_t)header.page_count + header.block_count) + 63) & ~(size_t)63);
+        DecodedInst slot;
+        while (f && fseek(f, at, SEEK_SET) == 0 && fread(&slot, sizeof(slot), 1, f) == 1 && slot.op == Op::NONE) at += sizeof(slot);
+        if (field == 0) slot.op = (Op)0xFF;
+        else slot.rd = 40;
+        if (f) {
+            fseek(f, at, SEEK_SET);
+            fwrite(&slot, sizeof(slot), 1, f);
+            fclose(f);
+        }
+        CPU corrupt;
+        corrupt.setQuiet(true);
+        corrupt.setDecodeCache(true);
+        corrupt.loadELF(path);
+        corrupt.run();
+        if (corrupt.decodeCacheLoaded() || corrupt.getReg(11) != 1 || corrupt.getReg(10) != 2) {
+            fail(string("Cache with a bad ") + (field == 0 ? "op" : "register") + " was loaded");
+        }
+        if (field == 0 && !corrupt.saveDecodeCache()) fail("Cache not rewritten after a corrupt one");
+    }
+    
+    remove(path);
+    remove(cache.c_str());
+    if (pass) cout << "   [PASS] Warm load skips decoding; rewritten code and stale caches are rejected." << endl;
+    return pass;
+}
+
+// Test 14: Snapshot and restore. Each run starts from the snapshot with a
+// new input; only the pages a run wrote are copied back, code included.
+bool runSnapshotRestoreTest() {
+    cout << "[TEST] Snapshot & Restore (Dirty Page Tracking)" << endl;
+    
+    vector<uint32_t> program = {
+        0x000022b7, // lui x5, 2
+        0x0002a303, // lw x6, 0(x5)      input
+        0x06430393, // addi x7, x6, 100
+        0x0072a223, // sw x7, 4(x5)
+        0x00005437, // lui x8, 5
+        0x00742023, // sw x7, 0(x8)      page that starts out unallocated
+        0x020000ef, // jal x1, func
+        0x00050593, // addi x11, x10, 0
+        0x00200637, // lui x12, 0x200
+        0x51360613, // addi x12, x12, 0x513 (x12 = addi x10, x0, 2)
+        0x02c02c23, // sw x12, 56(x0)    -> patch func
+        0x00c000ef, // jal x1, func
+        0x00a00893, // addi x17, x0, 10
+        0x00000073, // ecall
+        0x00100513, // func: addi x10, x0, 1
+        0x00008067  //       jalr x0, 0(x1)
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            cpu.loadRaw(program);
+            shared_ptr<Snapshot> snap = cpu.snapshot();
+            
+            for (uint32_t input = 1; input <= 3; input++) {
+                if (input > 1 && !cpu.restore(snap)) {
+                    cout << "   [FAIL] " << name << ": restore rejected" << endl;
+                    pass = false;
+                }
+                cpu.writeMemory(0x2000, &input, 4);
+                StopReason reason = cpu.run();
+                uint32_t stored = 0;
+                cpu.readMemory(0x5000, &stored, 4);
+                // Dirty: code page (patch), input page, page 5
+                if (reason != StopReason::Exit || cpu.getReg(7) != input + 100 || stored != input + 100 ||
+                    cpu.getReg(11) != 1 || cpu.getReg(10) != 2 || cpu.getDirtyPageCount() != 3 ||
+                    cpu.getInstructionCount() != 18) {
+                    cout << "   [FAIL] " << name << " input " << input << ": x7=" << dec << cpu.getReg(7) << " x11="
+                         << cpu.getReg(11) << " dirty=" << cpu.getDirtyPageCount() << " count=" << cpu.getInstructionCount()
+                         << " (" << stopReasonName(reason) << ")" << endl;
+                    pass = false;
+                }
+            }
+            
+            cpu.restore(snap);
+            uint32_t input = 1, stored = 1;
+            cpu.readMemory(0x2000, &input, 4);
+            cpu.readMemory(0x5000, &stored, 4);
+            if (input != 0 || stored != 0 || cpu.getReg(7) != 0 || cpu.getInstructionCount() != 0 || cpu.getDirtyPageCount() != 0) {
+                cout << "   [FAIL] " << name << ": state not restored" << endl;
+                pass = false;
+            }
+            shared_ptr<Snapshot> newer = cpu.snapshot();
+            if (cpu.restore(snap) || !cpu.restore(newer)) {
+                cout << "   [FAIL] " << name << ": only the latest snapshot may be restored" << endl;
+                pass = false;
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Restores copy back written pages only, on every engine and backend." << endl;
+    return pass;
+}
+
+// Test 15: The run server. Requests over a socket each restore the start
+// snapshot, receive their input in a0/a1 and get back exit code and output.
+bool runServerTest() {
+    cout << "[TEST] Run Server (Snapshot per Request)" << endl;
+#if RISCV_SERVER_AVAILABLE
+    vector<uint32_t> program = {
+        0x00000613, // addi x12, x0, 0
+        0x00058c63, // loop: beq x11, x0, done
+        0x00054683, // lbu x13, 0(x10)
+        0x00d60633, // add x12, x12, x13
+        0x00150513, // addi x10, x10, 1
+        0xfff58593, // addi x11, x11, -1
+        0xfedff06f, // jal x0, loop
+        0x00060513, // done: addi x10, x12, 0
+        0x00100893, // addi x17, x0, 1   print sum
+        0x00000073, // ecall
+        0x00a00893, // addi x17, x0, 10  exit(sum)
+        0x00000073  // ecall
+    };
+    
+    CPU cpu;
+    cpu.setQuiet(true);
+    cpu.loadRaw(program);
+    ServerOptions options;
+    options.input_addr = 0x8000;
+    shared_ptr<Snapshot> start = cpu.snapshot();
+    
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        cout << "   [FAIL] socketpair failed" << endl;
+        return false;
+    }
+    string oversized(cpu.getMemorySize() - options.input_addr + 1, 'x');
+    thread server([&] { serveConnection(cpu, start, options, fds[1], fds[1]); });
+    
+    // Each input sums its bytes from a fresh start: nothing leaks between requests
+    vector<string> inputs = { "abc", "", string(2, '\xff'), "abc" };
+    vector<int32_t> sums = { 294, 0, 510, 294 };
+    bool pass = true;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        ServerResponse response;
+        uint64_t expected_count = 7 + 6 * inputs[i].size();
+        if (!requestRun(fds[0], inputs[i], response) || response.stop_reason != StopReason::Exit ||
+            response.exit_code != sums[i] || response.output != to_string(sums[i]) ||
+            response.instructions != expected_count) {
+            cout << "   [FAIL] Request " << i << ": exit=" << dec << response.exit_code << " output='" << response.output
+                 << "' count=" << response.instructions << " (" << stopReasonName(response.stop_reason) << ")" << endl;
+            pass = false;
+        }
+    }
+    
+    // An input too big for guest memory is dropped and answered with a
+    // fault, and the connection stays in step for the next request
+    ServerResponse dropped, after;
+    if (!requestRun(fds[0], oversized, dropped) || dropped.stop_reason != StopReason::Fault || dropped.instructions != 0 ||
+        !requestRun(fds[0], "abc", after) || after.exit_code != 294) {
+        cout << "   [FAIL] Oversized input: " << stopReasonName(dropped.stop_reason) << ", next exit=" << dec << after.exit_code << endl;
+        pass = false;
+    }
+    close(fds[0]);
+    server.join();
+    close(fds[1]);
+    
+    // A client that hangs up without reading its response must not take the
+    // socket server down, and one that stalls mid-request is dropped after
+    // the client timeout: the next client is still served
+    const char* socket_path = "server_test.sock";
+    remove(socket_path);
+    options.client_timeout_ms = 200;
+    cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        serveSocket(cpu, start, options, socket_path);
+        _exit(1);
+    }
+    int first = -1;
+    for (int tries = 0; tries < 500 && first < 0; tries++) {
+        first = connectServer(socket_path);
+        if (first < 0) usleep(10000);
+    }
+    uint8_t empty_request[4] = {};
+    bool sent = first >= 0 && write(first, empty_request, 4) == 4;
+    if (first >= 0) close(first);
+    int stalled = connectServer(socket_path);
+    bool stalled_sent = stalled >= 0 && write(stalled, empty_request, 2) == 2;    // Half a length, then nothing
+    int second = connectServer(socket_path);
+    timeval patience = { 5, 0 };    // The test fails rather than hangs if the stalled client is never dropped
+    if (second >= 0) setsockopt(second, SOL_SOCKET, SO_RCVTIMEO, &patience, sizeof(patience));
+    ServerResponse served;
+    bool ok = sent && stalled_sent && second >= 0 && requestRun(second, "abc", served) && served.exit_code == 294;
+    if (second >= 0) close(second);
+    if (stalled >= 0) close(stalled);
+    int status = 0;
+    bool alive = child > 0 && waitpid(child, &status, WNOHANG) == 0;
+    if (child > 0) {
+        kill(child, SIGKILL);
+        waitpid(child, &status, 0);
+    }
+    remove(socket_path);
+    if (!ok || !alive) {
+        cout << "   [FAIL] Server did not survive a client hanging up or stalling" << (alive ? "" : " (server exited)") << endl;
+        pass = false;
+    }
+    
+    if (pass) cout << "   [PASS] Every request starts from the snapshot and returns its own output." << endl;
+    return pass;
+#else
+    cout << "   [SKIP] Run server unavailable on this host." << endl;
+    return true;
+#endif
+}
+
+// Test 16: Batch runner. Jobs from two ELFs run on a work-stealing pool with
+// guest arguments; every job reports once with its own output, and the
+// decode caches the first batch writes make the second batch start warm.
+bool runBatchTest() {
+    cout << "[TEST] Parallel Batch Runner (Work Stealing, Shared Decode Cache)" << endl;
+    
+    bool pass = true;
+    vector<atomic<int>> runs(1000);
+    runWorkStealing(runs.size(), 4, [&](size_t i) {
+        if (i % 7 == 0) this_thread::yield(); // Uneven tasks, so workers run dry and steal
+        runs[i]++;
+    });
+    if (any_of(runs.begin(), runs.end(), [](const atomic<int>& n) { return n != 1; })) {
+        cout << "   [FAIL] Work stealing ran a task more or less than once" << endl;
+        pass = false;
+    }
+    
+    vector<uint32_t> program = {
+        0x00050a13, // addi x20, x10, 0  argc
+        0x0045a503, // lw x10, 4(x11)    argv[1]
+        0x00400893, // addi x17, x0, 4   print it
+        0x00000073, // ecall
+        0x000a0513, // addi x10, x20, 0
+        0x00a00893, // addi x17, x0, 10  exit(argc)
+        0x00000073  // ecall
+    };
+    const char* paths[2] = { "batch_test_a.elf", "batch_test_b.elf" };
+    for (const char* path : paths) {
+        remove((string(path) + ".dcache").c_str());
+        if (!writeTestElf(path, 0x10000, { {0x10000, wordBytes(program), 0x1000} })) {
+            cout << "   [FAIL] Cannot write " << path << endl;
+            return false;
+        }
+    }
+    
+    vector<BatchJob> jobs;
+    for (size_t i = 0; i < 24; i++) {
+        BatchJob job;
+        job.elf = paths[i % 2];
+        job.budget = 100;
+        job.args.push_back("job" + to_string(i));
+        job.args.resize(1 + i % 3, "x");
+        jobs.push_back(job);
+    }
+    BatchOptions options;
+    options.threads = 4;
+    
+    for (int round = 0; round < 2; round++) {
+        vector<int> reported(jobs.size(), 0);
+        size_t warm = 0;
+        runBatch(jobs, options, [&](const BatchResult& r) {
+            reported[r.job]++;
+            warm += r.warm;
+            int32_t argc = 2 + r.job % 3;
+            if (!r.loaded || r.stop_reason != StopReason::Exit || r.exit_code != argc ||
+                r.output != "job" + to_string(r.job) || r.instructions != 7) {
+                cout << "   [FAIL] Round " << round << " job " << r.job << ": exit=" << r.exit_code << " output='"
+                     << r.output << "' count=" << r.instructions << endl;
+                pass = false;
+            }
+        });
+        if (count(reported.begin(), reported.end(), 1) != (long)jobs.size()) {
+            cout << "   [FAIL] Round " << round << ": not every job reported exactly once" << endl;
+            pass = false;
+        }
+        // Each ELF is predecoded once up front, so even the first batch runs warm
+        if (warm != jobs.size()) {
+            cout << "   [FAIL] Round " << round << ": only " << warm << " of " << jobs.size() << " jobs started warm" << endl;
+            pass = false;
+        }
+    }
+    
+    // Output that is not UTF-8 still makes a valid, plain ASCII JSON line
+    BatchJob binary;
+    binary.elf = paths[0];
+    binary.budget = 100;
+    binary.args = { "\xff\"\n" };
+    runBatch({ binary }, options, [&](const BatchResult& r) {
+        string json = resultJson(binary, r);
+        if (r.output != "\xff\"\n" || json.find("\"stdout\":\"\\u00ff\\\"\\n\"}") == string::npos ||
+            any_of(json.begin(), json.end(), [](char c) { return (unsigned char)c >= 0x80; })) {
+            cout << "   [FAIL] Byte 0xFF not escaped: " << json << endl;
+            pass = false;
+        }
+    });
+    
+    BatchJob missing;
+    missing.elf = "batch_test_missing.elf";
+    runBatch({ missing }, options, [&](const BatchResult& r) {
+        if (r.loaded || resultJson(missing, r) != "{\"job\":0,\"elf\":\"batch_test_missing.elf\",\"error\":\"cannot load ELF\"}") {
+            cout << "   [FAIL] Missing ELF not reported as a load error" << endl;
+            pass = false;
+        }
+    });
+    
+    for (const char* path : paths) {
+        remove(path);
+        remove((string(path) + ".dcache").c_str());
+    }
+    if (pass) cout << "   [PASS] Jobs run in parallel with their own arguments and share decode caches." << endl;
+    return pass;
+}
+
+// Test 17: Multi-hart SMP. Four harts share memory: each sums its own range
+// into a fresh page and hart 0 collects the results. Then one hart patches a
+// function another hart has already run; FENCE.I makes the reader see it.
+bool runSmpTest() {
+    cout << "[TEST] Multi-Hart SMP (Shared Memory, Quantum Barrier, FENCE.I)" << endl;
+    
+    vector<uint32_t> parallelSum = {
+        0x001002b7, // lui x5, 0x100
+        0x00c51313, // slli x6, x10, 12
+        0x006282b3, // add x5, x5, x6      own page: 0x100000 + hartid * 4 KiB
+        0x00a51e13, // slli x28, x10, 10
+        0x40000e93, // addi x29, x0, 1024
+        0x00000f13, // addi x30, x0, 0
+        0x001e0e13, // loop: addi x28, x28, 1
+        0x01cf0f33, // add x30, x30, x28
+        0xfffe8e93, // addi x29, x29, -1
+        0xfe0e9ae3, // bne x29, x0, loop
+        0x01e2a023, // sw x30, 0(x5)       result
+        0x0ff0000f, // fence
+        0x00100f93, // addi x31, x0, 1
+        0x01f2a223, // sw x31, 4(x5)       done flag
+        0x04051663, // bne x10, x0, park
+        0x00000413, // addi x8, x0, 0
+        0x00000493, // addi x9, x0, 0
+        0x00100937, // lui x18, 0x100
+        0x00492983, // wait: lw x19, 4(x18)
+        0xfe098ee3, // beq x19, x0, wait
+        0x0ff0000f, // fence
+        0x00092983, // lw x19, 0(x18)
+        0x01340433, // add x8, x8, x19
+        0x00148493, // addi x9, x9, 1
+        0x00001a37, // lui x20, 1
+        0x01490933, // add x18, x18, x20
+        0x00400a93, // addi x21, x0, 4
+        0xfd549ee3, // bne x9, x21, wait
+        0x00040513, // addi x10, x8, 0
+        0x00100893, // addi x17, x0, 1     print total
+        0x00000073, // ecall
+        0x00a00893, // addi x17, x0, 10
+        0x00000073, // ecall
+        0x00000000  // park: null instruction
+    };
+    vector<uint32_t> crossHartPatch = {
+        0x00100937, // lui x18, 0x100
+        0x04051263, // bne x10, x0, writer
+        0x068000ef, // jal x1, func        hart 0: func decoded, returns 1
+        0x00050993, // addi x19, x10, 0
+        0x00100293, // addi x5, x0, 1
+        0x00592023, // sw x5, 0(x18)       ready
+        0x00492283, // wait: lw x5, 4(x18)
+        0xfe028ee3, // beq x5, x0, wait
+        0x0000100f, // fence.i
+        0x04c000ef, // jal x1, func        must run the patched code: 2
+        0x00a00313, // addi x6, x0, 10
+        0x000003b3, // add x7, x0, x0
+        0x013383b3, // mul10: add x7, x7, x19
+        0xfff30313, // addi x6, x6, -1
+        0xfe031ce3, // bne x6, x0, mul10
+        0x00750533, // add x10, x10, x7    exit(first * 10 + second)
+        0x00a00893, // addi x17, x0, 10
+        0x00000073, // ecall
+        0x00092283, // writer: lw x5, 0(x18)
+        0xfe028ee3, // beq x5, x0, writer
+        0x00000317, // auipc x6, 0
+        0x002003b7, // lui x7, 0x200
+        0x51338393, // addi x7, x7, 0x513 (x7 = addi x10, x0, 2)
+        0x02732023, // sw x7, 32(x6)       -> patch func
+        0x0ff0000f, // fence
+        0x00100293, // addi x5, x0, 1
+        0x00592223, // sw x5, 4(x18)       patched
+        0x00000000, // null instruction
+        0x00100513, // func: addi x10, x0, 1
+        0x00008067  //       jalr x0, 0(x1)
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            Machine machine(4);
+            if (!machine.setEngine(engine.first) || !machine.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            machine.setQuantum(1000); // Many barriers while hart 0 spins
+            
+            machine.loadRaw(parallelSum);
+            bool stacks = true;
+            for (unsigned i = 0; i < 4; i++) stacks = stacks && machine.hart(i).getReg(2) == (4u << 20) - i * Machine::DEFAULT_STACK_SIZE;
+            StopReason reason = machine.run();
+            // sum(id * 1024 + k, k = 1..1024) over ids 0..3
+            bool parked = true;
+            for (unsigned i = 1; i < 4; i++) parked = parked && machine.hart(i).getStopReason() == StopReason::Halt;
+            string output = machine.takeOutput();
+            if (reason != StopReason::Exit || machine.getStopHart() != 0 || machine.hart(0).getReg(10) != 8390656 ||
+                output != "8390656" || !parked || !stacks) {
+                cout << "   [FAIL] " << name << " parallel sum: " << stopReasonName(reason) << " on hart " << machine.getStopHart()
+                     << ", x10=" << dec << machine.hart(0).getReg(10) << " output='" << output << "'" << endl;
+                pass = false;
+            }
+            
+            Machine pair(2);
+            pair.setEngine(engine.first);
+            pair.setMemoryBackend(backend);
+            pair.loadRaw(crossHartPatch);
+            reason = pair.run(1000000);
+            if (reason != StopReason::Exit || pair.hart(0).getReg(10) != 12 || pair.hart(1).getStopReason() != StopReason::Halt) {
+                cout << "   [FAIL] " << name << " cross-hart patch: " << stopReasonName(reason) << ", x10=" << dec
+                     << pair.hart(0).getReg(10) << " (12 expected)" << endl;
+                pass = false;
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Harts share memory, synchronise per quantum and see patched code after FENCE.I." << endl;
+    return pass;
+}
+
+// Test 18: RV32A atomics. AMO results and LR/SC reservations on one hart,
+// then four harts taking an LR/SC spinlock around a plain read-modify-write
+// while also bumping a shared AMOADD counter: no update may be lost.
+bool runAtomicsTest() {
+    cout << "[TEST] RV32A Atomics (AMOs, LR/SC, Spinlock Across Harts)" << endl;
+    
+    vector<uint32_t> semantics = {
+        0x00100437, // lui x8, 0x100
+        0xffb00293, // addi x5, x0, -5
+        0x00542023, // sw x5, 0(x8)
+        0x00300313, // addi x6, x0, 3
+        0x8064252f, // amomin.w x10, x6, (x8)     -5, mem -5
+        0xc06425af, // amominu.w x11, x6, (x8)    -5, mem 3
+        0xa054262f, // amomax.w x12, x5, (x8)     3, mem 3
+        0xe05426af, // amomaxu.w x13, x5, (x8)    3, mem -5
+        0x2064272f, // amoxor.w x14, x6, (x8)     -5, mem -8
+        0x605427af, // amoand.w x15, x5, (x8)     -8, mem -8
+        0x4064282f, // amoor.w x16, x6, (x8)      -8, mem -5
+        0x186424af, // sc.w x9, x6, (x8)          no reservation: 1
+        0x1004292f, // lr.w x18, (x8)             -5
+        0x186429af, // sc.w x19, x6, (x8)         0, mem 3
+        0x18542a2f, // sc.w x20, x5, (x8)         reservation used up: 1
+        0x00042a83, // lw x21, 0(x8)              3
+        0x00240393, // addi x7, x8, 2
+        0x0063ab2f  // amoadd.w x22, x6, (x7)     misaligned: always traps
+    };
+    vector<pair<int, uint32_t>> expected = {
+        {10, (uint32_t)-5}, {11, (uint32_t)-5}, {12, 3}, {13, 3}, {14, (uint32_t)-5}, {15, (uint32_t)-8}, {16, (uint32_t)-8},
+        {9, 1}, {18, (uint32_t)-5}, {19, 0}, {20, 1}, {21, 3}, {22, 0}
+    };
+    vector<uint32_t> failed_sc = {
+        0x00100437, // lui x8, 0x100
+        0x186424af, // sc.w x9, x6, (x8)          no reservation: 1, nothing written
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    vector<uint32_t> spinlock = {
+        0x00100437, // lui x8, 0x100           lock, then counter, AMO counter, done count
+        0x3e800e13, // addi x28, x0, 1000
+        0x00100f13, // addi x30, x0, 1
+        0x100422af, // acquire: lr.w x5, (x8)
+        0xfe029ee3, // bne x5, x0, acquire
+        0x19e423af, // sc.w x7, x30, (x8)
+        0xfe039ae3, // bne x7, x0, acquire
+        0x00442e83, // lw x29, 4(x8)           critical section
+        0x001e8e93, // addi x29, x29, 1
+        0x01d42223, // sw x29, 4(x8)
+        0x0a04202f, // amoswap.w.rl x0, x0, (x8)   release
+        0x00840f93, // addi x31, x8, 8
+        0x01efa02f, // amoadd.w x0, x30, (x31)
+        0xfffe0e13, // addi x28, x28, -1
+        0xfc0e1ae3, // bne x28, x0, acquire
+        0x00c40f93, // addi x31, x8, 12
+        0x01efa02f, // amoadd.w x0, x30, (x31)    done
+        0x02051063, // bne x10, x0, park
+        0x00400313, // addi x6, x0, 4
+        0x00c42283, // wait: lw x5, 12(x8)
+        0xfe629ee3, // bne x5, x6, wait
+        0x00442503, // lw x10, 4(x8)
+        0x00842583, // lw x11, 8(x8)
+        0x00a00893, // addi x17, x0, 10
+        0x00000073, // ecall
+        0x00000000  // park: null instruction
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            
+            cpu.loadRaw(semantics);
+            StopReason reason = cpu.run();
+            bool regsOk = true;
+            for (const auto& e : expected) regsOk = regsOk && cpu.getReg(e.first) == e.second;
+            if (reason != StopReason::Misaligned || cpu.getPC() != 0x44 || !regsOk) {
+                cout << "   [FAIL] " << name << " semantics: " << stopReasonName(reason) << " at 0x" << hex << cpu.getPC() << endl;
+                for (const auto& e : expected) {
+                    if (cpu.getReg(e.first) != e.second) cout << "      x" << dec << e.first << " = 0x" << hex << cpu.getReg(e.first) << endl;
+                }
+                pass = false;
+            }
+            
+            // A failed SC neither dirties its page nor counts as a store
+            CPU fresh;
+            fresh.setQuiet(true);
+            fresh.setEngine(engine.first);
+            fresh.setMemoryBackend(backend);
+            fresh.loadRaw(failed_sc);
+            shared_ptr<Snapshot> snap = fresh.snapshot();
+            reason = fresh.run();
+            if (reason != StopReason::Exit || fresh.getReg(9) != 1 || fresh.getDirtyPageCount() != 0 || fresh.getPerfCounters().stores != 0) {
+                cout << "   [FAIL] " << name << " failed SC: " << stopReasonName(reason) << ", x9=" << dec << fresh.getReg(9)
+                     << " dirty=" << fresh.getDirtyPageCount() << " stores=" << fresh.getPerfCounters().stores << endl;
+                pass = false;
+            }
+            
+            Machine machine(4);
+            machine.setEngine(engine.first);
+            machine.setMemoryBackend(backend);
+            machine.setQuantum(500); // Quanta end inside critical sections
+            machine.loadRaw(spinlock);
+            reason = machine.run(10000000);
+            if (reason != StopReason::Exit || machine.hart(0).getReg(10) != 4000 || machine.hart(0).getReg(11) != 4000) {
+                cout << "   [FAIL] " << name << " spinlock: " << stopReasonName(reason) << ", locked count " << dec
+                     << machine.hart(0).getReg(10) << ", AMO count " << machine.hart(0).getReg(11) << " (4000 expected)" << endl;
+                pass = false;
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] AMOs return the old value, SC needs a live reservation, no lost updates across harts." << endl;
+    return pass;
+}
+
+// Test 19: RV32M. Signed, unsigned and mixed multiplies, truncating division
+// and the spec's results for division by zero and INT_MIN / -1, looped so
+// the JIT translates the block too.
+bool runMulDivTest() {
+    cout << "[TEST] M-Extension (Multiply/Divide Edge Cases)" << endl;
+    
+    vector<uint32_t> program = {
+        0x01400413, // addi x8, x0, 20
+        0xff900293, // loop: addi x5, x0, -7
+        0x00200313, // addi x6, x0, 2
+        0x800003b7, // lui x7, 0x80000     INT_MIN
+        0xfff00e13, // addi x28, x0, -1
+        0x02628533, // mul x10, x5, x6
+        0x026295b3, // mulh x11, x5, x6
+        0x03c2a633, // mulhsu x12, x5, x28
+        0x03c2b6b3, // mulhu x13, x5, x28
+        0x0262c733, // div x14, x5, x6
+        0x0262e7b3, // rem x15, x5, x6
+        0x0262d833, // divu x16, x5, x6
+        0x0262fc33, // remu x24, x5, x6
+        0x03c3c4b3, // div x9, x7, x28     overflow
+        0x03c3e933, // rem x18, x7, x28
+        0x0202c9b3, // div x19, x5, x0     by zero
+        0x0202da33, // divu x20, x5, x0
+        0x0202eab3, // rem x21, x5, x0
+        0x0202fb33, // remu x22, x5, x0
+        0x02739bb3, // mulh x23, x7, x7
+        0xfff40413, // addi x8, x8, -1
+        0xfa0418e3, // bne x8, x0, loop
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    vector<pair<int, uint32_t>> expected = {
+        {10, (uint32_t)-14}, {11, 0xFFFFFFFF}, {12, 0xFFFFFFF9}, {13, 0xFFFFFFF8},
+        {14, (uint32_t)-3}, {15, (uint32_t)-1}, {16, 0x7FFFFFFC}, {24, 1},
+        {9, 0x80000000}, {18, 0}, {19, 0xFFFFFFFF}, {20, 0xFFFFFFFF}, {21, (uint32_t)-7}, {22, (uint32_t)-7},
+        {23, 0x40000000}
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    for (const auto& engine : engines) {
+        CPU cpu;
+        cpu.setQuiet(true);
+        if (!cpu.setEngine(engine.first)) continue;
+        cpu.loadRaw(program);
+        StopReason reason = cpu.run();
+        bool regsOk = true;
+        for (const auto& e : expected) regsOk = regsOk && cpu.getReg(e.first) == e.second;
+        if (reason != StopReason::Exit || cpu.getInstructionCount() != 1 + 21 * 20 + 2 || !regsOk) {
+            cout << "   [FAIL] " << engine.second << ": " << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount() << " instructions" << endl;
+            for (const auto& e : expected) {
+                if (cpu.getReg(e.first) != e.second) cout << "      x" << dec << e.first << " = 0x" << hex << cpu.getReg(e.first) << endl;
+            }
+            pass = false;
+        }
+    }
+    
+    if (pass) cout << "   [PASS] MUL/MULH*/DIV*/REM* match the spec, including divide by zero and overflow." << endl;
+    return pass;
+}
+
+// Little-endian bytes of a run of 16-bit parcels (a 32-bit instruction is
+// two parcels, low half first)
+static vector<uint8_t> parcelBytes(const vector<uint16_t>& parcels) {
+    vector<uint8_t> bytes;
+    for (uint16_t p : parcels) {
+        bytes.push_back((uint8_t)p);
+        bytes.push_back((uint8_t)(p >> 8));
+    }
+    return bytes;
+}
+
+// Test 20: RV32C. Compressed and 32-bit instructions mixed at halfword
+// alignment (loop, call/return, stack access), a 32-bit instruction that
+// straddles a page boundary, and a store to its second half on the next page
+// that must invalidate it.
+bool runCompressedTest() {
+    cout << "[TEST] C-Extension (Compressed Code, Page-Straddling Fetch)" << endl;
+    
+    vector<uint16_t> main = {
+        0x4501,         // c.li x10, 0
+        0x45d1,         // c.li x11, 20
+        0x952e,         // loop: c.add x10, x11
+        0x15fd,         // c.addi x11, -1
+        0xfdf5,         // c.bnez x11, loop
+        0x2819,         // c.jal func
+        0x0513, 0x0015, // addi x10, x10, 1         (at 0xc)
+        0x717d,         // c.addi16sp x2, -16
+        0xc22a,         // c.swsp x10, 4(x2)
+        0x4612,         // c.lwsp x12, 4(x2)
+        0x6141,         // c.addi16sp x2, 16
+        0x12b7, 0x0000, // lui x5, 1
+        0x12f9,         // c.addi x5, -2
+        0x8282,         // c.jr x5                  -> 0xffe
+        0x0506,         // func: c.slli x10, 1
+        0x8082          // c.jr x1
+    };
+    vector<uint16_t> straddling = {
+        0x0693, 0x0070, // 0xffe: addi x13, x0, 7   (upper half on the next page)
+        0xeb09,         // c.bnez x14, done
+        0x4705,         // c.li x14, 1
+        0x1337, 0x0000, // lui x6, 1
+        0x0393, 0x0900, // addi x7, x0, 0x90
+        0x1023, 0x0073, // sh x7, 0(x6)             -> addi x13, x0, 9
+        0x8282,         // c.jr x5
+        0x48a9,         // done: c.li x17, 10
+        0x0073, 0x0000  // ecall
+    };
+    vector<uint8_t> mainBytes = parcelBytes(main);
+    vector<uint32_t> mainWords(mainBytes.size() / 4);
+    for (size_t i = 0; i < mainWords.size(); i++) mainWords[i] = SparseMemory::read<uint32_t>(&mainBytes[4 * i]);
+    vector<uint8_t> straddlingBytes = parcelBytes(straddling);
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            
+            cpu.loadRaw(mainWords);
+            cpu.writeMemory(0xffe, straddlingBytes.data(), straddlingBytes.size());
+            StopReason reason = cpu.run();
+            // sum(1..20) * 2 + 1; 73 instructions to the jump, then two passes and the exit
+            if (reason != StopReason::Exit || cpu.getReg(10) != 421 || cpu.getReg(12) != 421 || cpu.getReg(13) != 9 ||
+                cpu.getInstructionCount() != 73 + 7 + 2 + 2 || cpu.getPC() != 0x1016) {
+                cout << "   [FAIL] " << name << ": " << stopReasonName(reason) << " at 0x" << hex << cpu.getPC() << ", x10=" << dec
+                     << cpu.getReg(10) << " x12=" << cpu.getReg(12) << " x13=" << cpu.getReg(13) << " after "
+                     << cpu.getInstructionCount() << " instructions" << endl;
+                pass = false;
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Compressed code runs on every engine, including across a page boundary." << endl;
+    return pass;
+}
+
+// Test 21: Zba/Zbb. Shift-and-add, inverted logic, min/max, rotates, bit
+// counts (ctz of zero included), sign/zero extension, byte reverse and orc.b,
+// looped so the JIT translates the block too.
+bool runBitManipTest() {
+    cout << "[TEST] Zba/Zbb (Bit Manipulation)" << endl;
+    
+    vector<uint32_t> program = {
+        0x01400413, // addi x8, x0, 20
+        0x123452b7, // loop: lui x5, 0x12345
+        0x67828293, // addi x5, x5, 0x678
+        0xffd00313, // addi x6, x0, -3
+        0x001284b7, // lui x9, 0x128
+        0x0ff48493, // addi x9, x9, 0xFF
+        0x2062a533, // sh1add x10, x5, x6
+        0x2062c5b3, // sh2add x11, x5, x6
+        0x2062e633, // sh3add x12, x5, x6
+        0x4062e6b3, // orn x13, x5, x6
+        0x40537733, // andn x14, x6, x5
+        0x4062c7b3, // xnor x15, x5, x6
+        0x0a62c833, // min x16, x5, x6
+        0x0a62d933, // minu x18, x5, x6
+        0x0a62e9b3, // max x19, x5, x6
+        0x0a62fa33, // maxu x20, x5, x6
+        0x60629ab3, // rol x21, x5, x6    by 29
+        0x6062db33, // ror x22, x5, x6
+        0x6082db93, // rori x23, x5, 8
+        0x60029c13, // clz x24, x5
+        0x60129c93, // ctz x25, x5
+        0x60229d13, // cpop x26, x5
+        0x60049d93, // clz x27, x9
+        0x60101e13, // ctz x28, x0
+        0x60449e93, // sext.b x29, x9
+        0x60549f13, // sext.h x30, x9
+        0x08034fb3, // zext.h x31, x6
+        0x6982d093, // rev8 x1, x5
+        0x2874d113, // orc.b x2, x9
+        0xfff40413, // addi x8, x8, -1
+        0xf80416e3, // bne x8, x0, loop
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    vector<pair<int, uint32_t>> expected = {
+        {10, 0x2468ACED}, {11, 0x48D159DD}, {12, 0x91A2B3BD},
+        {13, 0x1234567A}, {14, 0xEDCBA985}, {15, 0x1234567A},
+        {16, 0xFFFFFFFD}, {18, 0x12345678}, {19, 0x12345678}, {20, 0xFFFFFFFD},
+        {21, 0x02468ACF}, {22, 0x91A2B3C0}, {23, 0x78123456},
+        {24, 3}, {25, 3}, {26, 13}, {27, 11}, {28, 32},
+        {29, 0xFFFFFFFF}, {30, 0xFFFF80FF}, {31, 0xFFFD}, {1, 0x78563412}, {2, 0x00FFFFFF}
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    for (const auto& engine : engines) {
+        CPU cpu;
+        cpu.setQuiet(true);
+        if (!cpu.setEngine(engine.first)) continue;
+        cpu.loadRaw(program);
+        StopReason reason = cpu.run();
+        bool regsOk = true;
+        for (const auto& e : expected) regsOk = regsOk && cpu.getReg(e.first) == e.second;
+        if (reason != StopReason::Exit || cpu.getInstructionCount() != 1 + 30 * 20 + 2 || !regsOk) {
+            cout << "   [FAIL] " << engine.second << ": " << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount() << " instructions" << endl;
+            for (const auto& e : expected) {
+                if (cpu.getReg(e.first) != e.second) cout << "      x" << dec << e.first << " = 0x" << hex << cpu.getReg(e.first) << endl;
+            }
+            pass = false;
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Zba/Zbb results match the spec on every engine." << endl;
+    return pass;
+}
+
+// Test 22: RV32F/D. Arithmetic, FMA, sqrt and conversions (saturating, in
+// static and dynamic rounding modes), canonical NaNs and NaN-boxing,
+// min/compare/classify on NaN, 64-bit loads and stores, and the fflags the
+// loop raised, read back through the CSR. A second program rounds ties,
+// near-ties and an overflow to max magnitude, statically and through frm.
+// The host's own floating-point environment must be untouched afterwards.
+bool runFloatTest() {
+    cout << "[TEST] F/D-Extensions (Rounding, NaNs, fflags)" << endl;
+    
+    vector<uint32_t> program = {
+        0x000014b7, // lui x9, 1            scratch at 0x1000
+        0x01400413, // addi x8, x0, 20
+        0x00101073, // loop: fsflags x0
+        0x00700293, // addi x5, x0, 7
+        0xd002f0d3, // fcvt.s.w f1, x5
+        0x00200313, // addi x6, x0, 2
+        0xd0037153, // fcvt.s.w f2, x6
+        0x1820f1d3, // fdiv.s f3, f1, f2    3.5
+        0xe0018553, // fmv.x.w x10, f3
+        0xc001f5d3, // fcvt.w.s x11, f3     ties to even
+        0xc0019653, // fcvt.w.s x12, f3, rtz
+        0x42018253, // fcvt.d.s f4, f3
+        0x124272d3, // fmul.d f5, f4, f4    12.25
+        0x0054b027, // fsd f5, 0(x9)
+        0x0044a683, // lw x13, 4(x9)
+        0x0004b307, // fld f6, 0(x9)
+        0x5a0373d3, // fsqrt.d f7, f6
+        0xa243a753, // feq.d x14, f7, f4
+        0x22427443, // fmadd.d f8, f4, f4, f4
+        0xc20427d3, // fcvt.w.d x15, f8, rdn
+        0xc2143853, // fcvt.wu.d x16, f8, rup
+        0x0810f4d3, // fsub.s f9, f1, f1
+        0x1894f553, // fdiv.s f10, f9, f9   0/0
+        0xe0050953, // fmv.x.w x18, f10
+        0xc00579d3, // fcvt.w.s x19, f10
+        0x281505d3, // fmin.s f11, f10, f1
+        0xe0058a53, // fmv.x.w x20, f11
+        0xa0151ad3, // flt.s x21, f10, f1
+        0xe0051b53, // fclass.s x22, f10
+        0x20109653, // fsgnjn.s f12, f1, f1
+        0xe0060bd3, // fmv.x.w x23, f12
+        0xc0167c53, // fcvt.wu.s x24, f12   -7
+        0x4012f6d3, // fcvt.s.d f13, f5
+        0xe0068cd3, // fmv.x.w x25, f13
+        0x006377d3, // fadd.s f15, f6, f6   f6 is not NaN-boxed
+        0xe0078d53, // fmv.x.w x26, f15
+        0x00100393, // addi x7, x0, 1
+        0xd003f953, // fcvt.s.w f18, x7
+        0x00300313, // addi x6, x0, 3
+        0xd0037853, // fcvt.s.w f16, x6
+        0x190928d3, // fdiv.s f17, f18, f16, rdn
+        0xe0088dd3, // fmv.x.w x27, f17
+        0x190979d3, // fdiv.s f19, f18, f16
+        0xe0098e53, // fmv.x.w x28, f19
+        0x00215073, // fsrmi x0, 2          frm = RDN
+        0x19017a53, // fdiv.s f20, f2, f16
+        0xe00a0ed3, // fmv.x.w x29, f20
+        0x19010ad3, // fdiv.s f21, f2, f16, rne
+        0xe00a8f53, // fmv.x.w x30, f21
+        0x00205073, // fsrmi x0, 0
+        0x1890fb53, // fdiv.s f22, f1, f9   7/0
+        0xe00b00d3, // fmv.x.w x1, f22
+        0x00102ff3, // frflags x31
+        0xfff40413, // addi x8, x8, -1
+        0xf20418e3, // bne x8, x0, loop
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    vector<pair<int, uint32_t>> expected = {
+        {10, 0x40600000}, {11, 4}, {12, 3}, {13, 0x40288000}, {14, 1}, {15, 15}, {16, 16},
+        {18, 0x7FC00000}, {19, 0x7FFFFFFF}, {20, 0x40E00000}, {21, 0}, {22, 0x200},
+        {23, 0xC0E00000}, {24, 0}, {25, 0x41440000}, {26, 0x7FC00000},
+        {27, 0x3EAAAAAA}, {28, 0x3EAAAAAB}, {29, 0x3F2AAAAA}, {30, 0x3F2AAAAB},
+        {1, 0x7F800000}, {31, FFLAG_NV | FFLAG_DZ | FFLAG_NX}
+    };
+    
+    vector<uint32_t> rmmProgram = {
+        0x00105073, // fsflags x0
+        0x00100293, // addi x5, x0, 1
+        0xd002f0d3, // fcvt.s.w f1, x5
+        0x33800337, // lui x6, 0x33800      2^-24, half an ulp of 1.0f
+        0xf0030153, // fmv.w.x f2, x6
+        0x0020c1d3, // fadd.s f3, f1, f2, rmm
+        0xe0018553, // fmv.x.w x10, f3
+        0x00208253, // fadd.s f4, f1, f2, rne
+        0xe00205d3, // fmv.x.w x11, f4
+        0x20109353, // fsgnjn.s f6, f1, f1
+        0x082343d3, // fsub.s f7, f6, f2, rmm
+        0xe0038653, // fmv.x.w x12, f7
+        0xfff30313, // addi x6, x6, -1      just under the tie
+        0xf00302d3, // fmv.w.x f5, x6
+        0x0050c2d3, // fadd.s f5, f1, f5, rmm
+        0xe00286d3, // fmv.x.w x13, f5
+        0xd2028453, // fcvt.d.w f8, x5
+        0x250003b7, // lui x7, 0x25000      2^-53, half an ulp of 1.0
+        0xf0038553, // fmv.w.x f10, x7
+        0x420504d3, // fcvt.d.s f9, f10
+        0x029445d3, // fadd.d f11, f8, f9, rmm
+        0x000014b7, // lui x9, 1
+        0x00b4b027, // fsd f11, 0(x9)
+        0x0004a703, // lw x14, 0(x9)
+        0x0044a783, // lw x15, 4(x9)
+        0x0820c643, // fmadd.s f12, f1, f2, f1, rmm
+        0xe0060853, // fmv.x.w x16, f12
+        0x7f800e37, // lui x28, 0x7F800
+        0xfffe0e13, // addi x28, x28, -1    largest finite single
+        0xf00e06d3, // fmv.w.x f13, x28
+        0x00d6c753, // fadd.s f14, f13, f13, rmm
+        0xe00709d3, // fmv.x.w x19, f14
+        0x00225073, // fsrmi x0, 4          frm = RMM
+        0x0020f7d3, // fadd.s f15, f1, f2
+        0xe0078a53, // fmv.x.w x20, f15
+        0x00205073, // fsrmi x0, 0
+        0x42010853, // fcvt.d.s f16, f2
+        0x030478d3, // fadd.d f17, f8, f16  1 + 2^-24, exact
+        0x4018c953, // fcvt.s.d f18, f17, rmm
+        0xe0090ad3, // fmv.x.w x21, f18
+        0x00102b73, // frflags x22
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    vector<pair<int, uint32_t>> rmmExpected = {
+        {10, 0x3F800001}, {11, 0x3F800000}, {12, 0xBF800001}, {13, 0x3F800000}, {14, 1}, {15, 0x3FF00000},
+        {16, 0x3F800001}, {19, 0x7F800000}, {20, 0x3F800001}, {21, 0x3F800001}, {22, FFLAG_OF | FFLAG_NX}
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            
+            cpu.loadRaw(program);
+            feclearexcept(FE_ALL_EXCEPT);
+            fesetround(FE_UPWARD);
+            StopReason reason = cpu.run();
+            bool hostOk = fegetround() == FE_UPWARD && fetestexcept(FE_ALL_EXCEPT) == 0;
+            fesetround(FE_TONEAREST);
+            bool regsOk = true;
+            for (const auto& e : expected) regsOk = regsOk && cpu.getReg(e.first) == e.second;
+            if (reason != StopReason::Exit || cpu.getInstructionCount() != 2 + 53 * 20 + 2 || !regsOk ||
+                cpu.getFcsr() != (FFLAG_NV | FFLAG_DZ | FFLAG_NX) || !hostOk) {
+                cout << "   [FAIL] " << name << ": " << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount()
+                     << " instructions, fcsr 0x" << hex << cpu.getFcsr() << (hostOk ? "" : ", host environment changed") << endl;
+                for (const auto& e : expected) {
+                    if (cpu.getReg(e.first) != e.second) cout << "      x" << dec << e.first << " = 0x" << hex << cpu.getReg(e.first) << endl;
+                }
+                pass = false;
+            }
+            
+            CPU rmm;
+            rmm.setQuiet(true);
+            rmm.setEngine(engine.first);
+            rmm.setMemoryBackend(backend);
+            rmm.loadRaw(rmmProgram);
+            reason = rmm.run();
+            regsOk = true;
+            for (const auto& e : rmmExpected) regsOk = regsOk && rmm.getReg(e.first) == e.second;
+            hostOk = fegetround() == FE_TONEAREST && fetestexcept(FE_ALL_EXCEPT) == 0;
+            if (reason != StopReason::Exit || rmm.getInstructionCount() != rmmProgram.size() || !regsOk || !hostOk) {
+                cout << "   [FAIL] " << name << " RMM: " << stopReasonName(reason) << " after " << dec << rmm.getInstructionCount()
+                     << " instructions" << (hostOk ? "" : ", host environment changed") << endl;
+                for (const auto& e : rmmExpected) {
+                    if (rmm.getReg(e.first) != e.second) cout << "      x" << dec << e.first << " = 0x" << hex << rmm.getReg(e.first) << endl;
+                }
+                pass = false;
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] F/D results, NaN handling, fflags and RMM rounding match the spec on every engine." << endl;
+    return pass;
+}
+
+// Test 23: RVV integer subset. A strip-mined loop (SEW 32, LMUL 2, 100
+// elements, so the last strip is short) chains every arithmetic form and
+// accumulates four reductions across strips; a single SEW 8, LMUL 8 strip
+// checks the signed reductions and sign extension of vmv.x.s; SEW 16 moves
+// check that the tail is left alone. Then vill, a misaligned register group
+// and a load past the end of memory must stop the program.
+bool runVectorTest() {
+    cout << "[TEST] Vector Extension (Strip Mining, Reductions, Tails)" << endl;
+    
+    vector<uint32_t> program = {
+        0x000014b7, // lui x9, 1
+        0x00002537, // lui x10, 2
+        0x000035b7, // lui x11, 3
+        0x06400613, // addi x12, x0, 100
+        0x00700693, // addi x13, x0, 7
+        0x00010737, // lui x14, 16
+        0x00170713, // addi x14, x14, 1
+        0x12c00793, // addi x15, x0, 300
+        0xabcde837, // lui x16, 0xABCDE
+        0xfff00293, // addi x5, x0, -1
+        0xcd00f057, // vsetivli x0, 1, e32, m1, ta, ma
+        0x42006c57, // vmv.s.x v24, x0
+        0x42006cd7, // vmv.s.x v25, x0
+        0x4202ed57, // vmv.s.x v26, x5
+        0x4202edd7, // vmv.s.x v27, x5
+        0x0d1672d7, // loop: vsetvli x5, x12, e32, m2, ta, ma
+        0x0204e107, // vle32.v v2, (x9)
+        0x02056207, // vle32.v v4, (x10)
+        0x96222357, // vmul.vv v6, v2, v4
+        0x0266c357, // vadd.vx v6, v6, x13
+        0x0a610357, // vsub.vv v6, v6, v2
+        0x2e62b357, // vxor.vi v6, v6, 5
+        0x96276457, // vmul.vx v8, v2, x14
+        0x26820457, // vand.vv v8, v8, v4
+        0x2a84b457, // vor.vi v8, v8, 9
+        0x0e8f3457, // vrsub.vi v8, v8, -2
+        0x02640357, // vadd.vv v6, v6, v8
+        0x0a67c357, // vsub.vx v6, v6, x15
+        0x2e684357, // vxor.vx v6, v6, x16
+        0x0205e327, // vse32.v v6, (x11)
+        0x026c2c57, // vredsum.vs v24, v6, v24
+        0x1a6cacd7, // vredmaxu.vs v25, v6, v25
+        0x066d2d57, // vredand.vs v26, v6, v26
+        0x126dadd7, // vredminu.vs v27, v6, v27
+        0x00229313, // slli x6, x5, 2
+        0x006484b3, // add x9, x9, x6
+        0x00650533, // add x10, x10, x6
+        0x006585b3, // add x11, x11, x6
+        0x40560633, // sub x12, x12, x5
+        0xfa0610e3, // bne x12, x0, loop
+        0x43802957, // vmv.x.s x18, v24
+        0x439029d7, // vmv.x.s x19, v25
+        0x43a02a57, // vmv.x.s x20, v26
+        0x43b02ad7, // vmv.x.s x21, v27
+        0x000044b7, // lui x9, 4
+        0x06400613, // addi x12, x0, 100
+        0x03000693, // addi x13, x0, 0x30
+        0x0c800713, // addi x14, x0, 200
+        0x00500793, // addi x15, x0, 5
+        0x0c367b57, // vsetvli x22, x12, e8, m8, ta, ma
+        0x02048407, // vle8.v v8, (x9)
+        0x2687b857, // vand.vi v16, v8, 15
+        0x2b06c857, // vor.vx v16, v16, x13
+        0x2f040857, // vxor.vv v16, v16, v8
+        0x030eb857, // vadd.vi v16, v16, -3
+        0x0f074857, // vrsub.vx v16, v16, x14
+        0x4207e0d7, // vmv.s.x v1, x15
+        0x1680a157, // vredmin.vs v2, v8, v1
+        0x1f00a1d7, // vredmax.vs v3, v16, v1
+        0x0b00a257, // vredor.vs v4, v16, v1
+        0x0e80a2d7, // vredxor.vs v5, v8, v1
+        0x42202bd7, // vmv.x.s x23, v2
+        0x42302c57, // vmv.x.s x24, v3
+        0x42402cd7, // vmv.x.s x25, v4
+        0x425020d7, // vmv.x.s x1, v5
+        0x000054b7, // lui x9, 5
+        0x02048827, // vse8.v v16, (x9)
+        0xcc8a7d57, // vsetivli x26, 20, e16, m1, ta, ma
+        0x5e074557, // vmv.v.x v10, x14
+        0xcc82f057, // vsetivli x0, 5, e16, m1, ta, ma
+        0x5e0fb557, // vmv.v.i v10, -1
+        0xc081f057, // vsetivli x0, 3, e16, m1, tu, mu
+        0x5e048557, // vmv.v.v v10, v9
+        0xc2202df3, // csrr x27, vlenb
+        0xc2002e73, // csrr x28, vl
+        0xc2102ef3, // csrr x29, vtype
+        0xcc887057, // vsetivli x0, 16, e16, m1, ta, ma
+        0x000064b7, // lui x9, 6
+        0x0204d527, // vse16.v v10, (x9)
+        0x0d807f57, // vsetvli x30, x0, e64, m1, ta, ma
+        0xc2102ff3, // csrr x31, vtype
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    vector<uint32_t> a(100), b(100), c(100);
+    vector<uint8_t> d(100), e(100);
+    for (uint32_t i = 0; i < 100; i++) {
+        a[i] = 3 * i + 1;
+        b[i] = 1000 - 7 * i;
+        uint32_t product = (((a[i] * b[i] + 7 - a[i]) ^ 5) + (-2 - (((a[i] * 0x10001) & b[i]) | 9)) - 300) ^ 0xABCDE000;
+        c[i] = product;
+        d[i] = (uint8_t)(i * 29 + 5);
+        e[i] = (uint8_t)(200 - (uint8_t)((((d[i] & 15) | 0x30) ^ d[i]) - 3));
+    }
+    vector<uint16_t> f = { (uint16_t)(d[32] | d[33] << 8), (uint16_t)(d[34] | d[35] << 8), (uint16_t)(d[36] | d[37] << 8),
+                           0xFFFF, 0xFFFF, 200, 200, 200, 200, 200, 200, 200, 200, 200, 200, 200 };
+    vector<pair<int, uint32_t>> expected = {
+        {5, 4}, {18, 0x1BFE088E}, {19, 0xABCDF9BA}, {20, 0xABCC0000}, {21, 0xABCC403A},
+        {22, 100}, {23, 0xFFFFFF83}, {24, 0x7B}, {25, 0xFFFFFFFF}, {1, 0x61},
+        {26, 16}, {27, VLENB}, {28, 3}, {29, 0x08}, {30, 0}, {31, VTYPE_VILL}
+    };
+    
+    // vill, a group not aligned to LMUL 2, and a load running off the end of 4 MiB
+    vector<pair<vector<uint32_t>, StopReason>> stops = {
+        { { 0x0d807057, 0x022180d7 }, StopReason::Illegal },   // vsetvli x0, x0, e64, m1; vadd.vv v1, v2, v3
+        { { 0x0d1072d7, 0x022200d7 }, StopReason::Illegal },   // vsetvli x5, x0, e32, m2; vadd.vv v1, v2, v4
+        { { 0x004004b7, 0xff848493, 0xcd027057, 0x0204e087 }, StopReason::Fault }  // lui x9, 0x400; addi x9, x9, -8;
+                                                                                    // vsetivli x0, 4, e32, m1; vle32.v v1, (x9)
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            
+            cpu.loadRaw(program);
+            cpu.writeMemory(0x1000, a.data(), 400);
+            cpu.writeMemory(0x2000, b.data(), 400);
+            cpu.writeMemory(0x4000, d.data(), 100);
+            StopReason reason = cpu.run();
+            vector<uint32_t> storedC(100);
+            vector<uint8_t> storedE(101);
+            vector<uint16_t> storedF(16);
+            cpu.readMemory(0x3000, storedC.data(), 400);
+            cpu.readMemory(0x5000, storedE.data(), 101);
+            cpu.readMemory(0x6000, storedF.data(), 32);
+            bool regsOk = true;
+            for (const auto& r : expected) regsOk = regsOk && cpu.getReg(r.first) == r.second;
+            bool memoryOk = storedC == c && equal(e.begin(), e.end(), storedE.begin()) && storedE[100] == 0 && storedF == f;
+            if (reason != StopReason::Exit || cpu.getInstructionCount() != 15 + 7 * 25 + 43 || !regsOk || !memoryOk) {
+                cout << "   [FAIL] " << name << ": " << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount()
+                     << " instructions" << (memoryOk ? "" : ", stored vectors differ") << endl;
+                for (const auto& r : expected) {
+                    if (cpu.getReg(r.first) != r.second) cout << "      x" << dec << r.first << " = 0x" << hex << cpu.getReg(r.first) << endl;
+                }
+                pass = false;
+            }
+            
+            for (const auto& stop : stops) {
+                CPU bad;
+                bad.setQuiet(true);
+                bad.setEngine(engine.first);
+                bad.setMemoryBackend(backend);
+                bad.loadRaw(stop.first);
+                StopReason got = bad.run();
+                if (got != stop.second || bad.getInstructionCount() != stop.first.size()) {
+                    cout << "   [FAIL] " << name << ": expected " << stopReasonName(stop.second) << ", got " << stopReasonName(got)
+                         << " after " << dec << bad.getInstructionCount() << " instructions" << endl;
+                    pass = false;
+                }
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Vector results, reductions and tails match the spec on every engine." << endl;
+    return pass;
+}
+
+// Test 24: Counters. A load/store loop under a custom timing model, then
+// cycle, instret, time and the event hpmcounters read back; the counter CSRs
+// are read-only and EBREAK is not a syscall.
+bool runCounterTest() {
+    cout << "[TEST] Counters (cycle, time, instret, hpmcounter3-6)" << endl;
+    
+    vector<uint32_t> program = {
+        0x06400293, // addi x5, x0, 100
+        0x00001337, // lui x6, 1
+        0x00032383, // loop: lw x7, 0(x6)
+        0x00138393, // addi x7, x7, 1
+        0x00732023, // sw x7, 0(x6)
+        0xfff28293, // addi x5, x5, -1
+        0xfe0298e3, // bne x5, x0, loop
+        0xc0002573, // rdcycle x10
+        0xc02025f3, // rdinstret x11
+        0xc0102673, // rdtime x12
+        0xc03026f3, // csrr x13, hpmcounter3 (loads)
+        0xc0402773, // csrr x14, hpmcounter4 (stores)
+        0xc05027f3, // csrr x15, hpmcounter5 (taken branches)
+        0xc0602873, // csrr x16, hpmcounter6 (decodes)
+        0xc8002973, // rdcycleh x18
+        0xc07029f3, // csrr x19, hpmcounter7
+        0xc8202a73, // rdinstreth x20
+        0x00a00893, // addi x17, x0, 10
+        0x00000073  // ecall
+    };
+    // 10^7 cycles per instruction pushes cycle past 32 bits; loads, stores
+    // and the 99 taken branches add 300 + 100 + 396, and time ticks once
+    // every 50 cycles
+    TimingModel timing;
+    timing.cycles_per_instruction = 10000000;
+    timing.load_cycles = 3;
+    timing.store_cycles = 1;
+    timing.taken_branch_cycles = 4;
+    timing.clock_hz = 50000000;
+    timing.timebase_hz = 1000000;
+    vector<pair<int, uint32_t>> expected = {
+        {10, 0x2B37221C}, {11, 503}, {12, 100800015}, {13, 100}, {14, 100}, {15, 99},
+        {18, 1}, {19, 0}, {20, 0}
+    };
+    
+    vector<vector<uint32_t>> illegal = {
+        { 0xc0029073 },     // csrw cycle, x5
+        { 0xc0201073 },     // csrw instret, x0
+        { 0x00100073 }      // ebreak
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            
+            cpu.setTimingModel(timing);
+            cpu.loadRaw(program);
+            StopReason reason = cpu.run();
+            uint32_t value = 0;
+            cpu.readMemory(0x1000, &value, 4);
+            PerfCounters counters = cpu.getPerfCounters();
+            bool regsOk = true;
+            for (const auto& r : expected) regsOk = regsOk && cpu.getReg(r.first) == r.second;
+            // Every instruction is decoded once, some before the read
+            bool decodesOk = cpu.getReg(16) > 0 && cpu.getReg(16) <= program.size() && counters.decode_misses == program.size();
+            if (reason != StopReason::Exit || cpu.getInstructionCount() != 514 || value != 100 || !regsOk || !decodesOk ||
+                counters.loads != 100 || counters.stores != 100 || counters.taken_branches != 99) {
+                cout << "   [FAIL] " << name << ": " << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount()
+                     << " instructions, " << counters.decode_misses << " decodes" << endl;
+                for (const auto& r : expected) {
+                    if (cpu.getReg(r.first) != r.second) cout << "      x" << dec << r.first << " = 0x" << hex << cpu.getReg(r.first) << endl;
+                }
+                pass = false;
+            }
+            
+            for (const auto& bad_program : illegal) {
+                CPU bad;
+                bad.setQuiet(true);
+                bad.setEngine(engine.first);
+                bad.setMemoryBackend(backend);
+                bad.loadRaw(bad_program);
+                StopReason got = bad.run();
+                if (got != StopReason::Illegal || bad.getInstructionCount() != 1) {
+                    cout << "   [FAIL] " << name << ": 0x" << hex << bad_program[0] << " gave " << stopReasonName(got) << endl;
+                    pass = false;
+                }
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Counters follow the timing model and events on every engine." << endl;
+    return pass;
+}
+
+// Test 25: Linux syscalls. write/writev to stdout (captured), a file
+// written, reopened, stat'ed, seeked with plain lseek (newlib) and _llseek
+// (musl) and read back (including a read over already-decoded code), brk,
+// anonymous mmap, clock_gettime64, and the errors for an unknown syscall
+// and a bad descriptor.
+bool runLinuxSyscallTest() {
+    cout << "[TEST] Linux Syscalls (Files, Heap, Zero-Copy I/O)" << endl;
+    
+    vector<uint32_t> program = {
+        0x04000893, // addi x17, x0, 64
+        0x00100513, // addi x10, x0, 1
+        0x000025b7, // lui x11, 2
+        0x00600613, // addi x12, x0, 6
+        0x00000073, // ecall
+        0x00050493, // addi x9, x10, 0
+        0x03800893, // addi x17, x0, 56
+        0xf9c00513, // addi x10, x0, -100
+        0x000025b7, // lui x11, 2
+        0x10058593, // addi x11, x11, 256
+        0x24100613, // addi x12, x0, 577
+        0x1a400693, // addi x13, x0, 420
+        0x00000073, // ecall
+        0x00050913, // addi x18, x10, 0
+        0x04000893, // addi x17, x0, 64
+        0x00090513, // addi x10, x18, 0
+        0x000035b7, // lui x11, 3
+        0xffe58593, // addi x11, x11, -2
+        0x00800613, // addi x12, x0, 8
+        0x00000073, // ecall
+        0x00050993, // addi x19, x10, 0
+        0x03900893, // addi x17, x0, 57
+        0x00090513, // addi x10, x18, 0
+        0x00000073, // ecall
+        0x03800893, // addi x17, x0, 56
+        0xf9c00513, // addi x10, x0, -100
+        0x000025b7, // lui x11, 2
+        0x10058593, // addi x11, x11, 256
+        0x00000613, // addi x12, x0, 0
+        0x00000693, // addi x13, x0, 0
+        0x00000073, // ecall
+        0x00050913, // addi x18, x10, 0
+        0x05000893, // addi x17, x0, 80
+        0x00090513, // addi x10, x18, 0
+        0x000045b7, // lui x11, 4
+        0x00000073, // ecall
+        0x00050a13, // addi x20, x10, 0
+        0x0305aa83, // lw x21, 48(x11)
+        0x03e00893, // addi x17, x0, 62
+        0x18058693, // addi x13, x11, 384   result at 0x4180; whence x14 is still 0
+        0x00090513, // addi x10, x18, 0
+        0x00000593, // addi x11, x0, 0
+        0x00400613, // addi x12, x0, 4
+        0x00000073, // ecall
+        0x00050b13, // addi x22, x10, 0
+        0x03f00893, // addi x17, x0, 63
+        0x00090513, // addi x10, x18, 0
+        0x000055b7, // lui x11, 5
+        0x01000613, // addi x12, x0, 16
+        0x00000073, // ecall
+        0x00050b93, // addi x23, x10, 0
+        0x0005ac03, // lw x24, 0(x11)
+        0x03e00893, // addi x17, x0, 62
+        0x00090513, // addi x10, x18, 0
+        0xffe00593, // addi x11, x0, -2     plain lseek(fd, -2, SEEK_CUR): 6
+        0x00100613, // addi x12, x0, 1
+        0x00000693, // addi x13, x0, 0
+        0x00000073, // ecall
+        0x00050193, // addi x3, x10, 0
+        0x03e00893, // addi x17, x0, 62
+        0x00090513, // addi x10, x18, 0
+        0x00000593, // addi x11, x0, 0
+        0x00000613, // addi x12, x0, 0
+        0x000046b7, // lui x13, 4
+        0x10068693, // addi x13, x13, 256
+        0x00000713, // addi x14, x0, 0
+        0x00000073, // ecall
+        0x00050c93, // addi x25, x10, 0
+        0x0c8000ef, // jal x1, target
+        0x00020d13, // addi x26, x4, 0
+        0x03f00893, // addi x17, x0, 63
+        0x00090513, // addi x10, x18, 0
+        0x1d800593, // addi x11, x0, target
+        0x00000013, // nop
+        0x00400613, // addi x12, x0, 4
+        0x00000073, // ecall
+        0x0a8000ef, // jal x1, target
+        0x00020d93, // addi x27, x4, 0
+        0x0d600893, // addi x17, x0, 214
+        0x00000513, // addi x10, x0, 0
+        0x00000073, // ecall
+        0x00050e13, // addi x28, x10, 0
+        0x000022b7, // lui x5, 2
+        0x005e0533, // add x10, x28, x5
+        0x00000073, // ecall
+        0x00050e93, // addi x29, x10, 0
+        0x0de00893, // addi x17, x0, 222
+        0x00000513, // addi x10, x0, 0
+        0x000025b7, // lui x11, 2
+        0x00300613, // addi x12, x0, 3
+        0x02200693, // addi x13, x0, 34
+        0xfff00713, // addi x14, x0, -1
+        0x00000793, // addi x15, x0, 0
+        0x00000073, // ecall
+        0x00050f13, // addi x30, x10, 0
+        0x19300893, // addi x17, x0, 403
+        0x00100513, // addi x10, x0, 1
+        0x000045b7, // lui x11, 4
+        0x20058593, // addi x11, x11, 512
+        0x00000073, // ecall
+        0x00050f93, // addi x31, x10, 0
+        0x3e700893, // addi x17, x0, 999
+        0x00000073, // ecall
+        0x00050313, // addi x6, x10, 0
+        0x04200893, // addi x17, x0, 66
+        0x00100513, // addi x10, x0, 1
+        0x000025b7, // lui x11, 2
+        0x20058593, // addi x11, x11, 512
+        0x00200613, // addi x12, x0, 2
+        0x00000073, // ecall
+        0x00050393, // addi x7, x10, 0
+        0x03900893, // addi x17, x0, 57
+        0x00900513, // addi x10, x0, 9
+        0x00000073, // ecall
+        0x00050413, // addi x8, x10, 0
+        0x05e00893, // addi x17, x0, 94
+        0x02a00513, // addi x10, x0, 42
+        0x00000073, // ecall
+        0x00100213, // target: addi x4, x0, 1
+        0x00008067  // jalr x0, 0(x1)
+    };
+    const char* path = "syscall_test.bin";
+    const char text[] = "hello\n!!\n";
+    const uint32_t iov[] = { 0x2000, 5, 0x2006, 3 };
+    const uint8_t data[] = { 0x13, 0x02, 0x70, 0x00, 0xEF, 0xBE, 0xAD, 0xDE };   // addi x4, x0, 7; 0xDEADBEEF
+    vector<pair<int, uint32_t>> expected = {
+        {9, 6}, {18, 3}, {19, 8}, {20, 0}, {21, 8}, {22, 0}, {23, 4}, {24, 0xDEADBEEF}, {25, 0},
+        {26, 1}, {27, 7}, {28, 0x1000}, {29, 0x3000}, {30, 0x2FE000}, {31, 0},
+        {3, 6}, {6, (uint32_t)-38}, {7, 8}, {8, (uint32_t)-9}, {10, 42}
+    };
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            
+            cpu.setOutputCapture(true);
+            cpu.loadRaw(program);
+            cpu.writeMemory(0x2000, text, sizeof(text) - 1);
+            cpu.writeMemory(0x2100, path, strlen(path) + 1);
+            cpu.writeMemory(0x2200, iov, sizeof(iov));
+            cpu.writeMemory(0x2FFE, data, sizeof(data));
+            StopReason reason = cpu.run();
+            string output = cpu.takeOutput();
+            
+            uint32_t mode = 0;
+            uint64_t seeked = 0;
+            uint64_t position = 1;
+            int64_t nsec = -1;
+            cpu.readMemory(0x4010, &mode, 4);
+            cpu.readMemory(0x4180, &seeked, 8);
+            cpu.readMemory(0x4100, &position, 8);
+            cpu.readMemory(0x4208, &nsec, 8);
+            uint8_t file[16] = {};
+            FILE* f = fopen(path, "rb");
+            size_t size = f ? fread(file, 1, sizeof(file), f) : 0;
+            if (f) fclose(f);
+            remove(path);
+            
+            bool regsOk = true;
+            for (const auto& r : expected) regsOk = regsOk && cpu.getReg(r.first) == r.second;
+            bool hostOk = output == "hello\nhello!!\n" && size == sizeof(data) && equal(data, data + sizeof(data), file);
+            bool memoryOk = (mode & 0xF000) == 0x8000 && seeked == 4 && position == 0 && nsec >= 0 && nsec < 1000000000;
+            if (reason != StopReason::Exit || cpu.getInstructionCount() != 122 || !regsOk || !hostOk || !memoryOk) {
+                cout << "   [FAIL] " << name << ": " << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount()
+                     << " instructions, output '" << output << "'" << (memoryOk ? "" : ", bad stat/seek/clock results")
+                     << (size == sizeof(data) ? "" : ", file not written") << endl;
+                for (const auto& r : expected) {
+                    if (cpu.getReg(r.first) != r.second) cout << "      x" << dec << r.first << " = 0x" << hex << cpu.getReg(r.first) << endl;
+                }
+                pass = false;
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Files, heap and stdout behave like Linux on every engine." << endl;
+    return pass;
+}
+
+// Test 26: Guest stdout. Print syscalls (a string across a page boundary,
+// an int, one bigger than the output buffer) and write(1) reach the real
+// stdout, redirected to a file here: in order, with nothing written until
+// the guest exits.
+bool runGuestStdoutTest() {
+    cout << "[TEST] Guest Stdout (Buffered Print Syscalls)" << endl;
+    
+    vector<uint32_t> program = {
+        0x00002537, // lui x10, 2
+        0xffe50513, // addi x10, x10, -2
+        0x00400893, // addi x17, x0, 4     print "abcd\n" at 0x1FFE
+        0x00000073, // ecall
+        0xff900513, // addi x10, x0, -7
+        0x00100893, // addi x17, x0, 1     print -7
+        0x00000073, // ecall
+        0x00100513, // addi x10, x0, 1
+        0x000025b7, // lui x11, 2
+        0xffe58593, // addi x11, x11, -2
+        0x00300613, // addi x12, x0, 3
+        0x04000893, // addi x17, x0, 64    write(1, 0x1FFE, 3)
+        0x00000073, // ecall
+        0x00010537, // lui x10, 16
+        0x00400893, // addi x17, x0, 4     print the long string at 0x10000
+        0x00000073, // ecall
+        0x00002537, // lui x10, 2
+        0xffe50513, // addi x10, x10, -2
+        0x00000073, // ecall               print "abcd\n" again
+        0x05d00893, // addi x17, x0, 93
+        0x00000073  // ecall
+    };
+    const char* path = "stdout_test.txt";
+    string long_text(OutputBuffer::CAPACITY + 4000, 'x');
+    string expected = "abcd\n-7abc" + long_text + "abcd\n";
+    
+    bool pass = true;
+    vector<pair<Engine, string>> engines = { {Engine::Block, "Block"}, {Engine::Threaded, "Threaded"}, {Engine::Jit, "JIT"} };
+    vector<MemoryBackend> backends = { MemoryBackend::Paged, MemoryBackend::Reserved };
+    for (MemoryBackend backend : backends) {
+        for (const auto& engine : engines) {
+            CPU cpu;
+            cpu.setQuiet(true);
+            if (!cpu.setEngine(engine.first) || !cpu.setMemoryBackend(backend)) continue;
+            string name = engine.second + (backend == MemoryBackend::Reserved ? " (reserved)" : "");
+            
+            cpu.loadRaw(program);
+            cpu.writeMemory(0x1FFE, "abcd\n", 6);
+            cpu.writeMemory(0x10000, long_text.c_str(), long_text.size() + 1);
+            
+            // Point the host's stdout at the file while the guest runs
+            cout.flush();
+            int saved = dup(1);
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(fd, 1);
+            close(fd);
+            for (int i = 0; i < 7; i++) cpu.executeNext();  // Through the int print
+            struct stat st;
+            bool buffered = stat(path, &st) == 0 && st.st_size == 0;
+            StopReason reason = cpu.run();
+            dup2(saved, 1);
+            close(saved);
+            
+            string output;
+            FILE* f = fopen(path, "rb");
+            if (f) {
+                char chunk[4096];
+                size_t n;
+                while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) output.append(chunk, n);
+                fclose(f);
+            }
+            remove(path);
+            
+            if (reason != StopReason::Exit || cpu.getInstructionCount() != 21 || !buffered || output != expected) {
+                cout << "   [FAIL] " << name << ": " << stopReasonName(reason) << " after " << dec << cpu.getInstructionCount()
+                     << " instructions, " << output.size() << " of " << expected.size() << " bytes"
+                     << (output == expected ? "" : " (wrong)") << (buffered ? "" : ", written before exit") << endl;
+                pass = false;
+            }
+        }
+    }
+    
+    if (pass) cout << "   [PASS] Guest output reaches stdout in order, flushed at exit." << endl;
+    return pass;
+}
+
 int main() {
     cout << "=== RISC-V SIMULATOR TEST SUITE ===" << endl;
     int passed = 0;
@@ -161,6 +2447,29 @@ int main() {
     total++; if (runArithmeticTest()) passed++;
     total++; if (runMemoryTest()) passed++;
     total++; if (runFibonacciTest()) passed++;
+    total++; if (runSelfModifyingTest()) passed++;
+    total++; if (runBlockEngineTest()) passed++;
+    total++; if (runEngineTest()) passed++;
+    total++; if (runBinaryTraceTest()) passed++;
+    total++; if (runStopReasonTest()) passed++;
+    total++; if (runSparseMemoryTest()) passed++;
+    total++; if (runReservedMemoryTest()) passed++;
+    total++; if (runMisalignedAccessTest()) passed++;
+    total++; if (runZeroCopyElfTest()) passed++;
+    total++; if (runDecodeCacheTest()) passed++;
+    total++; if (runSnapshotRestoreTest()) passed++;
+    total++; if (runServerTest()) passed++;
+    total++; if (runBatchTest()) passed++;
+    total++; if (runSmpTest()) passed++;
+    total++; if (runAtomicsTest()) passed++;
+    total++; if (runMulDivTest()) passed++;
+    total++; if (runCompressedTest()) passed++;
+    total++; if (runBitManipTest()) passed++;
+    total++; if (runFloatTest()) passed++;
+    total++; if (runVectorTest()) passed++;
+    total++; if (runCounterTest()) passed++;
+    total++; if (runLinuxSyscallTest()) passed++;
+    total++; if (runGuestStdoutTest()) passed++;
     
     cout << "=== RESULTS: " << passed << "/" << total << " Tests Passed ===" << endl;
     return (passed == total) ? 0 : 1;
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include "Trace.h"
+
+using namespace std;
+
+// Decodes a binary trace written by `riscv_sim --trace` back into the
+// simulator's EXEC text format.
+
+void printUsage() {
+    cout << "Usage: ./trace_dump <trace_file> [-p]" << endl;
+    cout << "  -p : Prefix every line with the instruction's PC" << endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    bool showPc = (argc >= 3 && string(argv[2]) == "-p");
+
+    FILE* file = fopen(argv[1], "rb");
+    if (!file) {
+        cerr << "[ERROR] Cannot open " << argv[1] << endl;
+        return 1;
+    }
+
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        cerr << "[ERROR] Not a RISC-V simulator trace: " << argv[1] << endl;
+        fclose(file);
+        return 1;
+    }
+
+    vector<TraceRecord> chunk(1 << 16);
+    size_t n;
+    while ((n = fread(chunk.data(), sizeof(TraceRecord), chunk.size(), file)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            const TraceRecord& r = chunk[i];
+            if (showPc) cout << "0x" << hex << r.pc << ": ";
+            formatExec(cout, decode(r.inst), r.value, r.addr);
+        }
+    }
+    fclose(file);
+    return 0;
+}